@@ -1,12 +1,21 @@
 #include <vector>
 #include <string>
 #include <functional>
+#include <atomic>
+#include <new>
+#include <memory_resource>
 
 #include <fmt/format.h>
 #include <benchmark/benchmark.h>
 
 #include "load.h"
+#include "batch.h"
+#include "decoder.h"
+#include "probe.h"
+#include "stream.h"
+#include "save.h"
 #include "libpng.h"
+#include "blend.h"
 
 using namespace rpng;
 using namespace std;
@@ -15,25 +24,255 @@ using namespace filesystem;
 using load_fn_t = function<vector<uint8_t>(string)>;
 using tests_t = vector<pair<string, load_fn_t>>;
 
+// Count calls to the global operator new, so benchmarks can report the heap
+// allocations (and the bytes allocated, and later copied) per iteration.
+// Allocations made through malloc, e.g. by zlib and libpng, are not seen.
+atomic<size_t> num_allocs = 0, num_alloc_bytes = 0;
+
+[[gnu::noinline]] void * operator new(size_t size) {
+	num_allocs.fetch_add(1, memory_order_relaxed);
+	num_alloc_bytes.fetch_add(size, memory_order_relaxed);
+	if(void * ptr = malloc(size)) return ptr;
+	throw bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void * ptr) noexcept {
+	free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void * ptr, size_t) noexcept {
+	free(ptr);
+}
+
+struct alloc_counter_t {
+	size_t allocs = num_allocs, bytes = num_alloc_bytes;
+
+	void report(benchmark::State & state) {
+		state.counters["allocs"] = benchmark::Counter(
+			num_allocs - allocs,
+			benchmark::Counter::kAvgIterations
+		);
+		state.counters["alloc_bytes"] = benchmark::Counter(
+			num_alloc_bytes - bytes,
+			benchmark::Counter::kAvgIterations,
+			benchmark::Counter::kIs1024
+		);
+	}
+};
+
 void RunDecodeTest(benchmark::State & state, load_fn_t func, string filepath) {
+	alloc_counter_t counter;
 	for(auto _ : state) {
 		func(filepath);
 	}
+	counter.report(state);
+}
+
+// Decodes into a preallocated image with 64-byte aligned rows, reusing the
+// scratch and taking temporaries from an arena released every iteration
+void RunDecodeIntoTest(benchmark::State & state, string filepath) {
+	mapped_file_t file(filepath);
+	reader_t reader{ file.span() };
+	parse_png_header(reader);
+	auto [ihdr_data, colours] = parse_ihdr(reader);
+
+	size_t row_size = output_row_size(ihdr_data, colours, PIXEL_FORMAT_RAW);
+	size_t pitch = (row_size + 63) & ~(size_t)63;
+	vector<uint8_t> img(ihdr_data.height * pitch);
+
+	vector<uint8_t> storage(1 << 20);
+	pmr::monotonic_buffer_resource arena(
+		storage.data(), storage.size(), pmr::null_memory_resource()
+	);
+	decode_scratch_t scratch;
+	decode_options_t options{ .memory = &arena };
+	load_into(file.span(), img, pitch, scratch, options);
+
+	alloc_counter_t counter;
+	for(auto _ : state) {
+		arena.release();
+		load_into(file.span(), img, pitch, scratch, options);
+	}
+	counter.report(state);
+}
+
+// Decodes a file that is already in memory, with a fresh load() every time or
+// with one decoder_t that keeps its setup from each iteration to the next
+void RunDecoderTest(benchmark::State & state, string filepath, bool reuse) {
+	mapped_file_t file(filepath);
+	decoder_t decoder;
+	alloc_counter_t counter;
+	for(auto _ : state) {
+		if(reuse) {
+			benchmark::DoNotOptimize(decoder.decode(file.span()).data());
+		} else {
+			benchmark::DoNotOptimize(load(file.span()).data());
+		}
+	}
+	counter.report(state);
+}
+
+// The same over a set of images, one after another, as for a directory of
+// icons
+void RunDecoderCorpusTest(
+	benchmark::State & state,
+	shared_ptr<vector<vector<uint8_t>>> corpus,
+	bool reuse
+) {
+	decoder_t decoder;
+	alloc_counter_t counter;
+	for(auto _ : state) {
+		for(auto const & png : *corpus) {
+			if(reuse) {
+				benchmark::DoNotOptimize(decoder.decode(png).data());
+			} else {
+				benchmark::DoNotOptimize(load(png).data());
+			}
+		}
+	}
+	state.counters["per_image"] = benchmark::Counter(
+		state.iterations() * corpus->size(),
+		benchmark::Counter::kIsRate | benchmark::Counter::kInvert
+	);
+	counter.report(state);
+}
+
+// Reads the header of every file: by mapping it, as load() does, or with
+// probe(), serially or batched over a pool of range(0) threads
+void RunProbeTest(
+	benchmark::State & state,
+	shared_ptr<vector<string>> filepaths,
+	bool mapped
+) {
+	int num_threads = state.range(0);
+	unique_ptr<batch_decoder_t> batch;
+	if(num_threads > 0) batch = make_unique<batch_decoder_t>(num_threads);
+
+	for(auto _ : state) {
+		if(batch) {
+			benchmark::DoNotOptimize(batch->probe_all(*filepaths).data());
+			continue;
+		}
+		for(string const & filepath : *filepaths) {
+			if(mapped) {
+				mapped_file_t file(filepath);
+				reader_t reader{ file.span() };
+				parse_png_header(reader);
+				benchmark::DoNotOptimize(parse_ihdr(reader));
+			} else {
+				benchmark::DoNotOptimize(probe(filepath));
+			}
+		}
+	}
+	state.counters["per_file"] = benchmark::Counter(
+		state.iterations() * filepaths->size(),
+		benchmark::Counter::kIsRate | benchmark::Counter::kInvert
+	);
+}
+
+// Feeds a file to the push-mode decoder in pieces of one TCP segment, and
+// reports how far into the file the first row came out
+void RunStreamTest(benchmark::State & state, string filepath) {
+	constexpr size_t segment = 1460;
+	mapped_file_t file(filepath);
+	span<uint8_t const> png = file.span();
+
+	size_t fed = 0, first_row_at = 0;
+	bool first = true;
+	stream_decoder_t decoder([&](
+		reduced_image_t const &, int, span<uint8_t const> row
+	) {
+		if(first) first_row_at = fed + segment;
+		first = false;
+		benchmark::DoNotOptimize(row.data());
+	});
+
+	for(auto _ : state) {
+		first = true;
+		for(fed = 0; fed < png.size(); fed += segment) {
+			decoder.feed(png.subspan(fed, min(segment, png.size() - fed)));
+		}
+		decoder.finish();
+		decoder.reset();
+	}
+	state.counters["first_row_at"] =
+		(double)min(first_row_at, png.size()) / png.size();
 }
 
 void RunParseTest(benchmark::State & state, string filepath) {
 	for(auto _ : state) {
-		ifstream ifs(filepath, ios::binary);
-		parse_png_header(ifs);
-		parse_ihdr(ifs);
-		pack_idat_chunks(ifs);
+		mapped_file_t file(filepath);
+		reader_t reader{ file.span() };
+		parse_png_header(reader);
+		parse_ihdr(reader);
+		pack_idat_chunks(reader);
 	}
 }
 
-void RunInflateTest(benchmark::State & state, vector<uint8_t> packed) {
+void RunInflateTest(benchmark::State & state, string filepath) {
+	mapped_file_t file(filepath);
+	reader_t reader{ file.span() };
+	parse_png_header(reader);
+	parse_ihdr(reader);
+	auto packed = pack_idat_chunks(reader);
+
+	alloc_counter_t counter;
 	for(auto _ : state) {
 		inflate(packed);
 	}
+	counter.report(state);
+}
+
+void RunInflateExactTest(benchmark::State & state, string filepath) {
+	mapped_file_t file(filepath);
+	reader_t reader{ file.span() };
+	parse_png_header(reader);
+	auto [ihdr_data, colours] = parse_ihdr(reader);
+	auto packed = pack_idat_chunks(reader);
+	image_layout_t layout = image_layout(ihdr_data, colours);
+
+	alloc_counter_t counter;
+	for(auto _ : state) {
+		vector<uint8_t> filtered(layout.filtered_size);
+		inflate_exact(packed, filtered);
+	}
+	counter.report(state);
+}
+
+// Inflates the whole datastream into a buffer sized from IHDR with one
+// backend, reusing its state and the buffer as a decode does
+void inflate_backend_loop(
+	benchmark::State & state,
+	span<uint8_t const> png,
+	inflate_backend_t backend
+) {
+	if(!inflate_backend_available(backend)) {
+		state.SkipWithError("backend not available");
+		return;
+	}
+
+	reader_t reader{ png };
+	parse_png_header(reader);
+	auto [ihdr_data, colours] = parse_ihdr(reader);
+	auto packed = pack_idat_chunks(reader);
+	image_layout_t layout = image_layout(ihdr_data, colours);
+
+	decode_scratch_t scratch;
+	vector<uint8_t> filtered(layout.filtered_size);
+	pmr::memory_resource * memory = pmr::get_default_resource();
+	for(auto _ : state) {
+		inflate_whole(packed, filtered, backend, scratch, memory);
+	}
+	state.SetBytesProcessed(state.iterations() * filtered.size());
+}
+
+void RunInflateBackendTest(
+	benchmark::State & state,
+	string filepath,
+	inflate_backend_t backend
+) {
+	mapped_file_t file(filepath);
+	inflate_backend_loop(state, file.span(), backend);
 }
 
 void RunReconstructTest(
@@ -58,6 +297,394 @@ void RunDeinterlaceTest(
 	}
 }
 
+// Reconstructs in place and scatters straight into the final image, from a
+// fresh copy of the datastream each iteration
+void RunFusedDeinterlaceTest(
+	benchmark::State & state,
+	vector<uint8_t> filtered,
+	chunk_ihdr_data_t ihdr_data,
+	colour_properties_t colours
+) {
+	image_layout_t layout = image_layout(ihdr_data, colours);
+	for(auto _ : state) {
+		vector<uint8_t> work = filtered;
+		vector<uint8_t> raw(layout.raw_size);
+		reconstruct_deinterlace(
+			work, layout, ihdr_data.height, raw.data(), layout.bytes_per_row
+		);
+		benchmark::DoNotOptimize(raw.data());
+	}
+}
+
+// Decodes the whole corpus per iteration with a batch decoder of
+// state.range(0) threads
+void RunThroughputTest(
+	benchmark::State & state,
+	shared_ptr<vector<vector<uint8_t>>> corpus
+) {
+	vector<span<uint8_t const>> bufs(corpus->begin(), corpus->end());
+	batch_decoder_t batch(state.range(0));
+
+	size_t decoded_bytes = 0;
+	for(auto _ : state) {
+		for(auto & image : batch.load_all(bufs)) {
+			decoded_bytes += image.get().size();
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * bufs.size());
+	state.SetBytesProcessed(decoded_bytes);
+}
+
+// Decodes a whole image per iteration with the given inflate backend, with
+// or without checking the CRCs and Adler-32
+void RunBackendDecodeTest(
+	benchmark::State & state,
+	shared_ptr<vector<uint8_t>> png,
+	inflate_backend_t backend,
+	bool verify
+) {
+	if(!inflate_backend_available(backend)) {
+		state.SkipWithError("backend not available");
+		return;
+	}
+
+	decode_options_t options{ .inflate = backend, .verify_checksums = verify };
+	size_t size = 0;
+	for(auto _ : state) {
+		size = load(*png, options).size();
+	}
+	state.SetBytesProcessed(state.iterations() * size);
+}
+
+// Checksums a buffer per iteration
+void RunChecksumTest(
+	benchmark::State & state,
+	shared_ptr<vector<uint8_t>> data,
+	function<uint32_t(span<uint8_t const>)> checksum
+) {
+	for(auto _ : state) {
+		benchmark::DoNotOptimize(checksum(*data));
+	}
+	state.SetBytesProcessed(state.iterations() * data->size());
+}
+
+// Blends a sticker-like row, mostly opaque or clear with antialiased edges,
+// over an opaque canvas row
+void RunBlendTest(benchmark::State & state, simd_level_t level) {
+	constexpr int width = 4096;
+	vector<uint8_t> src(4 * width), dst(4 * width, 0xff), canvas = dst;
+	uint32_t noise = 1;
+	for(int i = 0; i < 4 * width; i++) {
+		noise = noise * 1664525 + 1013904223;
+		src[i] = noise >> 24;
+		if(i % 4 == 3 && (noise >> 8 & 7)) src[i] = (i / 256) % 2 ? 255 : 0;
+	}
+
+	blend_fn_t blend = blend_kernel(level);
+	for(auto _ : state) {
+		memcpy(dst.data(), canvas.data(), dst.size());
+		blend(dst.data(), src.data(), width);
+		benchmark::DoNotOptimize(dst.data());
+	}
+	state.SetBytesProcessed(state.iterations() * src.size());
+}
+
+// Decodes one large image per iteration with the two-stage pipeline on or off
+void RunPipelineTest(
+	benchmark::State & state,
+	shared_ptr<vector<uint8_t>> png,
+	bool pipeline
+) {
+	decode_options_t options{ .pipeline = pipeline };
+	for(auto _ : state) {
+		load(*png, options);
+	}
+}
+
+// Smooth gradients with a little noise, compressing roughly like a photo
+vector<uint8_t> synthetic_image(int width, int height, int channels) {
+	vector<uint8_t> img((size_t)width * height * channels);
+	uint32_t noise = 1;
+	for(int y = 0; y < height; y++) {
+		for(int x = 0; x < width; x++) {
+			for(int c = 0; c < channels; c++) {
+				noise = noise * 1664525 + 1013904223;
+				img[((size_t)y * width + x) * channels + c]
+					= (x * (c + 1) + y * (3 - c)) / 8 + (noise >> 29);
+			}
+		}
+	}
+	return img;
+}
+
+// Flat panels with lines of "text", compressing roughly like a screenshot
+vector<uint8_t> synthetic_ui(int width, int height, int channels) {
+	vector<uint8_t> img((size_t)width * height * channels);
+	uint32_t noise = 1;
+	for(int y = 0; y < height; y++) {
+		for(int x = 0; x < width; x++) {
+			int panel = (x / 320) + (y / 240) * 7;
+			bool text = (y % 24) < 12 && (x % 320) > 16 && (x % 320) < 300;
+			if(text) noise = noise * 1664525 + 1013904223;
+			bool ink = text && (noise >> 30) == 0;
+			for(int c = 0; c < channels; c++) {
+				img[((size_t)y * width + x) * channels + c] = ink
+					? 32
+					: c == 3 ? 255 : 200 + panel * (c + 3) % 50;
+			}
+		}
+	}
+	return img;
+}
+
+// Encodes one image per iteration with `func`, reporting raw bytes per second
+// and the size of the encoded datastream
+void RunEncodeTest(
+	benchmark::State & state,
+	shared_ptr<vector<uint8_t>> img,
+	function<vector<uint8_t>()> func
+) {
+	size_t size = 0;
+	for(auto _ : state) {
+		size = func().size();
+	}
+	state.SetBytesProcessed(state.iterations() * img->size());
+	state.counters["size"] = benchmark::Counter(
+		size, benchmark::Counter::kDefaults, benchmark::Counter::kIs1024
+	);
+	state.counters["ratio"] = (double)size / img->size();
+}
+
+// Encodes bands in parallel on a pool of state.range(0) threads, optionally
+// writing a segment index
+void RunParallelEncodeTest(
+	benchmark::State & state,
+	shared_ptr<vector<uint8_t>> img,
+	chunk_ihdr_data_t ihdr,
+	bool segment_index
+) {
+	thread_pool_t pool(state.range(0));
+	encode_options_t options{ .pool = &pool, .segment_index = segment_index };
+
+	size_t size = 0;
+	for(auto _ : state) {
+		size = save(*img, ihdr, options).size();
+	}
+	state.SetBytesProcessed(state.iterations() * img->size());
+	state.counters["size"] = benchmark::Counter(
+		size, benchmark::Counter::kDefaults, benchmark::Counter::kIs1024
+	);
+	state.counters["ratio"] = (double)size / img->size();
+}
+
+void RegisterEncodeTests() {
+	int width = 1024, height = 1024, level = 6;
+	auto img = make_shared<vector<uint8_t>>(synthetic_image(width, height, 3));
+	chunk_ihdr_data_t ihdr{
+		(uint32_t)width, (uint32_t)height, 8, COLOUR_TYPE_TRUECOLOUR, 0, 0, 0
+	};
+
+	string prefix = fmt::format("encode/{}x{}", width, height);
+	for(int effort : { 0, 1, 2 }) {
+		string testname = fmt::format("{}/rpng/effort{}", prefix, effort);
+		benchmark::RegisterBenchmark(
+			testname.c_str(),
+			RunEncodeTest,
+			img,
+			[=] {
+				return save(*img, ihdr, {
+					.compression_level = level,
+					.effort = effort
+				});
+			}
+		)->Unit(benchmark::kMillisecond);
+	}
+
+	string fastname = fmt::format("{}/rpng/fast", prefix);
+	benchmark::RegisterBenchmark(
+		fastname.c_str(),
+		RunEncodeTest,
+		img,
+		[=] { return save(*img, ihdr, { .fast = true }); }
+	)->Unit(benchmark::kMillisecond);
+
+	int max_threads = max<int>(thread::hardware_concurrency(), 1);
+	for(bool indexed : { false, true }) {
+		string testname = fmt::format(
+			"{}/rpng/{}", prefix, indexed ? "indexed" : "primed"
+		);
+		auto * bench = benchmark::RegisterBenchmark(
+			testname.c_str(),
+			RunParallelEncodeTest,
+			img,
+			ihdr,
+			indexed
+		);
+		for(int n = 1; n < max_threads; n *= 2) bench->Arg(n);
+		bench->Arg(max_threads)
+			->ArgName("threads")
+			->UseRealTime()
+			->Unit(benchmark::kMillisecond);
+	}
+
+	// libpng's default filter heuristic matches effort 1
+	string testname = fmt::format("{}/libpng", prefix);
+	benchmark::RegisterBenchmark(
+		testname.c_str(),
+		RunEncodeTest,
+		img,
+		[=] {
+			return encode(*img, width, height, 8, PNG_COLOR_TYPE_RGB, level);
+		}
+	)->Unit(benchmark::kMillisecond);
+
+	// screenshots, where the fast profile is meant to be used
+	int ui_width = 1920, ui_height = 1080;
+	auto ui = make_shared<vector<uint8_t>>(synthetic_ui(ui_width, ui_height, 4));
+	chunk_ihdr_data_t ui_ihdr{
+		(uint32_t)ui_width, (uint32_t)ui_height,
+		8, COLOUR_TYPE_TRUECOLOUR_ALPHA, 0, 0, 0
+	};
+	string ui_prefix = fmt::format("encode/ui{}x{}", ui_width, ui_height);
+
+	vector<pair<string, function<vector<uint8_t>()>>> ui_tests{
+		{ "rpng/fast", [=] { return save(*ui, ui_ihdr, { .fast = true }); } },
+		{ "rpng/level1", [=] {
+			return save(*ui, ui_ihdr, { .compression_level = 1 });
+		} },
+		{ "libpng/level1", [=] {
+			return encode(
+				*ui, ui_width, ui_height, 8, PNG_COLOR_TYPE_RGBA, 1
+			);
+		} }
+	};
+	for(auto const & [suffix, func] : ui_tests) {
+		string testname = fmt::format("{}/{}", ui_prefix, suffix);
+		benchmark::RegisterBenchmark(
+			testname.c_str(),
+			RunEncodeTest,
+			ui,
+			func
+		)->Unit(benchmark::kMillisecond);
+	}
+}
+
+void RegisterPipelineTests() {
+	int width = 4096, height = 2048;
+	auto png = make_shared<vector<uint8_t>>(encode(
+		synthetic_image(width, height, 3),
+		width, height,
+		8, PNG_COLOR_TYPE_RGB
+	));
+
+	for(bool pipeline : { false, true }) {
+		string testname = fmt::format(
+			"pipeline/{}x{}/{}", width, height, pipeline ? "on" : "off"
+		);
+		benchmark::RegisterBenchmark(
+			testname.c_str(),
+			RunPipelineTest,
+			png,
+			pipeline
+		)->UseRealTime()->Unit(benchmark::kMillisecond);
+	}
+}
+
+// Each inflate backend on large images, beside the small pngsuite files:
+// inflating alone, and decoding whole images
+void RegisterInflateTests() {
+	int width = 4096, height = 2048;
+	int ui_width = 1920, ui_height = 1080;
+	vector<pair<string, shared_ptr<vector<uint8_t>>>> images{
+		{ fmt::format("photo{}x{}", width, height),
+			make_shared<vector<uint8_t>>(encode(
+				synthetic_image(width, height, 3),
+				width, height, 8, PNG_COLOR_TYPE_RGB
+			)) },
+		{ fmt::format("ui{}x{}", ui_width, ui_height),
+			make_shared<vector<uint8_t>>(encode(
+				synthetic_ui(ui_width, ui_height, 4),
+				ui_width, ui_height, 8, PNG_COLOR_TYPE_RGBA
+			)) }
+	};
+
+	for(auto const & [name, png] : images) {
+		for(inflate_backend_t backend : {
+			INFLATE_BACKEND_ZLIB, INFLATE_BACKEND_LIBDEFLATE,
+			INFLATE_BACKEND_BUILTIN
+		}) {
+			string testname = fmt::format(
+				"inflate/{}/{}", name, inflate_backend_name(backend)
+			);
+			benchmark::RegisterBenchmark(
+				testname.c_str(),
+				[png](benchmark::State & state, inflate_backend_t backend) {
+					inflate_backend_loop(state, *png, backend);
+				},
+				backend
+			)->Unit(benchmark::kMillisecond);
+
+			for(bool verify : { true, false }) {
+				string decodename = fmt::format(
+					"decode/{}/{}{}", name, inflate_backend_name(backend),
+					verify ? "" : "/unchecked"
+				);
+				benchmark::RegisterBenchmark(
+					decodename.c_str(),
+					RunBackendDecodeTest,
+					png,
+					backend,
+					verify
+				)->Unit(benchmark::kMillisecond);
+			}
+		}
+	}
+}
+
+// zlib's checksums against rpng's, on a buffer the size of a large IDAT
+// datastream
+void RegisterChecksumTests() {
+	auto data = make_shared<vector<uint8_t>>(4 << 20);
+	uint32_t noise = 1;
+	for(uint8_t & byte : *data) {
+		noise = noise * 1664525 + 1013904223;
+		byte = noise >> 24;
+	}
+
+	vector<pair<string, function<uint32_t(span<uint8_t const>)>>> checksums{
+		{ "crc32/zlib", [](span<uint8_t const> in) {
+			return (uint32_t)crc32_z(0, in.data(), in.size());
+		} },
+		{ "crc32/rpng", [](span<uint8_t const> in) {
+			return update_crc32(0, in.data(), in.size());
+		} },
+		{ "crc32/slice16", [](span<uint8_t const> in) {
+			return ~crc32_slice16(~0u, in.data(), in.size());
+		} },
+		{ "adler32/zlib", [](span<uint8_t const> in) {
+			return (uint32_t)adler32_z(1, in.data(), in.size());
+		} },
+		{ "adler32/rpng", [](span<uint8_t const> in) {
+			return update_adler32(1, in.data(), in.size());
+		} }
+	};
+	for(auto const & [name, checksum] : checksums) {
+		string testname = fmt::format("checksum/{}", name);
+		benchmark::RegisterBenchmark(
+			testname.c_str(), RunChecksumTest, data, checksum
+		)->Unit(benchmark::kMicrosecond);
+	}
+}
+
+void RegisterBlendTests() {
+	for(int level = SIMD_SCALAR; level <= simd_level(); level++) {
+		string testname = fmt::format("blend/level{}", level);
+		benchmark::RegisterBenchmark(
+			testname.c_str(), RunBlendTest, (simd_level_t)level
+		)->Unit(benchmark::kMicrosecond);
+	}
+}
+
 vector<path> pngsuite() {
 	vector<path> pngs;
 	path pngdir("resources/pngsuite");
@@ -96,6 +723,35 @@ void RegisterTests(tests_t tests) {
 
 		string prefix = fmt::format("decode/{}/rpng", stem);
 
+		// into caller memory, without allocating
+		string testname_into = fmt::format("{}/into", prefix);
+		benchmark::RegisterBenchmark(
+			testname_into.c_str(),
+			RunDecodeIntoTest,
+			file.string()
+		)->Unit(benchmark::kMicrosecond);
+
+		// from memory, with and without a reused decoder
+		for(bool reuse : { false, true }) {
+			string testname_decoder = fmt::format(
+				"{}/{}", prefix, reuse ? "decoder" : "buffer"
+			);
+			benchmark::RegisterBenchmark(
+				testname_decoder.c_str(),
+				RunDecoderTest,
+				file.string(),
+				reuse
+			)->Unit(benchmark::kMicrosecond);
+		}
+
+		// pushed a segment at a time
+		string testname_stream = fmt::format("{}/stream", prefix);
+		benchmark::RegisterBenchmark(
+			testname_stream.c_str(),
+			RunStreamTest,
+			file.string()
+		)->Unit(benchmark::kMicrosecond);
+
 		// Load file into memory and combine chunks
 		string testname_parse = fmt::format("{}/parse", prefix);
 		benchmark::RegisterBenchmark(
@@ -104,12 +760,13 @@ void RegisterTests(tests_t tests) {
 			file.string()
 		)->Unit(benchmark::kMicrosecond);
 
-		auto [ihdr_data, colours, packed] = [](string filepath) {
-			ifstream ifs(filepath, ios::binary);
-			parse_png_header(ifs);
-			auto [ihdr_data, colours] = parse_ihdr(ifs);
-			vector<uint8_t> packed = pack_idat_chunks(ifs); 
-			return tuple(ihdr_data, colours, packed);
+		auto [ihdr_data, colours, filtered] = [](string filepath) {
+			mapped_file_t file(filepath);
+			reader_t reader{ file.span() };
+			parse_png_header(reader);
+			auto [ihdr_data, colours] = parse_ihdr(reader);
+			vector<uint8_t> filtered = inflate(pack_idat_chunks(reader));
+			return tuple(ihdr_data, colours, filtered);
 		}(file.string());
 
 		// inflate packed datastream
@@ -117,9 +774,31 @@ void RegisterTests(tests_t tests) {
 		benchmark::RegisterBenchmark(
 			testname_inflate.c_str(),
 			RunInflateTest,
-			packed
+			file.string()
 		)->Unit(benchmark::kMicrosecond);
-		auto filtered = inflate(packed);
+
+		// inflate packed datastream into a buffer sized from IHDR
+		string testname_inflate_exact = fmt::format("{}/inflate_exact", prefix);
+		benchmark::RegisterBenchmark(
+			testname_inflate_exact.c_str(),
+			RunInflateExactTest,
+			file.string()
+		)->Unit(benchmark::kMicrosecond);
+
+		for(inflate_backend_t backend : {
+			INFLATE_BACKEND_ZLIB, INFLATE_BACKEND_LIBDEFLATE,
+			INFLATE_BACKEND_BUILTIN
+		}) {
+			string testname_backend = fmt::format(
+				"{}/inflate/{}", prefix, inflate_backend_name(backend)
+			);
+			benchmark::RegisterBenchmark(
+				testname_backend.c_str(),
+				RunInflateBackendTest,
+				file.string(),
+				backend
+			)->Unit(benchmark::kMicrosecond);
+		}
 
 		// reconstruct filtered datastream
 		string testname_reconstruct = fmt::format("{}/reconstruct", prefix);
@@ -132,6 +811,33 @@ void RegisterTests(tests_t tests) {
 		)->Unit(benchmark::kMicrosecond);
 		auto reconstructed = reconstruct(filtered, ihdr_data, colours);
 
+		// encode the decoded image, interlaced sources as non-interlaced
+		auto img = make_shared<vector<uint8_t>>(load(file.string()));
+		auto palette = make_shared<vector<uint8_t>>();
+		if(ihdr_data.colour_type == COLOUR_TYPE_INDEXED_COLOUR) {
+			for(int i = 0; i < 3 << ihdr_data.bit_depth; i++)
+				palette->push_back(i / 3);
+		}
+		chunk_ihdr_data_t encode_ihdr = ihdr_data;
+		encode_ihdr.interlace = 0;
+
+		for(bool fast : { true, false }) {
+			string testname_encode = fmt::format(
+				"encode/{}/rpng{}", stem, fast ? "/fast" : ""
+			);
+			benchmark::RegisterBenchmark(
+				testname_encode.c_str(),
+				RunEncodeTest,
+				img,
+				[=] {
+					return save(*img, encode_ihdr, {
+						.fast = fast,
+						.palette = *palette
+					});
+				}
+			)->Unit(benchmark::kMicrosecond);
+		}
+
 		if(!ihdr_data.interlace) continue;
 
 		// deinterlace reconstructed datastream
@@ -143,13 +849,99 @@ void RegisterTests(tests_t tests) {
 			ihdr_data,
 			colours
 		)->Unit(benchmark::kMicrosecond);
+
+		// both at once, without the packed reconstructed image
+		string testname_fused = fmt::format(
+			"{}/reconstruct+deinterlace", prefix
+		);
+		benchmark::RegisterBenchmark(
+			testname_fused.c_str(),
+			RunFusedDeinterlaceTest,
+			filtered,
+			ihdr_data,
+			colours
+		)->Unit(benchmark::kMicrosecond);
+	}
+}
+
+void RegisterThroughputTests() {
+	auto corpus = make_shared<vector<vector<uint8_t>>>();
+	for(auto const & file : pngsuite()) {
+		mapped_file_t mapped(file.string());
+		corpus->emplace_back(mapped.span().begin(), mapped.span().end());
 	}
+
+	// the sprite-sized images, whose setup is a large part of their decode
+	auto sprites = make_shared<vector<vector<uint8_t>>>();
+	for(auto const & png : *corpus) {
+		reader_t reader{ png };
+		parse_png_header(reader);
+		auto [ihdr_data, colours] = parse_ihdr(reader);
+		if(ihdr_data.width <= 32 && ihdr_data.height <= 32)
+			sprites->push_back(png);
+	}
+	for(bool reuse : { false, true }) {
+		benchmark::RegisterBenchmark(
+			reuse ? "overhead/sprites/decoder" : "overhead/sprites/load",
+			RunDecoderCorpusTest,
+			sprites,
+			reuse
+		)->Unit(benchmark::kMicrosecond);
+	}
+
+	auto * bench = benchmark::RegisterBenchmark(
+		"throughput/pngsuite",
+		RunThroughputTest,
+		corpus
+	);
+	int max_threads = max<int>(thread::hardware_concurrency(), 1);
+	for(int n = 1; n < max_threads; n *= 2) bench->Arg(n);
+	bench->Arg(max_threads)
+		->ArgName("threads")
+		->UseRealTime()
+		->Unit(benchmark::kMillisecond);
+}
+
+void RegisterProbeTests() {
+	auto filepaths = make_shared<vector<string>>();
+	for(auto const & file : pngsuite()) filepaths->push_back(file.string());
+
+	benchmark::RegisterBenchmark(
+		"probe/pngsuite/mapped", RunProbeTest, filepaths, true
+	)->Arg(0)->Unit(benchmark::kMicrosecond);
+	auto * bench = benchmark::RegisterBenchmark(
+		"probe/pngsuite/pread", RunProbeTest, filepaths, false
+	);
+	int max_threads = max<int>(thread::hardware_concurrency(), 1);
+	bench->Arg(0);
+	for(int n = 1; n < max_threads; n *= 2) bench->Arg(n);
+	bench->Arg(max_threads)
+		->ArgName("threads")
+		->UseRealTime()
+		->Unit(benchmark::kMicrosecond);
 }
 
 int main(int argc, char ** argv) {
+	RegisterProbeTests();
+	RegisterThroughputTests();
+	RegisterPipelineTests();
+	RegisterInflateTests();
+	RegisterChecksumTests();
+	RegisterBlendTests();
+	RegisterEncodeTests();
 	RegisterTests({
-		{ "rpng", load },
-		{ "libpng", decode }
+		{ "rpng", [](string filepath) { return load(filepath); } },
+		{ "libpng", [](string filepath) { return decode(filepath); } },
+		{ "rpng/rgba8", [](string filepath) {
+			return load(filepath, { .format = PIXEL_FORMAT_RGBA8 });
+		} },
+		{ "libpng/rgba8", [](string filepath) { return decode(filepath, 8); } },
+		{ "rpng/libdeflate", [](string filepath) {
+			return load(filepath, { .inflate = INFLATE_BACKEND_LIBDEFLATE });
+		} },
+		{ "rpng/builtin", [](string filepath) {
+			return load(filepath, { .inflate = INFLATE_BACKEND_BUILTIN });
+		} }
 	});
 
 	benchmark::Initialize(&argc, argv);
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "load.h"
+#include "blend.h"
+#include "options.h"
+#include "chunk/actl.h"
+#include "chunk/fctl.h"
+
+namespace rpng {
+
+// A rendered frame of an animation. `canvas` stays valid until another frame
+// is rendered.
+struct animation_frame_t {
+	uint32_t index;
+	frame_control_t const & control;
+	std::span<uint8_t const> canvas;
+};
+
+// Decodes an animated PNG a frame at a time onto one canvas of the image's
+// size, as RGBA8, or BGRA8 if options.format asks for it. Frames are rendered
+// when asked for, carrying on from the frame shown last, or from the start if
+// the frame comes before it; either way, from the last frame in between that
+// replaces the whole canvas. However many frames there are, memory stays at
+// three canvases at most: the canvas, a frame to be blended over it, and what
+// a frame disposed of with DISPOSE_OP_PREVIOUS covered. A PNG without acTL is
+// an animation of its one image. `buf` must outlive the decoder.
+//
+// Frames inflate piecewise, so libdeflate is replaced with zlib here.
+class animation_decoder_t {
+private:
+	struct frame_t {
+		frame_control_t control;
+		size_t begin;		// of the chunks after its fcTL
+		size_t end;			// of the next fcTL, or of the file
+		bool idat;			// whether the frame is the default image
+	};
+
+	std::span<uint8_t const> buf;
+	bool verify;
+	chunk_ihdr_data_t ihdr_data;
+	colour_properties_t colours;
+	animation_control_t animation{ 1, 0 };
+	std::vector<frame_t> frames;
+	std::optional<pixel_converter_t> converter;
+
+	decode_scratch_t scratch;
+	std::vector<uint8_t> canvas;
+	std::vector<uint8_t> pixels;		// a frame to blend over the canvas
+	std::vector<uint8_t> saved;			// the region to restore
+	std::vector<uint8_t> buffer;		// a converted row of an Adam7 pass
+	size_t shown = 0;					// the canvas has frame shown - 1
+
+public:
+	explicit animation_decoder_t(
+		std::span<uint8_t const> buf,
+		decode_options_t const & options = {}
+	) : buf(buf), verify(options.verify_checksums) {
+		pixel_format_t format = options.format;
+		if(format == PIXEL_FORMAT_RAW) format = PIXEL_FORMAT_RGBA8;
+		if(format != PIXEL_FORMAT_RGBA8 && format != PIXEL_FORMAT_BGRA8)
+			throw std::runtime_error(fmt::format(
+				"Animations are composited as RGBA8 or BGRA8, not format {}",
+				(int)format
+			));
+
+		reader_t reader{ buf };
+		parse_png_header(reader);
+		std::tie(ihdr_data, colours) = parse_ihdr(reader, verify);
+		colour_chunks_t chunks = find_colour_chunks(reader, verify);
+		converter.emplace(
+			ihdr_data, colours, format, chunks.palette, chunks.transparency
+		);
+
+		index_frames(reader);
+		canvas.resize((size_t)ihdr_data.height * row_size());
+
+		inflate_backend_t backend = options.inflate;
+		scratch.inflater.use_builtin(backend == INFLATE_BACKEND_BUILTIN);
+		scratch.inflater.verify_checksum(verify);
+	}
+
+	animation_decoder_t(animation_decoder_t const &) = delete;
+	animation_decoder_t & operator=(animation_decoder_t const &) = delete;
+
+	chunk_ihdr_data_t const & ihdr() const {
+		return ihdr_data;
+	}
+
+	// Bytes per row of the canvas
+	size_t row_size() const {
+		return (size_t)ihdr_data.width * 4;
+	}
+
+	uint32_t num_frames() const {
+		return frames.size();
+	}
+
+	// Times to play the animation, 0 for indefinitely
+	uint32_t num_plays() const {
+		return animation.num_plays;
+	}
+
+	frame_control_t const & frame_control(uint32_t n) const {
+		return frames.at(n).control;
+	}
+
+	// Renders frame `n` onto the canvas
+	std::span<uint8_t const> frame(uint32_t n) {
+		if(n >= frames.size())
+			throw std::runtime_error(fmt::format(
+				"No frame {} in an animation of {}", n, frames.size()
+			));
+		if(shown == n + 1) return canvas;
+
+		size_t start = n < shown ? 0 : shown;
+		for(size_t k = n; k > start; k--) {
+			if(replaces_canvas(frames[k].control)) {
+				start = k;
+				break;
+			}
+		}
+
+		// carrying on from the frame on the canvas, that frame is disposed of
+		// first; otherwise the canvas is cleared, or replaced outright
+		bool resumed = start == shown && start > 0;
+		shown = 0;			// until rendered, in case decoding fails
+		for(size_t k = start; k <= n; k++) render(k, k > start || resumed);
+		shown = n + 1;
+		return canvas;
+	}
+
+	class iterator {
+	private:
+		animation_decoder_t * decoder;
+		uint32_t index;
+
+	public:
+		iterator(animation_decoder_t * decoder, uint32_t index)
+			: decoder(decoder), index(index) {}
+
+		animation_frame_t operator*() const {
+			std::span<uint8_t const> canvas = decoder->frame(index);
+			return { index, decoder->frame_control(index), canvas };
+		}
+
+		iterator & operator++() {
+			index++;
+			return *this;
+		}
+
+		bool operator==(iterator const & other) const {
+			return index == other.index;
+		}
+	};
+
+	// Every frame in order, rendered as the iterator is dereferenced
+	iterator begin() {
+		return { this, 0 };
+	}
+
+	iterator end() {
+		return { this, num_frames() };
+	}
+
+private:
+	// Finds each frame's fcTL and the chunks that follow, checking the
+	// sequence numbers of everything but the frame data
+	void index_frames(reader_t & reader) {
+		size_t image_begin = reader.pos;
+		bool animated = false, seen_idat = false;
+		uint32_t sequence = 0;
+
+		while(!reader.eof()) {
+			size_t chunk_begin = reader.pos;
+			chunk_t chunk = parse_chunk(reader, false);
+			bool control = chunk.type == CHUNK_TYPE_ACTL
+				|| chunk.type == CHUNK_TYPE_FCTL;
+			if(verify && control) check_chunk_crc(chunk);
+
+			switch(chunk.type) {
+			case CHUNK_TYPE_IDAT:
+				seen_idat = true;
+				break;
+			case CHUNK_TYPE_ACTL:
+				if(seen_idat || animated) {
+					SPDLOG_WARN("Ignoring acTL after the image data");
+					break;
+				}
+				animation = parse_actl(chunk.data);
+				animated = true;
+				break;
+			case CHUNK_TYPE_FCTL: {
+				if(!animated) break;
+				frame_control_t control = parse_fctl(chunk.data, ihdr_data);
+				if(control.sequence_number != sequence)
+					throw std::runtime_error(fmt::format(
+						"fcTL with sequence number {} where {} was expected",
+						control.sequence_number, sequence
+					));
+				sequence++;
+
+				bool whole = control.x_offset == 0 && control.y_offset == 0
+					&& control.width == ihdr_data.width
+					&& control.height == ihdr_data.height;
+				if(!seen_idat && !whole)
+					throw std::runtime_error(
+						"The default image is a frame, but not the whole image"
+					);
+
+				if(!frames.empty()) frames.back().end = chunk_begin;
+				frames.push_back({ control, reader.pos, buf.size(), !seen_idat });
+				break;
+			}
+			case CHUNK_TYPE_FDAT:
+				if(!animated) break;
+				if(frames.empty() || frames.back().idat)
+					throw std::runtime_error("fdAT without its own fcTL");
+				sequence++;
+				break;
+			}
+		}
+
+		if(!animated) {
+			frame_control_t whole{
+				0, ihdr_data.width, ihdr_data.height, 0, 0, 0, 0,
+				DISPOSE_OP_NONE, BLEND_OP_SOURCE
+			};
+			frames.push_back({ whole, image_begin, buf.size(), true });
+		} else if(frames.size() != animation.num_frames) {
+			throw std::runtime_error(fmt::format(
+				"acTL promises {} frames, but there are {}",
+				animation.num_frames, frames.size()
+			));
+		}
+	}
+
+	bool replaces_canvas(frame_control_t const & control) const {
+		return control.blend_op == BLEND_OP_SOURCE
+			&& control.dispose_op != DISPOSE_OP_PREVIOUS
+			&& control.x_offset == 0 && control.y_offset == 0
+			&& control.width == ihdr_data.width
+			&& control.height == ihdr_data.height;
+	}
+
+	uint8_t * region(frame_control_t const & control) {
+		return canvas.data() + control.y_offset * row_size()
+			+ (size_t)control.x_offset * 4;
+	}
+
+	// Renders frame `n`, after disposing of the previous frame if `dispose`
+	// and else clearing the canvas for the first frame
+	void render(size_t n, bool dispose) {
+		frame_control_t const & control = frames[n].control;
+		size_t pitch = row_size();
+		size_t frame_row_size = (size_t)control.width * 4;
+
+		if(dispose) {
+			frame_control_t const & previous = frames[n - 1].control;
+			uint8_t * dst = region(previous);
+			size_t size = (size_t)previous.width * 4;
+			for(uint32_t y = 0; y < previous.height; y++, dst += pitch) {
+				if(previous.dispose_op == DISPOSE_OP_BACKGROUND)
+					memset(dst, 0, size);
+				else if(previous.dispose_op == DISPOSE_OP_PREVIOUS)
+					memcpy(dst, saved.data() + y * size, size);
+			}
+		} else if(n == 0) {
+			std::fill(canvas.begin(), canvas.end(), 0);
+		}
+
+		// DISPOSE_OP_PREVIOUS on the first frame restores the cleared canvas,
+		// as the specification's DISPOSE_OP_BACKGROUND would
+		uint8_t * dst = region(control);
+		if(control.dispose_op == DISPOSE_OP_PREVIOUS) {
+			saved.resize(frame_row_size * control.height);
+			for(uint32_t y = 0; y < control.height; y++) {
+				memcpy(
+					saved.data() + y * frame_row_size, dst + y * pitch,
+					frame_row_size
+				);
+			}
+		}
+
+		if(control.blend_op == BLEND_OP_SOURCE) {
+			decode(frames[n], dst, pitch);
+			return;
+		}
+
+		pixels.resize(frame_row_size * control.height);
+		decode(frames[n], pixels.data(), frame_row_size);
+		blend_fn_t blend = blend_kernel();
+		for(uint32_t y = 0; y < control.height; y++) {
+			blend(dst + y * pitch, pixels.data() + y * frame_row_size,
+				control.width);
+		}
+	}
+
+	// Decodes a frame's data, converted, into `dst`
+	void decode(frame_t const & frame, uint8_t * dst, size_t pitch) {
+		chunk_ihdr_data_t frame_ihdr = ihdr_data;
+		frame_ihdr.width = frame.control.width;
+		frame_ihdr.height = frame.control.height;
+
+		image_layout_t layout = image_layout(frame_ihdr, colours);
+		row_writer_t writer{ layout, dst, pitch, &*converter };
+		buffer.resize(writer.buffer_size());
+		auto write_row = [&](
+			reduced_image_t const & image, int y, std::span<uint8_t const> row
+		) {
+			writer.write(image, y, row.data(), buffer.data());
+		};
+
+		uint32_t type = frame.idat ? CHUNK_TYPE_IDAT : CHUNK_TYPE_FDAT;
+		uint32_t sequence = frame.control.sequence_number + 1;
+		scanline_decoder_t decoder(layout, scratch);
+		reader_t reader{ buf.first(frame.end), frame.begin };
+		while(!reader.eof()) {
+			chunk_t chunk = parse_chunk(reader, false);
+			if(chunk.type != type) continue;
+			if(verify) check_chunk_crc(chunk);
+
+			std::span<uint8_t const> data = chunk.data;
+			if(!frame.idat) {
+				reader_t fdat{ data };
+				uint32_t number = ntohl(fdat.read<uint32_t>("fdAT sequence"));
+				if(number != sequence++)
+					throw std::runtime_error(fmt::format(
+						"fdAT with sequence number {} where {} was expected",
+						number, sequence - 1
+					));
+				data = data.subspan(4);
+			}
+			decoder.feed(data, write_row);
+		}
+		decoder.finish();
+	}
+};
+
+}
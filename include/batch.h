@@ -0,0 +1,114 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <exception>
+#include <functional>
+
+#include "load.h"
+#include "probe.h"
+#include "thread_pool.h"
+
+namespace rpng {
+
+// Decodes many images concurrently. Each worker thread owns a zlib stream and
+// row buffers that are reset, not reallocated, between images, as does any
+// other thread that runs queued decodes while it waits on the pool.
+class batch_decoder_t {
+private:
+	thread_pool_t pool;
+	std::unique_ptr<decode_scratch_t[]> scratch;
+
+	decode_scratch_t & worker_scratch() {
+		int self = pool.worker_index();
+		if(self >= 0) return scratch[self];
+
+		// several outside threads may be in thread_pool_t::wait() at once
+		static thread_local decode_scratch_t outside;
+		return outside;
+	}
+
+public:
+	using image_t = std::vector<uint8_t>;
+
+	// Called once per image, from a worker thread, with either the decoded
+	// image or the exception that decoding it raised
+	using completion_t = std::function<
+		void(size_t index, image_t image, std::exception_ptr error)
+	>;
+
+	explicit batch_decoder_t(
+		int num_threads = std::thread::hardware_concurrency()
+	) : pool(num_threads), scratch(new decode_scratch_t[pool.size()]) {}
+
+	int num_threads() const {
+		return pool.size();
+	}
+
+	std::future<image_t> load(std::string filepath) {
+		return pool.submit([this, filepath = std::move(filepath)] {
+			mapped_file_t file(filepath);
+			return rpng::load(file.span(), worker_scratch());
+		});
+	}
+
+	// The buffer must stay alive until the image has been decoded
+	std::future<image_t> load(std::span<uint8_t const> buf) {
+		return pool.submit([this, buf] {
+			return rpng::load(buf, worker_scratch());
+		});
+	}
+
+	// Reads only the headers, see probe_all()
+	std::vector<probe_result_t> probe_all(
+		std::vector<std::string> const & filepaths
+	) {
+		return rpng::probe_all(filepaths, pool);
+	}
+
+	template <class Source>
+	std::vector<std::future<image_t>> load_all(
+		std::vector<Source> const & sources
+	) {
+		std::vector<std::future<image_t>> images;
+		images.reserve(sources.size());
+		for(auto const & source : sources) {
+			images.push_back(load(source));
+		}
+		return images;
+	}
+
+	// Decodes every source, reporting each image through `on_done` as soon as
+	// it is finished. Returns once all of them have been reported.
+	template <class Source>
+	void load_all(
+		std::vector<Source> const & sources,
+		completion_t const & on_done
+	) {
+		std::vector<std::future<void>> done;
+		done.reserve(sources.size());
+		for(size_t i = 0; i < sources.size(); i++) {
+			done.push_back(pool.submit([this, &sources, &on_done, i] {
+				image_t image;
+				std::exception_ptr error;
+				try {
+					if constexpr(std::is_convertible_v<Source, std::string>) {
+						mapped_file_t file(sources[i]);
+						image = rpng::load(file.span(), worker_scratch());
+					} else {
+						image = rpng::load(sources[i], worker_scratch());
+					}
+				} catch(...) {
+					error = std::current_exception();
+				}
+				on_done(i, std::move(image), error);
+			}));
+		}
+		pool.wait(done);
+	}
+};
+
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
+
+namespace rpng {
+
+// Composites a row of `width` 8-bit pixels from `src` over `dst`, as APNG's
+// BLEND_OP_OVER does: non-premultiplied, with alpha in the last byte, so RGBA
+// and BGRA alike
+using blend_fn_t = void(*)(uint8_t * dst, uint8_t const * src, int width);
+
+void blend_pixel(uint8_t * dst, uint8_t const * src) {
+	uint32_t sa = src[3];
+	if(sa == 255) {
+		memcpy(dst, src, 4);
+		return;
+	}
+	if(sa == 0) return;
+
+	// both weights scaled by 255, rounded once at the end
+	uint32_t dw = dst[3] * (255 - sa);
+	uint32_t oa = sa * 255 + dw;
+	for(int c = 0; c < 3; c++) {
+		dst[c] = (src[c] * sa * 255 + dst[c] * dw + oa / 2) / oa;
+	}
+	dst[3] = (oa + 127) / 255;
+}
+
+void blend_over(uint8_t * dst, uint8_t const * src, int width) {
+	for(int x = 0; x < width; x++) blend_pixel(dst + 4 * x, src + 4 * x);
+}
+
+#if defined(__x86_64__)
+namespace simd {
+
+// Rounded x / 255 of each 16-bit lane, for x up to 255 * 255
+[[gnu::target("sse2"), gnu::always_inline]] inline
+__m128i div255_epu16(__m128i x) {
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// src * a + dst * (255 - a), over 255, for two pixels widened to 16 bits
+[[gnu::target("sse2"), gnu::always_inline]] inline
+__m128i mix_epu16(__m128i s, __m128i d) {
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+	__m128i x = _mm_add_epi16(
+		_mm_mullo_epi16(s, a),
+		_mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a))
+	);
+	return div255_epu16(x);
+}
+
+// SSE2: four pixels at a time. Over an opaque pixel the result stays opaque
+// and takes a multiply and a rounded division by 255; over a clear one it is
+// the source. Groups whose destination has any other alpha, which needs a
+// true division, go pixel by pixel.
+[[gnu::target("sse2")]]
+void blend_over_sse2(uint8_t * dst, uint8_t const * src, int width) {
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const alpha = _mm_set1_epi32(0xff000000);
+
+	int x = 0;
+	for(; x + 4 <= width; x += 4) {
+		__m128i s = _mm_loadu_si128((__m128i const *)(src + 4 * x));
+		__m128i d = _mm_loadu_si128((__m128i const *)(dst + 4 * x));
+		__m128i sa = _mm_and_si128(s, alpha);
+		__m128i da = _mm_and_si128(d, alpha);
+
+		__m128i src_clear = _mm_cmpeq_epi32(sa, zero);
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(sa, alpha)) == 0xffff) {
+			_mm_storeu_si128((__m128i *)(dst + 4 * x), s);
+			continue;
+		}
+		if(_mm_movemask_epi8(src_clear) == 0xffff) continue;
+
+		__m128i dst_opaque = _mm_cmpeq_epi32(da, alpha);
+		__m128i dst_clear = _mm_cmpeq_epi32(da, zero);
+		if(_mm_movemask_epi8(_mm_or_si128(dst_opaque, dst_clear)) != 0xffff) {
+			blend_over(dst + 4 * x, src + 4 * x, 4);
+			continue;
+		}
+
+		__m128i over = _mm_or_si128(_mm_packus_epi16(
+			mix_epu16(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero)),
+			mix_epu16(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero))
+		), alpha);
+		__m128i copy = _mm_or_si128(
+			_mm_and_si128(src_clear, d), _mm_andnot_si128(src_clear, s)
+		);
+		__m128i out = _mm_or_si128(
+			_mm_and_si128(dst_opaque, over), _mm_andnot_si128(dst_opaque, copy)
+		);
+		_mm_storeu_si128((__m128i *)(dst + 4 * x), out);
+	}
+	blend_over(dst + 4 * x, src + 4 * x, width - x);
+}
+
+}
+#endif
+
+// The kernel for an instruction set tier, which must be supported by the
+// running CPU
+blend_fn_t blend_kernel(simd_level_t level) {
+#if defined(__x86_64__)
+	if(level >= SIMD_SSE2) return simd::blend_over_sse2;
+#endif
+	return blend_over;
+}
+
+blend_fn_t blend_kernel() {
+	static blend_fn_t const kernel = blend_kernel(simd_level());
+	return kernel;
+}
+
+}
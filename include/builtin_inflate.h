@@ -0,0 +1,1009 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <zlib.h>
+
+#include "checksum.h"
+
+namespace rpng {
+
+// rpng's own zlib decoder, tuned for the image data of PNGs, which is mostly
+// literals and short matches at the distance of a pixel or of a row:
+// - a 64-bit bit buffer, refilled with one unaligned load per symbol;
+// - literal/length lookups that return two literals at once when both codes
+//   fit in the table's index;
+// - matches copied 16 bytes at a time, repeating the pattern of a short
+//   distance, into output that has slack for the overrun.
+
+enum huffman_kind_t : uint8_t {
+	HUFFMAN_INVALID = 0,		// no code maps here, e.g. in an incomplete code
+	HUFFMAN_LITERAL,			// one literal, or two whose codes fit one lookup
+	HUFFMAN_LENGTH,				// in a distance table, a distance
+	HUFFMAN_END,
+	HUFFMAN_SUBTABLE			// codes longer than the table's index
+};
+
+// Four bytes, so that a lookup is a single load
+struct huffman_entry_t {
+	uint8_t length;		// bits of the code, of both codes of a pair, or of
+						// the main table's index for a subtable
+	uint8_t kind : 3;
+	uint8_t extra : 5;	// number of literals, extra bits of a length or
+						// distance, or the index bits of a subtable
+	uint16_t value;		// literals, base length or distance, or the offset
+						// of a subtable
+};
+
+constexpr int LITLEN_TABLE_BITS = 11;
+constexpr int DISTANCE_TABLE_BITS = 8;
+constexpr int CODELEN_TABLE_BITS = 7;
+
+// Each subtable holds the codes of one main table entry, at most 2^4 of them
+// for literals and lengths and 2^7 for distances
+constexpr size_t LITLEN_TABLE_SIZE = (1 << LITLEN_TABLE_BITS) + 288 * 16;
+constexpr size_t DISTANCE_TABLE_SIZE = (1 << DISTANCE_TABLE_BITS) + 32 * 128;
+
+// Bytes that wide match copies may write past the end of a match
+constexpr size_t INFLATE_COPY_SLACK = 32;
+
+constexpr size_t MAX_MATCH = 258;
+
+// Output a block with dynamic codes produces before its literals are paired.
+// Pairing walks the whole main table, which costs more than it saves on the
+// short blocks of small images.
+constexpr size_t PAIR_LITERALS_AFTER = 16384;
+
+// Entries for each symbol before its code length is known
+struct huffman_symbols_t {
+	std::array<huffman_entry_t, 288> litlen;
+	std::array<huffman_entry_t, 32> distance;
+	std::array<huffman_entry_t, 19> codelen;
+};
+
+constexpr huffman_symbols_t make_huffman_symbols() {
+	huffman_symbols_t symbols{};
+	for(int i = 0; i < 256; i++)
+		symbols.litlen[i] = { 0, HUFFMAN_LITERAL, 1, (uint16_t)i };
+	symbols.litlen[256] = { 0, HUFFMAN_END, 0, 0 };
+
+	// lengths 3 to 258 over symbols 257 to 285, with 0 to 5 extra bits
+	int length = 3;
+	for(int symbol = 257; symbol < 285; symbol++) {
+		int extra = symbol < 265 ? 0 : (symbol - 261) / 4;
+		symbols.litlen[symbol]
+			= { 0, HUFFMAN_LENGTH, (uint8_t)extra, (uint16_t)length };
+		length += 1 << extra;
+	}
+	symbols.litlen[285] = { 0, HUFFMAN_LENGTH, 0, 258 };
+
+	// distances 1 to 32768 over symbols 0 to 29, with 0 to 13 extra bits
+	int distance = 1;
+	for(int symbol = 0; symbol < 30; symbol++) {
+		int extra = symbol < 4 ? 0 : symbol / 2 - 1;
+		symbols.distance[symbol]
+			= { 0, HUFFMAN_LENGTH, (uint8_t)extra, (uint16_t)distance };
+		distance += 1 << extra;
+	}
+
+	for(int i = 0; i < 19; i++)
+		symbols.codelen[i] = { 0, HUFFMAN_LITERAL, 1, (uint16_t)i };
+	return symbols;
+}
+
+constexpr huffman_symbols_t huffman_symbols = make_huffman_symbols();
+
+// The next code of the same length after `code`, with both bit-reversed:
+// counting up from the most significant end
+uint32_t next_reversed_code(uint32_t code, int length) {
+	uint32_t bit = 1u << (31 - __builtin_clz(code ^ ((1u << length) - 1)));
+	return (code & (bit - 1)) | bit;
+}
+
+// Builds the lookup table of a canonical Huffman code over the low `bits`
+// bits of the bit buffer. Longer codes continue in subtables placed after the
+// main table. Returns false if the code is over-subscribed or, as zlib does,
+// incomplete. Only a code with no symbols, or with a single one of length 1
+// where `allow_single`, is accepted incomplete, with HUFFMAN_INVALID entries.
+bool build_huffman_table(
+	std::span<huffman_entry_t> table,
+	int bits,
+	uint8_t const * lengths,
+	int num_symbols,
+	huffman_entry_t const * symbols,
+	bool allow_single = true
+) {
+	// symbols in the order of their codes: by length, then by value
+	int count[16] = {};
+	for(int s = 0; s < num_symbols; s++) count[lengths[s]]++;
+	count[0] = 0;
+
+	int offset[16] = {};
+	for(int len = 1; len < 15; len++) offset[len + 1] = offset[len] + count[len];
+	uint16_t sorted[288];
+	for(int s = 0; s < num_symbols; s++) {
+		if(lengths[s]) sorted[offset[lengths[s]]++] = s;
+	}
+
+	int left = 1;
+	for(int len = 1; len < 16; len++) {
+		left = (left << 1) - count[len];
+		if(left < 0) return false;
+	}
+	int max_length = 15;
+	while(max_length > 0 && !count[max_length]) max_length--;
+	bool incomplete = left > 0;
+	if(incomplete && max_length > (allow_single ? 1 : 0)) return false;
+	if(incomplete) std::fill_n(table.begin(), 1 << bits, huffman_entry_t{});
+
+	// Codes that fit the main table go in a table of 2^len entries, which is
+	// doubled for each longer length, repeating the shorter codes under the
+	// new bit. Codes run from all zeros to all ones, so a complete code is
+	// finished once the code reaches all ones.
+	uint32_t code = 0;
+	int next = 0;
+	size_t end = 1;
+	for(int len = 1; len <= bits; len++) {
+		std::copy_n(table.begin(), end, table.begin() + end);
+		end <<= 1;
+		for(int n = 0; n < count[len]; n++) {
+			huffman_entry_t entry = symbols[sorted[next++]];
+			entry.length = len;
+			table[code] = entry;
+			if(code == end - 1) {
+				for(len++; len <= bits; len++, end <<= 1)
+					std::copy_n(table.begin(), end, table.begin() + end);
+				return true;
+			}
+			code = next_reversed_code(code, len);
+		}
+	}
+
+	// Longer codes go in a subtable per main table index, sized for the
+	// codes that share it: they come one after another, and fill it once
+	// they account for all of its entries
+	uint32_t mask = (1u << bits) - 1;
+	uint32_t prefix = ~0u;
+	size_t sub_start = 0, sub_end = 1 << bits;
+	for(int len = bits + 1; len < 16; len++) {
+		for(; count[len]; count[len]--) {
+			if((code & mask) != prefix) {
+				prefix = code & mask;
+				int sub_bits = len - bits;
+				for(int room = 1 << sub_bits;; room <<= 1, sub_bits++) {
+					room -= count[bits + sub_bits];
+					if(room <= 0 || bits + sub_bits == 15) break;
+				}
+				sub_start = sub_end;
+				sub_end += 1 << sub_bits;
+				table[prefix] = {
+					(uint8_t)bits, HUFFMAN_SUBTABLE,
+					(uint8_t)sub_bits, (uint16_t)sub_start
+				};
+				if(incomplete)
+					std::fill(
+						table.begin() + sub_start, table.begin() + sub_end,
+						huffman_entry_t{}
+					);
+			}
+
+			huffman_entry_t entry = symbols[sorted[next++]];
+			entry.length = len - bits;
+			size_t stride = 1 << entry.length;
+			for(size_t i = sub_start + (code >> bits); i < sub_end; i += stride)
+				table[i] = entry;
+			if(code == (1u << len) - 1) return true;
+			code = next_reversed_code(code, len);
+		}
+	}
+	return true;
+}
+
+// Turns each literal of the main table whose code leaves room for a second
+// literal's code into a pair, so one lookup emits both. The second code is
+// at a lower index, so working downwards finds it still unpaired.
+void pair_literals(std::span<huffman_entry_t> table) {
+	for(size_t i = 1 << LITLEN_TABLE_BITS; i-- > 0;) {
+		huffman_entry_t first = table[i];
+		if(first.kind != HUFFMAN_LITERAL) continue;
+		huffman_entry_t second = table[i >> first.length];
+		if(second.kind != HUFFMAN_LITERAL) continue;
+		if(first.length + second.length > LITLEN_TABLE_BITS) continue;
+
+		table[i] = {
+			(uint8_t)(first.length + second.length), HUFFMAN_LITERAL, 2,
+			(uint16_t)(first.value | second.value << 8)
+		};
+	}
+}
+
+// Copies a match of `length` bytes from `distance` back, 8 or 16 bytes at a
+// time. Up to 15 bytes past the match are overwritten.
+[[gnu::always_inline]] inline
+void copy_match(uint8_t * out, size_t distance, size_t length) {
+	uint8_t const * src = out - distance;
+	uint8_t * end = out + length;
+	if(distance >= 16) {
+		do {
+			memcpy(out, src, 16);
+			out += 16;
+			src += 16;
+		} while(out < end);
+	} else if(distance >= 8) {
+		do {
+			memcpy(out, src, 8);
+			out += 8;
+			src += 8;
+		} while(out < end);
+	} else {
+		// a short distance repeats a pattern, which is laid down a whole
+		// number of periods at a time
+		uint8_t pattern[8];
+		for(size_t i = 0; i < 8; i++)
+			pattern[i] = i < distance ? src[i] : pattern[i - distance];
+		size_t step = 8 - 8 % distance;
+		do {
+			memcpy(out, pattern, 8);
+			out += step;
+		} while(out < end);
+	}
+}
+
+// Resumable zlib stream decoder. It reads from whatever input it was last
+// given and, when that runs out part way through a symbol or a block header,
+// backs off to its start so the caller can supply more.
+class deflate_decoder_t {
+public:
+	enum result_t {
+		DECODE_LIMIT,		// the output reached the limit
+		DECODE_END,			// the stream ended and its trailer was read
+		DECODE_NEED_INPUT
+	};
+
+private:
+	enum state_t {
+		STATE_ZLIB_HEADER,
+		STATE_BLOCK_HEADER,
+		STATE_STORED,
+		STATE_HUFFMAN,
+		STATE_TRAILER,
+		STATE_DONE
+	};
+
+	// Thrown when the input runs out inside a header
+	struct starved_t {};
+
+	uint8_t const * in = nullptr;
+	uint8_t const * in_end = nullptr;
+	uint64_t bitbuf = 0;
+	int bitcount = 0;
+	int overrun = 0;		// bits of zero padding loaded past the input
+
+	state_t state = STATE_ZLIB_HEADER;
+	bool final_block = false;
+	size_t stored_left = 0;
+	size_t unpaired_left = 0;	// output left before literals are paired
+	uint32_t trailer = 0;
+
+	huffman_entry_t const * litlen = nullptr;
+	huffman_entry_t const * distance = nullptr;
+	std::array<huffman_entry_t, LITLEN_TABLE_SIZE> litlen_table;
+	std::array<huffman_entry_t, DISTANCE_TABLE_SIZE> distance_table;
+
+	struct checkpoint_t {
+		uint8_t const * in;
+		uint64_t bitbuf;
+		int bitcount;
+		int overrun;
+	};
+
+	checkpoint_t save() const {
+		return { in, bitbuf, bitcount, overrun };
+	}
+
+	void restore(checkpoint_t const & c) {
+		in = c.in;
+		bitbuf = c.bitbuf;
+		bitcount = c.bitcount;
+		overrun = c.overrun;
+	}
+
+	// Tops the bit buffer up to at least 56 bits, with a single load while 8
+	// bytes of input remain. The bits above bitcount then already hold the
+	// next input bytes, which the following load puts back unchanged. Past
+	// the end of the input the buffer is padded with zeros, which must not
+	// end up consumed.
+	void refill() {
+		if(in_end - in >= 8) {
+			uint64_t word;
+			memcpy(&word, in, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			word = __builtin_bswap64(word);
+#endif
+			bitbuf |= word << bitcount;
+			in += (63 - bitcount) >> 3;
+			bitcount |= 56;
+			return;
+		}
+		while(bitcount < 56) {
+			uint64_t byte = 0;
+			if(in < in_end) byte = *in++;
+			else overrun += 8;
+			bitbuf |= byte << bitcount;
+			bitcount += 8;
+		}
+	}
+
+	bool starved() const {
+		return bitcount < overrun;
+	}
+
+	uint32_t peek(int n) const {
+		return bitbuf & ((1ull << n) - 1);
+	}
+
+	void consume(int n) {
+		bitbuf >>= n;
+		bitcount -= n;
+	}
+
+	uint32_t take(int n) {
+		uint32_t value = peek(n);
+		consume(n);
+		return value;
+	}
+
+	// Fails, unless the input ran out first, in which case the data read
+	// past it was only padding
+	void check(bool ok, char const * what) {
+		if(ok) return;
+		if(starved()) throw starved_t{};
+		error(what);
+	}
+
+	[[noreturn]] static void error(char const * what) {
+		throw std::runtime_error(fmt::format("Error inflating stream: {}", what));
+	}
+
+	[[noreturn]] static void overflow() {
+		throw std::runtime_error(
+			"Inflated data exceeds the size implied by IHDR"
+		);
+	}
+
+	void read_zlib_header() {
+		refill();
+		uint32_t cmf = take(8), flg = take(8);
+		if(starved()) throw starved_t{};
+		check((cmf << 8 | flg) % 31 == 0, "incorrect header check");
+		check((cmf & 15) == Z_DEFLATED, "unknown compression method");
+		check((cmf >> 4) <= 7, "invalid window size");
+		check(!(flg & 32), "preset dictionary not supported");
+	}
+
+	void read_dynamic_tables() {
+		refill();
+		int num_litlen = take(5) + 257;
+		int num_distance = take(5) + 1;
+		int num_codelen = take(4) + 4;
+		check(
+			num_litlen <= 286 && num_distance <= 30,
+			"too many length or distance symbols"
+		);
+
+		static constexpr uint8_t order[19] = {
+			16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+		};
+		uint8_t codelen_lengths[19] = {};
+		for(int i = 0; i < num_codelen; i++) {
+			if(bitcount < 3) refill();
+			codelen_lengths[order[i]] = take(3);
+		}
+
+		std::array<huffman_entry_t, 1 << CODELEN_TABLE_BITS> codelen;
+		bool ok = build_huffman_table(
+			codelen, CODELEN_TABLE_BITS, codelen_lengths, 19,
+			huffman_symbols.codelen.data(), false
+		);
+		check(ok, "invalid code lengths set");
+
+		uint8_t lengths[286 + 30] = {};
+		int total = num_litlen + num_distance;
+		for(int i = 0; i < total;) {
+			refill();
+			huffman_entry_t entry = codelen[peek(CODELEN_TABLE_BITS)];
+			check(entry.kind != HUFFMAN_INVALID, "invalid code lengths set");
+			consume(entry.length);
+
+			int symbol = entry.value;
+			if(symbol < 16) {
+				lengths[i++] = symbol;
+				continue;
+			}
+
+			uint8_t repeated = 0;
+			int repeat;
+			if(symbol == 16) {
+				check(i > 0, "invalid bit length repeat");
+				repeated = lengths[i - 1];
+				repeat = 3 + take(2);
+			} else if(symbol == 17) {
+				repeat = 3 + take(3);
+			} else {
+				repeat = 11 + take(7);
+			}
+			check(i + repeat <= total, "invalid bit length repeat");
+			std::fill_n(lengths + i, repeat, repeated);
+			i += repeat;
+		}
+		if(starved()) throw starved_t{};
+		check(lengths[256] != 0, "invalid code -- missing end-of-block");
+
+		ok = build_huffman_table(
+			litlen_table, LITLEN_TABLE_BITS, lengths, num_litlen,
+			huffman_symbols.litlen.data()
+		);
+		check(ok, "invalid literal/lengths set");
+		unpaired_left = PAIR_LITERALS_AFTER;
+
+		ok = build_huffman_table(
+			distance_table, DISTANCE_TABLE_BITS, lengths + num_litlen,
+			num_distance, huffman_symbols.distance.data()
+		);
+		check(ok, "invalid distances set");
+
+		litlen = litlen_table.data();
+		distance = distance_table.data();
+	}
+
+	void read_block_header() {
+		refill();
+		final_block = take(1);
+		int type = take(2);
+		if(starved()) throw starved_t{};
+
+		if(type == 0) {
+			consume(bitcount % 8);
+			refill();
+			uint32_t len = take(16), nlen = take(16);
+			if(starved()) throw starved_t{};
+			check(len == (~nlen & 0xffff), "invalid stored block lengths");
+			stored_left = len;
+			state = STATE_STORED;
+		} else if(type == 1) {
+			static struct fixed_tables_t {
+				std::array<huffman_entry_t, LITLEN_TABLE_SIZE> litlen;
+				std::array<huffman_entry_t, DISTANCE_TABLE_SIZE> distance;
+
+				fixed_tables_t() {
+					uint8_t lengths[288];
+					std::fill_n(lengths, 144, 8);
+					std::fill_n(lengths + 144, 112, 9);
+					std::fill_n(lengths + 256, 24, 7);
+					std::fill_n(lengths + 280, 8, 8);
+					build_huffman_table(
+						litlen, LITLEN_TABLE_BITS, lengths, 288,
+						huffman_symbols.litlen.data()
+					);
+					pair_literals(litlen);
+
+					std::fill_n(lengths, 32, 5);
+					build_huffman_table(
+						distance, DISTANCE_TABLE_BITS, lengths, 32,
+						huffman_symbols.distance.data()
+					);
+				}
+			} const fixed;
+			litlen = fixed.litlen.data();
+			distance = fixed.distance.data();
+			unpaired_left = 0;
+			state = STATE_HUFFMAN;
+		} else {
+			check(type == 2, "invalid block type");
+			read_dynamic_tables();
+			state = STATE_HUFFMAN;
+		}
+	}
+
+	// Copies stored bytes up to `stop`: first any left whole in the bit
+	// buffer, then straight from the input
+	void copy_stored(uint8_t *& out, uint8_t * stop) {
+		while(stored_left && bitcount - overrun >= 8 && out < stop) {
+			*out++ = take(8);
+			stored_left--;
+		}
+		if(!stored_left || bitcount - overrun >= 8) return;
+
+		bitbuf = 0;
+		bitcount = 0;
+		overrun = 0;
+		size_t n = std::min<size_t>({
+			stored_left, (size_t)(in_end - in), (size_t)(stop - out)
+		});
+		memcpy(out, in, n);
+		out += n;
+		in += n;
+		stored_left -= n;
+	}
+
+	// Decodes symbols while 8 bytes of input remain and any match fits before
+	// `fast_end`, so neither needs checking per symbol, and the input cannot
+	// run out part way through one. The bit buffer is kept in locals, as
+	// stores through `out` could alias the members. Returns true at the end
+	// of the block.
+	bool decode_fast(
+		uint8_t * out_begin, uint8_t *& out_ref,
+		uint8_t * out_limit, uint8_t * fast_end
+	) {
+		constexpr uint32_t litlen_mask = (1 << LITLEN_TABLE_BITS) - 1;
+
+		uint8_t const * p = in;
+		uint8_t const * p_end = in_end;
+		huffman_entry_t const * codes = litlen;
+		huffman_entry_t const * distances = distance;
+		uint64_t bits = bitbuf;
+		int count = bitcount;
+		uint8_t * out = out_ref;
+		uint8_t * stop = out_limit && out_limit < fast_end
+			? out_limit : fast_end;
+		bool end = false;
+
+		auto lookup = [&](huffman_entry_t const * table, int table_bits) {
+			huffman_entry_t entry = table[bits & ((1u << table_bits) - 1)];
+			if(entry.kind == HUFFMAN_SUBTABLE) {
+				bits >>= table_bits;
+				count -= table_bits;
+				entry = table[entry.value + (bits & ((1u << entry.extra) - 1))];
+			}
+			bits >>= entry.length;
+			count -= entry.length;
+			return entry;
+		};
+
+		// literals are stored two bytes at a time, one of them possibly
+		// overwritten by the next symbol
+		auto put_literals = [&](huffman_entry_t entry) {
+			out[0] = entry.value;
+			out[1] = entry.value >> 8;
+			out += entry.extra;
+		};
+
+		while(p_end - p >= 8 && out < stop) {
+			uint64_t word;
+			memcpy(&word, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			word = __builtin_bswap64(word);
+#endif
+			bits |= word << count;
+			p += (63 - count) >> 3;
+			count |= 56;
+
+			// up to three literals fit the 56 bits of a refill
+			huffman_entry_t entry = lookup(codes, LITLEN_TABLE_BITS);
+			if(entry.kind == HUFFMAN_LITERAL) {
+				put_literals(entry);
+				for(int i = 0; i < 2; i++) {
+					huffman_entry_t next = codes[bits & litlen_mask];
+					if(next.kind != HUFFMAN_LITERAL) break;
+					bits >>= next.length;
+					count -= next.length;
+					put_literals(next);
+				}
+				continue;
+			}
+
+			if(entry.kind == HUFFMAN_END) {
+				end = true;
+				break;
+			}
+			if(entry.kind != HUFFMAN_LENGTH) error("invalid literal/length code");
+
+			size_t length = entry.value + (bits & ((1u << entry.extra) - 1));
+			bits >>= entry.extra;
+			count -= entry.extra;
+
+			huffman_entry_t d = lookup(distances, DISTANCE_TABLE_BITS);
+			size_t dist = d.value + (bits & ((1u << d.extra) - 1));
+			bits >>= d.extra;
+			count -= d.extra;
+			if(d.kind != HUFFMAN_LENGTH) error("invalid distance code");
+			if(dist > (size_t)(out - out_begin))
+				error("invalid distance too far back");
+
+			copy_match(out, dist, length);
+			out += length;
+		}
+
+		in = p;
+		bitbuf = bits;
+		bitcount = count;
+		out_ref = out;
+		if(end) state = final_block ? STATE_TRAILER : STATE_BLOCK_HEADER;
+		return end;
+	}
+
+	result_t decode_huffman(
+		uint8_t * out_begin, uint8_t *& out,
+		uint8_t * out_limit, uint8_t * out_end
+	) {
+		constexpr uint32_t litlen_mask = (1 << LITLEN_TABLE_BITS) - 1;
+		constexpr uint32_t distance_mask = (1 << DISTANCE_TABLE_BITS) - 1;
+
+		// matches are copied 16 bytes at a time while there is room
+		uint8_t * fast_end = out_end - std::min<size_t>(
+			out_end - out, MAX_MATCH + INFLATE_COPY_SLACK
+		);
+
+		uint8_t * fast_start = out;
+		if(unpaired_left && out < fast_end) {
+			uint8_t * probe = out + std::min<size_t>(unpaired_left, fast_end - out);
+			if(decode_fast(
+				out_begin, out,
+				out_limit && out_limit < probe ? out_limit : probe, fast_end
+			)) return DECODE_END;
+			unpaired_left -= std::min<size_t>(out - fast_start, unpaired_left);
+			if(!unpaired_left) pair_literals(litlen_table);
+		}
+		if(decode_fast(out_begin, out, out_limit, fast_end))
+			return DECODE_END;
+		if(out_limit && out >= out_limit && out != fast_start)
+			return DECODE_LIMIT;
+
+		checkpoint_t saved;
+		while(true) {
+			saved = save();
+			refill();
+
+			huffman_entry_t entry = litlen[bitbuf & litlen_mask];
+			if(entry.kind == HUFFMAN_SUBTABLE) {
+				consume(LITLEN_TABLE_BITS);
+				entry = litlen[entry.value + peek(entry.extra)];
+			}
+			consume(entry.length);
+
+			if(entry.kind == HUFFMAN_LITERAL) {
+				if(starved()) break;
+				if(out_end - out < entry.extra) overflow();
+				out[0] = entry.value;
+				if(entry.extra == 2) out[1] = entry.value >> 8;
+				out += entry.extra;
+			} else if(entry.kind == HUFFMAN_LENGTH) {
+				size_t length = entry.value + take(entry.extra);
+				huffman_entry_t d = distance[bitbuf & distance_mask];
+				if(d.kind == HUFFMAN_SUBTABLE) {
+					consume(DISTANCE_TABLE_BITS);
+					d = distance[d.value + peek(d.extra)];
+				}
+				consume(d.length);
+				size_t dist = d.value + take(d.extra);
+				if(starved()) break;
+
+				check(d.kind == HUFFMAN_LENGTH, "invalid distance code");
+				check(
+					dist <= (size_t)(out - out_begin),
+					"invalid distance too far back"
+				);
+				// near `out_end`, only the bytes of the match may be written
+				size_t room = out_end - out;
+				if(length > room) overflow();
+				if(room >= length + 15) {
+					copy_match(out, dist, length);
+				} else {
+					for(size_t i = 0; i < length; i++) out[i] = out[i - dist];
+				}
+				out += length;
+			} else if(entry.kind == HUFFMAN_END) {
+				if(starved()) break;
+				state = final_block ? STATE_TRAILER : STATE_BLOCK_HEADER;
+				return DECODE_END;		// of the block
+			} else {
+				if(starved()) break;
+				check(false, "invalid literal/length code");
+			}
+
+			if(out_limit && out >= out_limit) return DECODE_LIMIT;
+		}
+
+		// the input ran out part way through the symbol
+		restore(saved);
+		return DECODE_NEED_INPUT;
+	}
+
+public:
+	void reset() {
+		in = in_end = nullptr;
+		bitbuf = 0;
+		bitcount = 0;
+		overrun = 0;
+		state = STATE_ZLIB_HEADER;
+		final_block = false;
+		stored_left = 0;
+		unpaired_left = 0;
+	}
+
+	// Continues from `begin`, which must follow the input consumed so far
+	void set_input(uint8_t const * begin, uint8_t const * end) {
+		bitcount -= overrun;
+		overrun = 0;
+		bitbuf &= bitcount ? ~0ull >> (64 - bitcount) : 0;
+		in = begin;
+		in_end = end;
+	}
+
+	// Input not yet consumed starts here
+	uint8_t const * input_position() const {
+		return in;
+	}
+
+	bool ended() const {
+		return state == STATE_DONE;
+	}
+
+	// Adler-32 of the data, from the trailer once the stream has ended
+	uint32_t checksum() const {
+		return trailer;
+	}
+
+	// Decodes from `out` on, with the bytes from `out_begin` available to
+	// matches. Given an `out_limit`, stops at the first symbol that reaches
+	// it, having decoded at least one; a match can run MAX_MATCH bytes past
+	// it. Wide copies need INFLATE_COPY_SLACK more, up to `out_end`, which is
+	// never written.
+	result_t decode(
+		uint8_t * out_begin, uint8_t *& out,
+		uint8_t * out_limit, uint8_t * out_end
+	) {
+		while(true) {
+			checkpoint_t saved = save();
+			try {
+				switch(state) {
+				case STATE_ZLIB_HEADER:
+					read_zlib_header();
+					state = STATE_BLOCK_HEADER;
+					break;
+
+				case STATE_BLOCK_HEADER:
+					read_block_header();
+					break;
+
+				case STATE_STORED: {
+					uint8_t * stop = out_limit
+						? std::min(out_limit, out_end) : out_end;
+					copy_stored(out, stop);
+					if(!stored_left) {
+						state = final_block
+							? STATE_TRAILER : STATE_BLOCK_HEADER;
+					} else if(out == stop) {
+						if(!out_limit) overflow();
+						return DECODE_LIMIT;
+					} else {
+						return DECODE_NEED_INPUT;
+					}
+					break;
+				}
+
+				case STATE_HUFFMAN: {
+					result_t res = decode_huffman(
+						out_begin, out, out_limit, out_end
+					);
+					if(res != DECODE_END) return res;
+					break;
+				}
+
+				case STATE_TRAILER: {
+					consume(bitcount % 8);
+					refill();
+					uint32_t value = take(32);
+					if(starved()) throw starved_t{};
+					trailer = __builtin_bswap32(value);
+
+					// hand back the bytes loaded past the trailer
+					in -= (bitcount - overrun) / 8;
+					bitbuf = 0;
+					bitcount = 0;
+					overrun = 0;
+					state = STATE_DONE;
+					return DECODE_END;
+				}
+
+				case STATE_DONE:
+					return DECODE_END;
+				}
+			} catch(starved_t const &) {
+				restore(saved);
+				return DECODE_NEED_INPUT;
+			}
+		}
+	}
+};
+
+// Streaming inflater over deflate_decoder_t, with the same interface as
+// inflater_t. Data is decoded into a window that keeps the last 32 KiB as
+// history for matches and is slid back once it fills, then copied out. Input
+// is read in place; only the few bytes of a symbol or header split across
+// two pieces are held back.
+class builtin_inflater_t {
+private:
+	static constexpr size_t HISTORY = 32768;
+	static constexpr size_t CHUNK = 32768;		// decoded between slides
+	static constexpr size_t WINDOW_SIZE
+		= HISTORY + CHUNK + MAX_MATCH + INFLATE_COPY_SLACK;
+	static constexpr size_t BRIDGE = 1024;		// joined onto held bytes
+
+	// allocated on first use, without zeroing the tables or the window
+	std::unique_ptr<deflate_decoder_t> decoder;
+	std::unique_ptr<uint8_t[]> window;
+	size_t read = 0;			// window bytes copied out
+	size_t write = 0;			// window bytes decoded
+	uint64_t total = 0;
+	uint32_t adler = 1;
+	bool verify = true;			// whether the Adler-32 is computed and checked
+
+	std::vector<uint8_t> held;	// input carried over from earlier calls
+	bool needs_input = true;
+	bool from_held = false;		// whether the decoder is reading `held`
+
+	void check_adler(uint32_t computed) const {
+		if(computed != decoder->checksum())
+			throw std::runtime_error(
+				"Error inflating stream: incorrect data check"
+			);
+	}
+
+	void copy_out(std::span<uint8_t> & out) {
+		size_t n = std::min(write - read, out.size());
+		if(!n) return;
+		memcpy(out.data(), window.get() + read, n);
+		out = out.subspan(n);
+		read += n;
+		total += n;
+	}
+
+public:
+	builtin_inflater_t() = default;
+	builtin_inflater_t(builtin_inflater_t const &) = delete;
+	builtin_inflater_t & operator=(builtin_inflater_t const &) = delete;
+
+	void reset() {
+		if(!decoder)
+			decoder = std::make_unique_for_overwrite<deflate_decoder_t>();
+		decoder->reset();
+		read = write = 0;
+		total = 0;
+		adler = 1;
+		held.clear();
+		needs_input = true;
+		from_held = false;
+	}
+
+	// Applies from the next stream on
+	void verify_checksum(bool enable) {
+		verify = enable;
+	}
+
+	bool finished() const {
+		return decoder && decoder->ended() && read == write;
+	}
+
+	uint64_t total_out() const {
+		return total;
+	}
+
+	// As inflater_t::inflate()
+	bool inflate(std::span<uint8_t const> & in, std::span<uint8_t> & out) {
+		if(!decoder) reset();
+		if(!window)
+			window = std::make_unique_for_overwrite<uint8_t[]>(WINDOW_SIZE);
+
+		// input this call joined onto `held`, which may be given back
+		uint8_t const * in_end = in.data() + in.size();
+		uint8_t const * bridge = nullptr;
+		size_t held_before = 0;
+
+		if(!needs_input && !from_held)
+			decoder->set_input(in.data(), in_end);
+
+		while(true) {
+			copy_out(out);
+			if(decoder->ended()) break;
+			if(read < write) break;
+
+			if(needs_input) {
+				if(in.empty()) break;
+				if(held.empty()) {
+					decoder->set_input(in.data(), in_end);
+					from_held = false;
+				} else {
+					size_t n = std::min(in.size(), BRIDGE);
+					held_before = held.size();
+					bridge = in.data();
+					held.insert(held.end(), in.begin(), in.begin() + n);
+					in = in.subspan(n);
+					decoder->set_input(held.data(), held.data() + held.size());
+					from_held = true;
+				}
+				needs_input = false;
+			}
+
+			if(write >= HISTORY + CHUNK) {
+				uint8_t * history = window.get() + write - HISTORY;
+				memmove(window.get(), history, HISTORY);
+				read = write = HISTORY;
+			}
+			uint8_t * begin = window.get();
+			uint8_t * pos = begin + write;
+			uint8_t * limit = begin
+				+ std::min(write + out.size(), HISTORY + CHUNK);
+			auto res = decoder->decode(
+				begin, pos, limit, begin + WINDOW_SIZE
+			);
+			size_t produced = pos - (begin + write);
+			if(verify) adler = update_adler32(adler, begin + write, produced);
+			write += produced;
+
+			// like zlib, carry on without room for output until a symbol
+			// produces some, in case the stream is about to end
+			if(res == deflate_decoder_t::DECODE_LIMIT) {
+				if(!from_held) in = { decoder->input_position(), in_end };
+				if(!produced) break;
+				continue;
+			}
+
+			// the decoder is done with its input: keep what it left over
+			size_t used = decoder->input_position()
+				- (from_held ? held.data() : in.data());
+			if(from_held) {
+				if(bridge && used >= held_before) {
+					in = { bridge + (used - held_before), in_end };
+					held.clear();
+				} else {
+					held.erase(held.begin(), held.begin() + used);
+				}
+			} else {
+				in = in.subspan(used);
+				if(res == deflate_decoder_t::DECODE_NEED_INPUT) {
+					held.assign(in.begin(), in.end());
+					in = {};
+				}
+			}
+			bridge = nullptr;
+			from_held = false;
+			needs_input = true;
+
+			if(res == deflate_decoder_t::DECODE_END && verify)
+				check_adler(adler);
+		}
+		return finished();
+	}
+
+	// Inflates the complete zlib datastream `in` straight into `out`, which
+	// it must fill exactly
+	void inflate_whole(std::span<uint8_t const> in, std::span<uint8_t> out) {
+		reset();
+		decoder->set_input(in.data(), in.data() + in.size());
+		uint8_t * pos = out.data();
+		auto res = decoder->decode(
+			out.data(), pos, nullptr, out.data() + out.size()
+		);
+		if(res != deflate_decoder_t::DECODE_END)
+			throw std::runtime_error("Ran out of input to decompress");
+		size_t size = pos - out.data();
+		if(size != out.size())
+			throw std::runtime_error(fmt::format(
+				"Inflated data is {} bytes short of the size implied by IHDR",
+				out.size() - size
+			));
+		if(verify) check_adler(update_adler32(1, out.data(), out.size()));
+		total = out.size();
+	}
+};
+
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+
+#include <zlib.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
+
+namespace rpng {
+
+// The CRC-32 of PNG chunks and the Adler-32 of zlib streams, with the same
+// starting values and results as zlib's crc32() and adler32(). Each picks the
+// fastest kernel the CPU has: PCLMULQDQ folding for CRC-32 and SSSE3 sums for
+// Adler-32, or slice-by-16 tables and zlib's adler32() without them.
+
+// Tables for the reflected polynomial, the first for one byte and each of
+// the others for a byte one position further from the end of a 16-byte slice
+constexpr auto crc32_tables = [] {
+	std::array<std::array<uint32_t, 256>, 16> tables{};
+	for(uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for(int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		tables[0][i] = c;
+	}
+	for(int t = 1; t < 16; t++) {
+		for(uint32_t i = 0; i < 256; i++) {
+			uint32_t c = tables[t - 1][i];
+			tables[t][i] = (c >> 8) ^ tables[0][c & 0xff];
+		}
+	}
+	return tables;
+}();
+
+inline uint32_t load_le32(uint8_t const * p) {
+	uint32_t value;
+	memcpy(&value, p, 4);
+#if __BYTE_ORDER == __BIG_ENDIAN
+	value = __builtin_bswap32(value);
+#endif
+	return value;
+}
+
+// Slice-by-16 over a CRC that has already been inverted
+uint32_t crc32_slice16(uint32_t crc, uint8_t const * data, size_t size) {
+	auto const & t = crc32_tables;
+	for(; size >= 16; data += 16, size -= 16) {
+		uint32_t a = load_le32(data) ^ crc;
+		uint32_t b = load_le32(data + 4);
+		uint32_t c = load_le32(data + 8);
+		uint32_t d = load_le32(data + 12);
+		crc = t[15][a & 0xff] ^ t[14][(a >> 8) & 0xff]
+			^ t[13][(a >> 16) & 0xff] ^ t[12][a >> 24]
+			^ t[11][b & 0xff] ^ t[10][(b >> 8) & 0xff]
+			^ t[9][(b >> 16) & 0xff] ^ t[8][b >> 24]
+			^ t[7][c & 0xff] ^ t[6][(c >> 8) & 0xff]
+			^ t[5][(c >> 16) & 0xff] ^ t[4][c >> 24]
+			^ t[3][d & 0xff] ^ t[2][(d >> 8) & 0xff]
+			^ t[1][(d >> 16) & 0xff] ^ t[0][d >> 24];
+	}
+	for(; size; data++, size--)
+		crc = t[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+namespace simd {
+
+// Multiplies both halves of `x` by the fold constants in `k`, and adds the
+// 16 bytes it is folded onto
+[[gnu::target("pclmul,sse2"), gnu::always_inline]] inline
+__m128i crc32_fold(__m128i x, __m128i k, __m128i next) {
+	__m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+	__m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+// PCLMULQDQ: folds four 128-bit lanes 64 bytes at a time, then one lane 16
+// bytes at a time, and Barrett-reduces the remainder. Takes an inverted CRC,
+// and a multiple of 16 bytes, at least 64.
+[[gnu::target("pclmul,sse2")]]
+uint32_t crc32_pclmul(uint32_t crc, uint8_t const * data, size_t size) {
+	// x^(k*32) mod P for the fold distances, and P and floor(x^64 / P)
+	__m128i const k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	__m128i const k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	__m128i const k5 = _mm_set_epi64x(0, 0x0163cd6124);
+	__m128i const poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	__m128i const low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	auto load = [](uint8_t const * p) {
+		return _mm_loadu_si128((__m128i const *)p);
+	};
+
+	__m128i x1 = _mm_xor_si128(load(data), _mm_cvtsi32_si128(crc));
+	__m128i x2 = load(data + 16);
+	__m128i x3 = load(data + 32);
+	__m128i x4 = load(data + 48);
+	data += 64;
+	size -= 64;
+
+	for(; size >= 64; data += 64, size -= 64) {
+		x1 = crc32_fold(x1, k1k2, load(data));
+		x2 = crc32_fold(x2, k1k2, load(data + 16));
+		x3 = crc32_fold(x3, k1k2, load(data + 32));
+		x4 = crc32_fold(x4, k1k2, load(data + 48));
+	}
+
+	x1 = crc32_fold(x1, k3k4, x2);
+	x1 = crc32_fold(x1, k3k4, x3);
+	x1 = crc32_fold(x1, k3k4, x4);
+	for(; size >= 16; data += 16, size -= 16)
+		x1 = crc32_fold(x1, k3k4, load(data));
+
+	// 128 bits to 64
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// 64 bits to 32
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low32), poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+// SSSE3: 32 bytes at a time, the byte sums from PSADBW and the weighted sums
+// from PMADDUBSW, reduced modulo 65521 before either sum could overflow
+[[gnu::target("ssse3")]]
+uint32_t adler32_ssse3(uint32_t adler, uint8_t const * data, size_t size) {
+	constexpr uint32_t BASE = 65521;
+	constexpr size_t BLOCK = 32;
+	constexpr size_t MAX_BLOCKS = 5552 / BLOCK;
+
+	__m128i const weights_lo = _mm_setr_epi8(
+		32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17
+	);
+	__m128i const weights_hi = _mm_setr_epi8(
+		16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+	);
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const ones = _mm_set1_epi16(1);
+
+	uint32_t s1 = adler & 0xffff, s2 = adler >> 16;
+	while(size >= BLOCK) {
+		size_t n = std::min(size / BLOCK, MAX_BLOCKS);
+		size -= n * BLOCK;
+
+		// s1 before each block adds 32 times over to s2
+		__m128i prev = _mm_cvtsi32_si128(s1 * n);
+		__m128i v1 = zero;
+		__m128i v2 = _mm_cvtsi32_si128(s2);
+		for(; n; n--, data += BLOCK) {
+			__m128i lo = _mm_loadu_si128((__m128i const *)data);
+			__m128i hi = _mm_loadu_si128((__m128i const *)(data + 16));
+			prev = _mm_add_epi32(prev, v1);
+			v1 = _mm_add_epi32(v1, _mm_sad_epu8(lo, zero));
+			v1 = _mm_add_epi32(v1, _mm_sad_epu8(hi, zero));
+			v2 = _mm_add_epi32(v2, _mm_madd_epi16(
+				_mm_maddubs_epi16(lo, weights_lo), ones
+			));
+			v2 = _mm_add_epi32(v2, _mm_madd_epi16(
+				_mm_maddubs_epi16(hi, weights_hi), ones
+			));
+		}
+		v2 = _mm_add_epi32(v2, _mm_slli_epi32(prev, 5));
+
+		v1 = _mm_add_epi32(v1, _mm_shuffle_epi32(v1, _MM_SHUFFLE(1, 0, 3, 2)));
+		v2 = _mm_add_epi32(v2, _mm_shuffle_epi32(v2, _MM_SHUFFLE(2, 3, 0, 1)));
+		v2 = _mm_add_epi32(v2, _mm_shuffle_epi32(v2, _MM_SHUFFLE(1, 0, 3, 2)));
+		s1 = (s1 + (uint32_t)_mm_cvtsi128_si32(v1)) % BASE;
+		s2 = (uint32_t)_mm_cvtsi128_si32(v2) % BASE;
+	}
+	for(; size; data++, size--) {
+		s1 += *data;
+		s2 += s1;
+	}
+	return (s1 % BASE) | (s2 % BASE) << 16;
+}
+
+}
+#endif
+
+uint32_t update_crc32(uint32_t crc, uint8_t const * data, size_t size) {
+	crc = ~crc;
+#if defined(__x86_64__)
+	if(size >= 64 && cpu_features().pclmul) {
+		size_t n = size & ~(size_t)15;
+		crc = simd::crc32_pclmul(crc, data, n);
+		data += n;
+		size -= n;
+	}
+#endif
+	return ~crc32_slice16(crc, data, size);
+}
+
+uint32_t update_adler32(uint32_t adler, uint8_t const * data, size_t size) {
+#if defined(__x86_64__)
+	if(cpu_features().ssse3) return simd::adler32_ssse3(adler, data, size);
+#endif
+	return adler32_z(adler, data, size);
+}
+
+}
@@ -1,13 +1,17 @@
 #pragma once
 
+#include <span>
+
 #include "fmtutils.h"
 
 namespace rpng {
 
+// Non-owning view of a chunk within an in-memory datastream
 struct chunk_t {
+	size_t offset;		// offset of the chunk data from the start of the file
 	uint32_t length;
 	uint32_t type;
-	std::vector<uint8_t> data;
+	std::span<uint8_t const> data;
 	uint32_t crc;
 };
 
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <span>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "net.h"
+#include "reader.h"
+
+namespace rpng {
+
+// acTL: marks an animated PNG, with its number of frames and of times to play
+// them, 0 for indefinitely
+struct animation_control_t {
+	uint32_t num_frames;
+	uint32_t num_plays;
+};
+
+animation_control_t parse_actl(std::span<uint8_t const> data) {
+	if(data.size() != 8)
+		throw std::runtime_error(fmt::format(
+			"acTL size mismatch: {} bytes", data.size()
+		));
+
+	reader_t reader{ data };
+	animation_control_t animation;
+	animation.num_frames = ntohl(reader.read<uint32_t>("acTL frames"));
+	animation.num_plays = ntohl(reader.read<uint32_t>("acTL plays"));
+	if(animation.num_frames == 0)
+		throw std::runtime_error("acTL with no frames");
+	return animation;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <span>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "net.h"
+#include "reader.h"
+#include "chunk/ihdr.h"
+
+namespace rpng {
+
+// What becomes of a frame's region before the next frame is rendered
+constexpr uint8_t DISPOSE_OP_NONE		= 0;	// left as it is
+constexpr uint8_t DISPOSE_OP_BACKGROUND	= 1;	// cleared to transparent black
+constexpr uint8_t DISPOSE_OP_PREVIOUS	= 2;	// restored to its prior state
+
+// How a frame is rendered onto its region
+constexpr uint8_t BLEND_OP_SOURCE		= 0;	// replacing it
+constexpr uint8_t BLEND_OP_OVER			= 1;	// composited over it
+
+// fcTL: the region of the canvas a frame covers, how long it is shown, and
+// how it is rendered and disposed of
+struct frame_control_t {
+	uint32_t sequence_number;
+	uint32_t width;
+	uint32_t height;
+	uint32_t x_offset;
+	uint32_t y_offset;
+	uint16_t delay_num;
+	uint16_t delay_den;
+	uint8_t dispose_op;
+	uint8_t blend_op;
+
+	// In seconds; a denominator of 0 means hundredths
+	double delay() const {
+		return delay_num / (double)(delay_den ? delay_den : 100);
+	}
+};
+
+frame_control_t parse_fctl(
+	std::span<uint8_t const> data,
+	chunk_ihdr_data_t const & ihdr
+) {
+	if(data.size() != 26)
+		throw std::runtime_error(fmt::format(
+			"fcTL size mismatch: {} bytes", data.size()
+		));
+
+	reader_t reader{ data };
+	frame_control_t frame;
+	frame.sequence_number = ntohl(reader.read<uint32_t>("fcTL sequence"));
+	frame.width = ntohl(reader.read<uint32_t>("fcTL width"));
+	frame.height = ntohl(reader.read<uint32_t>("fcTL height"));
+	frame.x_offset = ntohl(reader.read<uint32_t>("fcTL x offset"));
+	frame.y_offset = ntohl(reader.read<uint32_t>("fcTL y offset"));
+	frame.delay_num = ntohs(reader.read<uint16_t>("fcTL delay"));
+	frame.delay_den = ntohs(reader.read<uint16_t>("fcTL delay"));
+	frame.dispose_op = reader.read<uint8_t>("fcTL dispose op");
+	frame.blend_op = reader.read<uint8_t>("fcTL blend op");
+
+	bool inside = frame.width && frame.height
+		&& (uint64_t)frame.x_offset + frame.width <= ihdr.width
+		&& (uint64_t)frame.y_offset + frame.height <= ihdr.height;
+	if(!inside)
+		throw std::runtime_error(fmt::format(
+			"Frame {} of {}x{} at ({}, {}) is not within the image",
+			frame.sequence_number, frame.width, frame.height,
+			frame.x_offset, frame.y_offset
+		));
+	if(frame.dispose_op > DISPOSE_OP_PREVIOUS)
+		throw std::runtime_error(fmt::format(
+			"Unknown dispose op {}", frame.dispose_op
+		));
+	if(frame.blend_op > BLEND_OP_OVER)
+		throw std::runtime_error(fmt::format(
+			"Unknown blend op {}", frame.blend_op
+		));
+	return frame;
+}
+
+}
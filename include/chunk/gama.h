@@ -0,0 +1,26 @@
+#pragma once
+
+#include <span>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "net.h"
+#include "reader.h"
+
+namespace rpng {
+
+// gAMA: the image gamma times 100000, e.g. 45455 for 1 / 2.2
+uint32_t parse_gama(std::span<uint8_t const> data) {
+	if(data.size() != 4)
+		throw std::runtime_error(fmt::format(
+			"gAMA size mismatch: {} bytes", data.size()
+		));
+
+	reader_t reader{ data };
+	uint32_t gamma = ntohl(reader.read<uint32_t>("gAMA gamma"));
+	if(gamma == 0) throw std::runtime_error("gAMA gamma of zero");
+	return gamma;
+}
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include "reader.h"
+#include "chunk/text.h"
+
+namespace rpng {
+
+// iCCP: an embedded ICC profile, stored compressed, and its name
+struct icc_profile_t {
+	std::string name;
+	std::vector<uint8_t> profile;
+};
+
+icc_profile_t parse_iccp(
+	std::span<uint8_t const> data,
+	size_t max_size = MAX_INFLATED_METADATA
+) {
+	reader_t reader{ data };
+	icc_profile_t profile;
+	profile.name = read_keyword(reader, "iCCP profile name");
+	uint8_t method = reader.read<uint8_t>("iCCP compression method");
+	profile.profile = inflate_remaining(reader, method, "iCCP", max_size);
+	return profile;
+}
+
+}
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <array>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
 #include "fmtutils.h"
 
 namespace rpng {
@@ -40,6 +46,30 @@ constexpr std::array<colour_properties_t, 8>  colour_properties {{
 	{ }
 }};
 
+// Checks the fields of IHDR that both reading and writing depend on, and
+// returns the properties of its colour type
+colour_properties_t check_ihdr(chunk_ihdr_data_t const & ihdr) {
+	if(ihdr.width == 0 || ihdr.height == 0)
+		throw std::runtime_error("Neither width nor height may be zero");
+
+	colour_properties_t colours = colour_properties[
+		std::min<uint8_t>(ihdr.colour_type, colour_properties.size() - 1)
+	];
+
+	if(colours.colour_type == COLOUR_TYPE_INVALID) {
+		throw std::runtime_error(
+			fmt::format("Colour type {} is not valid", ihdr.colour_type)
+		);
+	} else if((ihdr.bit_depth & colours.valid_bit_depths) == 0) {
+		throw std::runtime_error(fmt::format(
+			"Colour type {} and bit depth {} combination is not valid",
+			ihdr.colour_type,
+			ihdr.bit_depth
+		));
+	}
+	return colours;
+}
+
 }
 
 namespace fmt {
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <span>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "net.h"
+#include "reader.h"
+
+namespace rpng {
+
+// Units of pHYs
+constexpr uint8_t PHYS_UNIT_UNKNOWN	= 0;		// gives only the aspect ratio
+constexpr uint8_t PHYS_UNIT_METRE	= 1;
+
+// pHYs: pixels per unit in each direction
+struct physical_dimensions_t {
+	uint32_t x;
+	uint32_t y;
+	uint8_t unit;
+};
+
+physical_dimensions_t parse_phys(std::span<uint8_t const> data) {
+	if(data.size() != 9)
+		throw std::runtime_error(fmt::format(
+			"pHYs size mismatch: {} bytes", data.size()
+		));
+
+	reader_t reader{ data };
+	physical_dimensions_t dimensions;
+	dimensions.x = ntohl(reader.read<uint32_t>("pHYs x"));
+	dimensions.y = ntohl(reader.read<uint32_t>("pHYs y"));
+	dimensions.unit = reader.read<uint8_t>("pHYs unit");
+	if(dimensions.unit > PHYS_UNIT_METRE)
+		throw std::runtime_error(fmt::format(
+			"Unknown pHYs unit {}", dimensions.unit
+		));
+	return dimensions;
+}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <span>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "chunk/ihdr.h"
+
+namespace rpng {
+
+// PLTE: up to 256 RGB entries of 8 bits per sample. Indexed-colour images
+// may not have more entries than their bit depth can address.
+std::span<uint8_t const> parse_plte(
+	std::span<uint8_t const> data,
+	chunk_ihdr_data_t const & ihdr
+) {
+	size_t num_entries = data.size() / 3;
+	size_t max_entries = ihdr.colour_type == COLOUR_TYPE_INDEXED_COLOUR
+		? 1 << ihdr.bit_depth
+		: 256;
+	if(data.size() % 3 || num_entries == 0 || num_entries > max_entries)
+		throw std::runtime_error(fmt::format(
+			"Invalid PLTE size of {} bytes", data.size()
+		));
+	return data;
+}
+
+}
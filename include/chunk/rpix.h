@@ -0,0 +1,67 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <memory_resource>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "net.h"
+#include "reader.h"
+
+namespace rpng {
+
+// rpIX: private ancillary chunk listing where the encoder restarted deflate
+// with a full flush. Each segment is a band of rows whose compressed data
+// starts on a byte boundary and refers to nothing before it, so bands can be
+// inflated independently. Layout, all big-endian:
+//
+//   uint32 number of segments
+//   per segment: uint32 first row, uint32 offset into the zlib datastream
+//
+// The first segment starts at row 0, just after the 2-byte zlib header.
+struct segment_t {
+	uint32_t first_row;
+	uint32_t offset;
+};
+
+using segment_index_t = std::pmr::vector<segment_t>;
+
+segment_index_t parse_rpix(
+	std::span<uint8_t const> data,
+	std::pmr::memory_resource * memory = std::pmr::get_default_resource()
+) {
+	reader_t reader{ data };
+	uint32_t count = ntohl(reader.read<uint32_t>("rpIX segment count"));
+	if(reader.remaining() != (size_t)count * 2 * sizeof(uint32_t))
+		throw std::runtime_error(fmt::format(
+			"rpIX size mismatch for {} segments: {} bytes", count, data.size()
+		));
+
+	segment_index_t segments(count, memory);
+	for(segment_t & segment : segments) {
+		segment.first_row = ntohl(reader.read<uint32_t>("rpIX first row"));
+		segment.offset = ntohl(reader.read<uint32_t>("rpIX offset"));
+	}
+	return segments;
+}
+
+std::vector<uint8_t> serialize_rpix(segment_index_t const & segments) {
+	std::vector<uint8_t> data;
+	data.reserve(4 + 8 * segments.size());
+	auto put = [&](uint32_t value) {
+		value = htonl(value);
+		uint8_t const * bytes = (uint8_t const *)&value;
+		data.insert(data.end(), bytes, bytes + 4);
+	};
+
+	put(segments.size());
+	for(segment_t const & segment : segments) {
+		put(segment.first_row);
+		put(segment.offset);
+	}
+	return data;
+}
+
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <zlib.h>
+
+#include "reader.h"
+#include "inflate.h"
+#include "constants.h"
+
+namespace rpng {
+
+// tEXt, zTXt and iTXt: a keyword and its text. The text of tEXt and zTXt is
+// Latin-1, and that of iTXt UTF-8, along with a language tag and the keyword
+// translated into that language, either of which may be empty.
+struct text_t {
+	uint32_t type;			// CHUNK_TYPE_TEXT, CHUNK_TYPE_ZTXT or CHUNK_TYPE_ITXT
+	std::string keyword;
+	std::string text;
+	std::string language;
+	std::string translated_keyword;
+};
+
+// Reads up to the next null separator, and past it
+std::string read_terminated(reader_t & reader, char const * what) {
+	std::span<uint8_t const> rest = reader.buf.subspan(reader.pos);
+	size_t length = std::find(rest.begin(), rest.end(), 0) - rest.begin();
+	if(length == rest.size())
+		throw std::runtime_error(
+			fmt::format("Missing null separator @ {}", what)
+		);
+
+	std::span<uint8_t const> bytes = reader.read(length, what);
+	reader.read(1, what);
+	return std::string(bytes.begin(), bytes.end());
+}
+
+// Keywords, and the names of ICC profiles, are 1 to 79 bytes of Latin-1
+std::string read_keyword(reader_t & reader, char const * what) {
+	std::string keyword = read_terminated(reader, what);
+	if(keyword.empty() || keyword.size() > 79)
+		throw std::runtime_error(fmt::format(
+			"{} of {} bytes is not valid", what, keyword.size()
+		));
+	return keyword;
+}
+
+// Default limit on the inflated size of a zTXt, iTXt or iCCP chunk, as
+// libpng's, so that a small chunk cannot expand to gigabytes
+constexpr size_t MAX_INFLATED_METADATA = 8 << 20;
+
+// Inflates the zlib datastream that ends a chunk, whose compression method
+// byte has just been read, to at most `max_size` bytes
+std::vector<uint8_t> inflate_remaining(
+	reader_t & reader, uint8_t method, char const * what, size_t max_size
+) {
+	if(method != 0)
+		throw std::runtime_error(fmt::format(
+			"Unknown compression method {} @ {}", method, what
+		));
+	return ::inflate(
+		std::array{ reader.read(reader.remaining(), what) }, max_size
+	);
+}
+
+text_t parse_text(std::span<uint8_t const> data) {
+	reader_t reader{ data };
+	text_t text{ CHUNK_TYPE_TEXT };
+	text.keyword = read_keyword(reader, "tEXt keyword");
+	std::span<uint8_t const> rest = reader.read(reader.remaining(), "tEXt");
+	text.text.assign(rest.begin(), rest.end());
+	return text;
+}
+
+text_t parse_ztxt(
+	std::span<uint8_t const> data,
+	size_t max_size = MAX_INFLATED_METADATA
+) {
+	reader_t reader{ data };
+	text_t text{ CHUNK_TYPE_ZTXT };
+	text.keyword = read_keyword(reader, "zTXt keyword");
+	uint8_t method = reader.read<uint8_t>("zTXt compression method");
+	std::vector<uint8_t> inflated = inflate_remaining(
+		reader, method, "zTXt", max_size
+	);
+	text.text.assign(inflated.begin(), inflated.end());
+	return text;
+}
+
+text_t parse_itxt(
+	std::span<uint8_t const> data,
+	size_t max_size = MAX_INFLATED_METADATA
+) {
+	reader_t reader{ data };
+	text_t text{ CHUNK_TYPE_ITXT };
+	text.keyword = read_keyword(reader, "iTXt keyword");
+	uint8_t compressed = reader.read<uint8_t>("iTXt compression flag");
+	uint8_t method = reader.read<uint8_t>("iTXt compression method");
+	text.language = read_terminated(reader, "iTXt language tag");
+	text.translated_keyword = read_terminated(
+		reader, "iTXt translated keyword"
+	);
+
+	if(compressed > 1)
+		throw std::runtime_error(fmt::format(
+			"iTXt compression flag of {} is not valid", compressed
+		));
+	if(compressed) {
+		std::vector<uint8_t> inflated = inflate_remaining(
+			reader, method, "iTXt", max_size
+		);
+		text.text.assign(inflated.begin(), inflated.end());
+	} else {
+		std::span<uint8_t const> rest = reader.read(reader.remaining(), "iTXt");
+		text.text.assign(rest.begin(), rest.end());
+	}
+	return text;
+}
+
+}
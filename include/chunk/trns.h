@@ -0,0 +1,61 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "net.h"
+#include "reader.h"
+#include "chunk/ihdr.h"
+
+namespace rpng {
+
+// tRNS: an alpha value for each of the first palette entries, or else the
+// single grey or RGB sample value, at the image's bit depth, that is fully
+// transparent
+struct transparency_t {
+	std::array<uint8_t, 256> alpha;		// per palette entry, 255 if absent
+	bool keyed = false;
+	std::array<uint16_t, 3> key;		// grey only uses the first
+};
+
+transparency_t parse_trns(
+	std::span<uint8_t const> data,
+	chunk_ihdr_data_t const & ihdr,
+	size_t num_palette_entries
+) {
+	transparency_t transparency{};
+	transparency.alpha.fill(255);
+
+	reader_t reader{ data };
+	switch(ihdr.colour_type) {
+	case COLOUR_TYPE_INDEXED_COLOUR:
+		if(data.size() > num_palette_entries)
+			throw std::runtime_error(fmt::format(
+				"tRNS has {} entries for a palette of {}",
+				data.size(), num_palette_entries
+			));
+		std::copy(data.begin(), data.end(), transparency.alpha.begin());
+		return transparency;
+	case COLOUR_TYPE_GREYSCALE:
+	case COLOUR_TYPE_TRUECOLOUR: {
+		int num_samples = ihdr.colour_type == COLOUR_TYPE_GREYSCALE ? 1 : 3;
+		if(data.size() != 2u * num_samples)
+			throw std::runtime_error(fmt::format(
+				"tRNS size mismatch: {} bytes", data.size()
+			));
+		for(int i = 0; i < num_samples; i++)
+			transparency.key[i] = ntohs(reader.read<uint16_t>("tRNS sample"));
+		transparency.keyed = true;
+		return transparency;
+	}
+	default:
+		throw std::runtime_error(
+			"tRNS is not allowed for images with an alpha channel"
+		);
+	}
+}
+
+}
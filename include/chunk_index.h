@@ -0,0 +1,55 @@
+#pragma once
+
+#include <span>
+#include <memory_resource>
+#include <vector>
+#include <algorithm>
+
+#include "chunk.h"
+
+namespace rpng {
+
+// Where a chunk lies in its datastream. Unlike chunk_t, it holds no view of
+// the data, so it stays valid after the datastream is unmapped.
+struct chunk_entry_t {
+	uint32_t type;
+	uint32_t length;
+	size_t offset;		// of the chunk data from the start of the file
+	uint32_t crc;
+};
+
+// The chunks that follow IHDR, in file order. Filled during a decode's one
+// parse pass (see decode_options_t::chunks), or by index_chunks(), from the
+// chunk headers alone. Reading and decoding a chunk is left to metadata_t.
+class chunk_index_t {
+private:
+	std::pmr::vector<chunk_entry_t> entries;
+
+public:
+	explicit chunk_index_t(
+		std::pmr::memory_resource * memory = std::pmr::get_default_resource()
+	) : entries(memory) {}
+
+	void clear() {
+		entries.clear();
+	}
+
+	void add(chunk_t const & chunk) {
+		entries.push_back({ chunk.type, chunk.length, chunk.offset, chunk.crc });
+	}
+
+	std::span<chunk_entry_t const> chunks() const {
+		return entries;
+	}
+
+	// The first chunk of the given type, or null
+	chunk_entry_t const * find(uint32_t type) const {
+		auto it = std::find_if(
+			entries.begin(), entries.end(),
+			[&](chunk_entry_t const & entry) { return entry.type == type; }
+		);
+		return it == entries.end() ? nullptr : &*it;
+	}
+};
+
+}
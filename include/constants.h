@@ -29,4 +29,12 @@ constexpr uint32_t CHUNK_TYPE_ITXT	= htonl(0x69545874);
 constexpr uint32_t CHUNK_TYPE_TEXT	= htonl(0x74455874);
 constexpr uint32_t CHUNK_TYPE_ZTXT	= htonl(0x7a545874);
 
+// APNG chunk types
+constexpr uint32_t CHUNK_TYPE_ACTL	= htonl(0x6163544c);
+constexpr uint32_t CHUNK_TYPE_FCTL	= htonl(0x6663544c);
+constexpr uint32_t CHUNK_TYPE_FDAT	= htonl(0x66644154);
+
+// Private chunk types
+constexpr uint32_t CHUNK_TYPE_RPIX	= htonl(0x72704958);
+
 }
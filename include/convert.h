@@ -0,0 +1,395 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
+#include "format.h"
+#include "layout.h"
+#include "interlace.h"
+#include "chunk/ihdr.h"
+#include "chunk/plte.h"
+#include "chunk/trns.h"
+
+namespace rpng {
+
+// What a row kernel needs besides the row: the output of every value a
+// sample of 8 bits or fewer can take, and the tRNS key of the other images
+// without an alpha channel
+struct convert_tables_t {
+	std::array<uint64_t, 256> lookup;
+	bool keyed;
+	std::array<uint16_t, 3> key;
+};
+
+using convert_row_fn_t = void (*)(
+	uint8_t * dst, uint8_t const * src, int width,
+	convert_tables_t const & tables
+);
+
+// Grey level of an 8-bit colour, with libpng's default Rec. 709 weights
+uint8_t luma(uint32_t r, uint32_t g, uint32_t b) {
+	return (6968 * r + 23434 * g + 2366 * b + 16384) >> 15;
+}
+
+// Writes one pixel of samples DEPTH bits deep. 16 bits scale to 8 rounding
+// to nearest, as png_set_scale_16 does; 8 bits scale to 16 by replication.
+template <pixel_format_t FORMAT, int DEPTH>
+void store_pixel(
+	uint8_t * dst, uint32_t r, uint32_t g, uint32_t b, uint32_t a
+) {
+	auto to8 = [](uint32_t v) -> uint8_t {
+		return DEPTH == 16 ? (v * 255 + 32895) >> 16 : v;
+	};
+	auto to16 = [](uint32_t v) -> uint16_t {
+		return DEPTH == 16 ? v : v * 257;
+	};
+
+	if constexpr(FORMAT == PIXEL_FORMAT_RGBA8) {
+		dst[0] = to8(r), dst[1] = to8(g), dst[2] = to8(b), dst[3] = to8(a);
+	} else if constexpr(FORMAT == PIXEL_FORMAT_BGRA8) {
+		dst[0] = to8(b), dst[1] = to8(g), dst[2] = to8(r), dst[3] = to8(a);
+	} else if constexpr(FORMAT == PIXEL_FORMAT_RGB8) {
+		dst[0] = to8(r), dst[1] = to8(g), dst[2] = to8(b);
+	} else if constexpr(FORMAT == PIXEL_FORMAT_GRAY8) {
+		dst[0] = luma(to8(r), to8(g), to8(b));
+	} else {
+		uint16_t pixel[4] = { to16(r), to16(g), to16(b), to16(a) };
+		memcpy(dst, pixel, sizeof(pixel));
+	}
+}
+
+// Indexed and greyscale samples of 8 bits or fewer: one table lookup per
+// pixel, SIZE bytes copied out of the entry
+template <int BITS, int SIZE>
+void convert_lookup(
+	uint8_t * dst, uint8_t const * src, int width,
+	convert_tables_t const & tables
+) {
+	constexpr int per_byte = 8 / BITS;
+	constexpr int mask = (1 << BITS) - 1;
+
+	auto put = [&](uint8_t byte, int n) {
+		for(int j = 0; j < n; j++) {
+			int index = (byte >> (8 - BITS * (j + 1))) & mask;
+			memcpy(dst, &tables.lookup[index], SIZE);
+			dst += SIZE;
+		}
+	};
+
+	int x = 0;
+	for(; x + per_byte <= width; x += per_byte) put(*src++, per_byte);
+	if(x < width) put(*src, width - x);
+}
+
+// Greyscale, grey-alpha, RGB and RGBA samples of 8 or 16 bits, one pixel at
+// a time
+template <int CHANNELS, int DEPTH, pixel_format_t FORMAT>
+void convert_direct(
+	uint8_t * dst, uint8_t const * src, int width,
+	convert_tables_t const & tables
+) {
+	constexpr uint32_t max = (1 << DEPTH) - 1;
+	auto sample = [&](int i) -> uint32_t {
+		return DEPTH == 8 ? src[i] : src[2 * i] << 8 | src[2 * i + 1];
+	};
+
+	for(int x = 0; x < width; x++) {
+		int i = x * CHANNELS;
+		uint32_t r = sample(i), g = r, b = r, a = max;
+		if constexpr(CHANNELS >= 3) {
+			g = sample(i + 1);
+			b = sample(i + 2);
+		}
+
+		if constexpr(CHANNELS % 2 == 0) {
+			a = sample(i + CHANNELS - 1);
+		} else if(tables.keyed && r == tables.key[0]) {
+			if(CHANNELS == 1 || (g == tables.key[1] && b == tables.key[2]))
+				a = 0;
+		}
+		store_pixel<FORMAT, DEPTH>(dst, r, g, b, a);
+		dst += pixel_size(FORMAT);
+	}
+}
+
+#if defined(__x86_64__)
+namespace simd {
+
+// SSSE3: 8-bit grey, grey-alpha, RGB or RGBA without a tRNS key to RGBA8 or
+// BGRA8, four pixels per byte shuffle, with opaque alpha ORed in where the
+// source has none
+template <int CHANNELS, bool BGR>
+[[gnu::target("ssse3")]]
+void expand_rgba8_ssse3(
+	uint8_t * dst, uint8_t const * src, int width,
+	convert_tables_t const & tables
+) {
+	alignas(16) uint8_t order[16], fill[16];
+	for(int p = 0; p < 4; p++) {
+		for(int k = 0; k < 4; k++) {
+			int c = BGR && k < 3 ? 2 - k : k;		// RGBA channel
+			int s = CHANNELS >= 3
+				? (c < CHANNELS ? c : -1)
+				: (c < 3 ? 0 : CHANNELS == 2 ? 1 : -1);
+			order[4 * p + k] = s < 0 ? 0x80 : p * CHANNELS + s;
+			fill[4 * p + k] = s < 0 ? 0xff : 0;
+		}
+	}
+	__m128i shuffle = _mm_load_si128((__m128i const *)order);
+	__m128i alpha = _mm_load_si128((__m128i const *)fill);
+
+	// every 16-byte load must stay within the row
+	int x = 0;
+	for(; x * CHANNELS + 16 <= width * CHANNELS; x += 4) {
+		__m128i pixels = _mm_loadu_si128((__m128i const *)(src + x * CHANNELS));
+		pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha);
+		_mm_storeu_si128((__m128i *)(dst + 4 * x), pixels);
+	}
+	convert_direct<
+		CHANNELS, 8, BGR ? PIXEL_FORMAT_BGRA8 : PIXEL_FORMAT_RGBA8
+	>(dst + 4 * x, src + x * CHANNELS, width - x, tables);
+}
+
+// SSSE3: big-endian RGBA16 to native little-endian, two pixels at a time
+[[gnu::target("ssse3")]]
+void swap_rgba16_ssse3(
+	uint8_t * dst, uint8_t const * src, int width,
+	convert_tables_t const & tables
+) {
+	__m128i shuffle = _mm_setr_epi8(
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+	);
+	int x = 0;
+	for(; x + 2 <= width; x += 2) {
+		__m128i pixels = _mm_loadu_si128((__m128i const *)(src + 8 * x));
+		_mm_storeu_si128(
+			(__m128i *)(dst + 8 * x), _mm_shuffle_epi8(pixels, shuffle)
+		);
+	}
+	convert_direct<4, 16, PIXEL_FORMAT_RGBA16>(
+		dst + 8 * x, src + 8 * x, width - x, tables
+	);
+}
+
+// Kernels for 8-bit RGBA8 or BGRA8 output, and for 16-bit RGBA passed
+// through, or null where there is none
+convert_row_fn_t convert_kernel(
+	int channels, int bit_depth, pixel_format_t format
+) {
+	if(!cpu_features().ssse3) return nullptr;
+
+	if(bit_depth == 16) {
+		bool swap = __BYTE_ORDER == __LITTLE_ENDIAN
+			&& channels == 4 && format == PIXEL_FORMAT_RGBA16;
+		return swap ? swap_rgba16_ssse3 : nullptr;
+	}
+
+	bool bgr = format == PIXEL_FORMAT_BGRA8;
+	if(format != PIXEL_FORMAT_RGBA8 && !bgr) return nullptr;
+	switch(channels) {
+	case 1: return bgr ? expand_rgba8_ssse3<1, true> : expand_rgba8_ssse3<1, false>;
+	case 2: return bgr ? expand_rgba8_ssse3<2, true> : expand_rgba8_ssse3<2, false>;
+	case 3: return bgr ? expand_rgba8_ssse3<3, true> : expand_rgba8_ssse3<3, false>;
+	default: return bgr ? expand_rgba8_ssse3<4, true> : expand_rgba8_ssse3<4, false>;
+	}
+}
+
+}
+#endif
+
+// Calls f.template operator()<FORMAT>() for a converted format
+template <class F>
+auto with_format(pixel_format_t format, F && f) {
+	switch(format) {
+	case PIXEL_FORMAT_RGBA8:	return f.template operator()<PIXEL_FORMAT_RGBA8>();
+	case PIXEL_FORMAT_RGB8:		return f.template operator()<PIXEL_FORMAT_RGB8>();
+	case PIXEL_FORMAT_GRAY8:	return f.template operator()<PIXEL_FORMAT_GRAY8>();
+	case PIXEL_FORMAT_RGBA16:	return f.template operator()<PIXEL_FORMAT_RGBA16>();
+	case PIXEL_FORMAT_BGRA8:	return f.template operator()<PIXEL_FORMAT_BGRA8>();
+	default:
+		throw std::runtime_error(
+			fmt::format("Not a converted pixel format: {}", (int)format)
+		);
+	}
+}
+
+template <int CHANNELS, int DEPTH>
+convert_row_fn_t direct_kernel(pixel_format_t format) {
+	return with_format(format, []<pixel_format_t FORMAT>() -> convert_row_fn_t {
+		return convert_direct<CHANNELS, DEPTH, FORMAT>;
+	});
+}
+
+template <int BITS>
+convert_row_fn_t lookup_kernel(pixel_format_t format) {
+	switch(pixel_size(format)) {
+	case 1: return convert_lookup<BITS, 1>;
+	case 3: return convert_lookup<BITS, 3>;
+	case 4: return convert_lookup<BITS, 4>;
+	default: return convert_lookup<BITS, 8>;
+	}
+}
+
+// Converts reconstructed rows to a pixel format. Palettes, greyscale of 8
+// bits or fewer and their tRNS transparency resolve through a table built
+// once per image; other images convert sample by sample, with byte shuffles
+// for the common 8-bit and 16-bit layouts.
+class pixel_converter_t {
+private:
+	convert_tables_t tables{};
+	convert_row_fn_t fn;
+	int size;
+
+public:
+	pixel_converter_t(
+		chunk_ihdr_data_t const & ihdr,
+		colour_properties_t const & colours,
+		pixel_format_t format,
+		std::span<uint8_t const> plte,
+		std::span<uint8_t const> trns
+	) : size(rpng::pixel_size(format)) {
+		bool indexed = ihdr.colour_type == COLOUR_TYPE_INDEXED_COLOUR;
+		if(indexed && plte.empty())
+			throw std::runtime_error("Indexed-colour image without PLTE");
+		if(indexed) plte = parse_plte(plte, ihdr);
+
+		transparency_t transparency{};
+		transparency.alpha.fill(255);
+		if(!trns.empty()) {
+			try {
+				transparency = parse_trns(trns, ihdr, plte.size() / 3);
+			} catch(std::exception const & e) {
+				SPDLOG_WARN("Ignoring tRNS chunk: {}", e.what());
+			}
+		}
+		tables.keyed = transparency.keyed;
+		tables.key = transparency.key;
+
+		bool lookup = indexed || (
+			ihdr.colour_type == COLOUR_TYPE_GREYSCALE && ihdr.bit_depth <= 8
+		);
+		if(lookup) {
+			with_format(format, [&]<pixel_format_t FORMAT>() {
+				int max = (1 << ihdr.bit_depth) - 1;
+				for(int v = 0; v < 256; v++) {
+					uint8_t * entry = (uint8_t *)&tables.lookup[v];
+					if(indexed && (size_t)v < plte.size() / 3) {
+						uint8_t const * rgb = &plte[3 * v];
+						store_pixel<FORMAT, 8>(
+							entry, rgb[0], rgb[1], rgb[2], transparency.alpha[v]
+						);
+					} else if(indexed) {
+						store_pixel<FORMAT, 8>(entry, 0, 0, 0, 255);
+					} else if(v <= max) {
+						uint32_t grey = v * 255 / max;
+						bool clear = transparency.keyed
+							&& v == transparency.key[0];
+						store_pixel<FORMAT, 8>(
+							entry, grey, grey, grey, clear ? 0 : 255
+						);
+					}
+				}
+			});
+		}
+
+		switch(lookup ? ihdr.bit_depth : 0) {
+		case 1: fn = lookup_kernel<1>(format); break;
+		case 2: fn = lookup_kernel<2>(format); break;
+		case 4: fn = lookup_kernel<4>(format); break;
+		case 8: fn = lookup_kernel<8>(format); break;
+		default:
+			fn = ihdr.bit_depth == 8
+				? with_channels<8>(colours.num_channels, format)
+				: with_channels<16>(colours.num_channels, format);
+		}
+
+#if defined(__x86_64__)
+		// shuffles cannot key transparency; grey is faster shuffled than
+		// looked up
+		bool shuffled = ihdr.bit_depth >= 8 && !indexed && !tables.keyed;
+		if(convert_row_fn_t simd_fn = shuffled
+			? simd::convert_kernel(colours.num_channels, ihdr.bit_depth, format)
+			: nullptr
+		) {
+			fn = simd_fn;
+		}
+#endif
+	}
+
+	int pixel_size() const {
+		return size;
+	}
+
+	// Converts a row of `width` pixels
+	void convert(uint8_t * dst, uint8_t const * src, int width) const {
+		fn(dst, src, width, tables);
+	}
+
+private:
+	template <int DEPTH>
+	static convert_row_fn_t with_channels(int channels, pixel_format_t format) {
+		switch(channels) {
+		case 1: return direct_kernel<1, DEPTH>(format);
+		case 2: return direct_kernel<2, DEPTH>(format);
+		case 3: return direct_kernel<3, DEPTH>(format);
+		default: return direct_kernel<4, DEPTH>(format);
+		}
+	}
+};
+
+// Where decoded rows end up: the final image at `dst`, whose rows are `pitch`
+// bytes apart, as raw samples or converted to a pixel format
+struct row_writer_t {
+	image_layout_t const & layout;
+	uint8_t * dst;
+	size_t pitch;
+	pixel_converter_t const * converter = nullptr;
+
+	// Scratch that `write` needs for a converted row of an Adam7 pass
+	size_t buffer_size() const {
+		if(!converter || layout.passes[0].pass == 0) return 0;
+		int width = 0;
+		for(int p = 0; p < layout.num_passes; p++)
+			width = std::max(width, layout.passes[p].width);
+		return (size_t)width * converter->pixel_size();
+	}
+
+	// Rows of different passes only share bytes of the final image when
+	// they are written as raw sub-byte samples
+	bool concurrent() const {
+		return converter || layout.stride_bits >= 8;
+	}
+
+	// Writes row `y` of a reduced image. Converted rows of a non-interlaced
+	// image go straight into place; those of Adam7 passes are converted into
+	// `buffer`, then scattered.
+	void write(
+		reduced_image_t const & image, int y, uint8_t const * row,
+		uint8_t * buffer
+	) const {
+		if(!converter) {
+			scatter_row(dst, pitch, row, image, y, layout.stride_bits);
+		} else if(image.pass == 0) {
+			converter->convert(dst + (size_t)y * pitch, row, image.width);
+		} else {
+			converter->convert(buffer, row, image.width);
+			reduced_image_t converted = image;
+			converted.bytes_per_row = image.width * converter->pixel_size();
+			scatter_row(
+				dst, pitch, buffer, converted, y, 8 * converter->pixel_size()
+			);
+		}
+	}
+};
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+namespace rpng {
+
+// Instruction set tiers used for runtime kernel dispatch
+enum simd_level_t : int {
+	SIMD_SCALAR		= 0,
+	SIMD_SSE2		= 1,
+	SIMD_SSSE3		= 2,
+	SIMD_AVX2		= 3
+};
+
+struct cpu_features_t {
+	bool sse2;
+	bool ssse3;
+	bool avx2;
+	bool pclmul;
+	bool bmi2;
+};
+
+cpu_features_t const & cpu_features() {
+	static cpu_features_t const features = [] {
+		cpu_features_t features{};
+#if defined(__x86_64__)
+		__builtin_cpu_init();
+		features.sse2 = __builtin_cpu_supports("sse2");
+		features.ssse3 = __builtin_cpu_supports("ssse3");
+		features.avx2 = __builtin_cpu_supports("avx2");
+		features.pclmul = __builtin_cpu_supports("pclmul");
+		features.bmi2 = __builtin_cpu_supports("bmi2");
+#endif
+		return features;
+	}();
+	return features;
+}
+
+simd_level_t simd_level() {
+	cpu_features_t const & cpu = cpu_features();
+	return cpu.avx2 ? SIMD_AVX2
+		: cpu.ssse3 ? SIMD_SSSE3
+		: cpu.sse2 ? SIMD_SSE2
+		: SIMD_SCALAR;
+}
+
+}
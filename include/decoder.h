@@ -0,0 +1,107 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "load.h"
+#include "mmap.h"
+#include "memory.h"
+#include "options.h"
+
+namespace rpng {
+
+// Decodes one image after another, keeping whatever a decode sets up from
+// each image to the next: the zlib stream and its window, which are reset
+// rather than reinitialized, the row buffers, an arena for the temporaries,
+// and the image itself. For small images such as icons and sprites, that
+// setup costs as much as the decode.
+class decoder_t {
+private:
+	decode_options_t options;
+	decode_scratch_t scratch;
+	arena_t arena;
+	std::vector<uint8_t> image;
+	chunk_ihdr_data_t ihdr_data{};
+	colour_properties_t colours{};
+
+	// Options for one decode, with the temporaries in the arena
+	decode_options_t begin() {
+		arena.reset();
+		decode_options_t decode_options = options;
+		decode_options.memory = &arena;
+		return decode_options;
+	}
+
+public:
+	// The temporaries come from an arena over options.memory, if given
+	explicit decoder_t(decode_options_t const & options = {})
+		: options(options), arena(resource_or_default(options.memory)) {}
+
+	decoder_t(decoder_t const &) = delete;
+	decoder_t & operator=(decoder_t const &) = delete;
+
+	// Decodes into the decoder's own image, which stays valid until the next
+	// call. Its rows are row_size() bytes apart.
+	std::span<uint8_t const> decode(std::span<uint8_t const> buf) {
+		decode_options_t decode_options = begin();
+
+		reader_t reader{ buf };
+		parse_png_header(reader);
+		auto [header, properties] = parse_ihdr(
+			reader, options.verify_checksums
+		);
+
+		size_t pitch = output_row_size(header, properties, options.format);
+		image.resize(header.height * pitch);
+
+		// interlaced sub-byte rows keep whatever padding bits they had
+		bool padded = options.format == PIXEL_FORMAT_RAW && header.interlace
+			&& header.bit_depth * properties.num_channels < 8;
+		if(padded) std::fill(image.begin(), image.end(), 0);
+
+		std::tie(ihdr_data, colours) = load_into(
+			reader, header, properties, image, pitch, scratch, decode_options
+		);
+		return image;
+	}
+
+	std::span<uint8_t const> decode(std::string const & filepath) {
+		mapped_file_t file(filepath);
+		return decode(file.span());
+	}
+
+	// Decodes into caller memory, as load_into() does
+	void decode_into(
+		std::span<uint8_t const> buf,
+		std::span<uint8_t> dst, size_t pitch
+	) {
+		decode_options_t decode_options = begin();
+		std::tie(ihdr_data, colours) = load_into(
+			buf, dst, pitch, scratch, decode_options
+		);
+	}
+
+	// Header of the last image decoded
+	chunk_ihdr_data_t const & ihdr() const {
+		return ihdr_data;
+	}
+
+	colour_properties_t const & colour_properties() const {
+		return colours;
+	}
+
+	size_t row_size() const {
+		return output_row_size(ihdr_data, colours, options.format);
+	}
+
+	// Applies to the following decodes, apart from `memory`, which is fixed
+	// when the decoder is constructed
+	void set_options(decode_options_t const & new_options) {
+		options = new_options;
+	}
+};
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <zlib.h>
+
+// Incremental zlib compressor, the counterpart of inflater_t. Negative
+// `window_bits` produce raw deflate data.
+class deflater_t {
+private:
+	z_stream stream {};
+	uint8_t no_output;		// zlib rejects a null next_out, even when empty
+
+public:
+	explicit deflater_t(
+		int level,
+		int strategy = Z_DEFAULT_STRATEGY,
+		int window_bits = MAX_WBITS
+	) {
+		int res = deflateInit2(
+			&stream, level, Z_DEFLATED, window_bits, 8, strategy
+		);
+		if(res != Z_OK) {
+			throw std::runtime_error(fmt::format(
+				"Could not initialize the deflate procedure: {}",
+				stream.msg ? stream.msg : "unknown error"
+			));
+		}
+	}
+
+	deflater_t(deflater_t const &) = delete;
+	deflater_t & operator=(deflater_t const &) = delete;
+
+	~deflater_t() {
+		deflateEnd(&stream);
+	}
+
+	// Prepares for a new stream, keeping the allocated window and state
+	void reset() {
+		if(deflateReset(&stream) != Z_OK) {
+			throw std::runtime_error("Could not reset the deflate procedure");
+		}
+	}
+
+	// Primes the window with data the stream may refer back to, which must
+	// come before any input
+	void set_dictionary(std::span<uint8_t const> dictionary) {
+		int res = deflateSetDictionary(
+			&stream, dictionary.data(), dictionary.size()
+		);
+		if(res != Z_OK) {
+			throw std::runtime_error("Could not set the deflate dictionary");
+		}
+	}
+
+	// Compresses as much of `in` into `out` as possible with the given zlib
+	// flush mode, advancing both spans. Returns true once a Z_FINISH flush has
+	// completed the stream.
+	bool deflate(
+		std::span<uint8_t const> & in,
+		std::span<uint8_t> & out,
+		int flush
+	) {
+		stream.next_in = (Bytef *)in.data();
+		stream.avail_in = (uInt)in.size();
+		stream.next_out = out.empty() ? &no_output : out.data();
+		stream.avail_out = (uInt)out.size();
+
+		int res = ::deflate(&stream, flush);
+
+		in = in.last(stream.avail_in);
+		out = out.last(stream.avail_out);
+
+		switch(res) {
+		case Z_STREAM_END:
+			return true;
+		case Z_OK:
+		case Z_BUF_ERROR:
+			return false;
+		default:
+			throw std::runtime_error(fmt::format(
+				"Error deflating stream: {}",
+				stream.msg ? stream.msg : "unknown error"
+			));
+		}
+	}
+};
+
+// Deflates all of `in` onto the end of `out` with the given zlib flush mode,
+// growing the buffer as needed. A flush is complete once zlib stops short of
+// filling the output.
+void deflate_append(
+	deflater_t & deflater,
+	std::span<uint8_t const> in,
+	std::vector<uint8_t> & out,
+	int flush
+) {
+	size_t size = out.size();
+	while(true) {
+		if(size == out.size()) {
+			out.resize(std::max<size_t>(
+				out.size() * 2, size + in.size() / 2 + 64
+			));
+		}
+
+		std::span<uint8_t> window = std::span(out).subspan(size);
+		bool ended = deflater.deflate(in, window, flush);
+		size = out.size() - window.size();
+
+		bool flushed = in.empty() && !window.empty() && flush != Z_FINISH;
+		if(ended || flushed) break;
+	}
+	out.resize(size);
+}
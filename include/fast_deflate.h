@@ -0,0 +1,217 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <zlib.h>
+
+#include "checksum.h"
+#include "net.h"
+
+namespace rpng {
+
+// A deflate code with any extra bits appended, in the order they are written
+struct fast_code_t {
+	uint32_t bits;
+	uint32_t length;
+};
+
+// Reverses the bottom `n` bits, since Huffman codes are written MSB first
+// into a stream that is otherwise filled LSB first
+constexpr uint32_t reverse_bits(uint32_t code, int n) {
+	uint32_t reversed = 0;
+	for(int i = 0; i < n; i++) reversed |= ((code >> i) & 1) << (n - 1 - i);
+	return reversed;
+}
+
+// Code of a literal/length symbol in deflate's fixed Huffman table
+constexpr fast_code_t fixed_code(int symbol) {
+	if(symbol < 144) return { reverse_bits(0x30 + symbol, 8), 8 };
+	if(symbol < 256) return { reverse_bits(0x190 + symbol - 144, 9), 9 };
+	if(symbol < 280) return { reverse_bits(symbol - 256, 7), 7 };
+	return { reverse_bits(0xc0 + symbol - 280, 8), 8 };
+}
+
+// Codes of every literal, and of every match length with its extra bits
+struct fast_tables_t {
+	std::array<fast_code_t, 256> literals;
+	std::array<fast_code_t, 259> lengths;
+};
+
+constexpr fast_tables_t make_fast_tables() {
+	fast_tables_t tables{};
+	for(int i = 0; i < 256; i++) tables.literals[i] = fixed_code(i);
+
+	// length symbols 257 to 284 cover 3 to 257 with 0 to 5 extra bits
+	int length = 3;
+	for(int symbol = 257; symbol < 285; symbol++) {
+		int extra = symbol < 265 ? 0 : (symbol - 261) / 4;
+		for(int e = 0; e < 1 << extra && length < 258; e++, length++) {
+			fast_code_t code = fixed_code(symbol);
+			code.bits |= e << code.length;
+			code.length += extra;
+			tables.lengths[length] = code;
+		}
+	}
+	tables.lengths[258] = fixed_code(285);
+	return tables;
+}
+
+constexpr fast_tables_t fast_tables = make_fast_tables();
+
+// Code of a distance of 1 to 8, with its extra bit
+constexpr fast_code_t distance_code(int distance) {
+	if(distance <= 4) return { reverse_bits(distance - 1, 5), 5 };
+	uint32_t symbol = 4 + (distance - 5) / 2;
+	return { reverse_bits(symbol, 5) | (uint32_t)(distance - 5) % 2 << 5, 6 };
+}
+
+// A match of `length` bytes: its length code followed by `distance`
+fast_code_t match_code(int length, fast_code_t distance) {
+	fast_code_t code = fast_tables.lengths[length];
+	return { code.bits | distance.bits << code.length,
+		code.length + distance.length };
+}
+
+// Number of leading bytes, at most `n`, on which `p` and `q` agree
+int match_length(uint8_t const * p, uint8_t const * q, int n) {
+	int i = 0;
+#if defined(__x86_64__)
+	for(; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((__m128i const *)(p + i));
+		__m128i b = _mm_loadu_si128((__m128i const *)(q + i));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+		if(mask != 0xffff) return i + __builtin_ctz(~mask);
+	}
+#endif
+	while(i < n && p[i] == q[i]) i++;
+	return i;
+}
+
+// Single-pass zlib compressor for latency-critical encodes, in the style of
+// fpng and QOI. Everything goes into one block of deflate's fixed Huffman
+// codes, so there is no table to build, and the only matches repeat the
+// previous byte or the previous pixel, compared 16 bytes at a time. On
+// filtered images those are the flat areas and repeated pixels of
+// screenshots and UI, where most of the gain is.
+class fast_deflater_t {
+private:
+	uint64_t bits = 0;
+	int num_bits = 0;
+	int last = -1;			// previous byte of the stream, once there is one
+	uLong adler = 1;
+
+	int stride;
+	fast_code_t pixel_distance;
+
+	// Appends up to 32 bits, then spills whole 32-bit words into `dst`
+	static void put(
+		uint8_t *& dst, uint64_t & bits, int & num_bits, fast_code_t code
+	) {
+		bits |= (uint64_t)code.bits << num_bits;
+		num_bits += code.length;
+		if(num_bits >= 32) {
+			uint32_t word = bits;
+			memcpy(dst, &word, 4);
+			dst += 4;
+			bits >>= 32;
+			num_bits -= 32;
+		}
+	}
+
+	template <class F>
+	void emit(std::vector<uint8_t> & out, size_t max_bytes, F && f) {
+		size_t size = out.size();
+		out.resize(size + max_bytes + 8);
+		uint8_t * dst = out.data() + size;
+		f(dst);
+		out.resize(dst - out.data());
+	}
+
+public:
+	// `stride` is the size of a pixel in bytes, from 1 to 8
+	explicit fast_deflater_t(int stride)
+		: stride(stride), pixel_distance(distance_code(stride)) {}
+
+	// Writes the zlib header and the header of the only block
+	void begin(std::vector<uint8_t> & out) {
+		out.push_back(0x78);
+		out.push_back(0x01);	// fastest level, no dictionary
+		emit(out, 1, [&](uint8_t *& dst) {
+			put(dst, bits, num_bits, { 0b011, 3 });	// BFINAL, fixed codes
+		});
+	}
+
+	void write(std::span<uint8_t const> in, std::vector<uint8_t> & out) {
+		adler = update_adler32(adler, in.data(), in.size());
+
+		// at most 9 bits a byte, for literals of 144 and up
+		emit(out, in.size() * 9 / 8 + 1, [&](uint8_t *& dst) {
+			uint64_t b = bits;
+			int nb = num_bits;
+			int prev = last;
+
+			uint8_t const * p = in.data();
+			int n = in.size();
+			for(int i = 0; i < n;) {
+				uint8_t x = p[i];
+				int limit = std::min(n - i, 258);
+
+				// a repeat of the previous byte may carry on from the last
+				// call, one of the previous pixel starts within this one
+				int byte_run = 0, pixel_run = 0;
+				if(x == prev) {
+					byte_run = 1 + match_length(p + i + 1, p + i, limit - 1);
+				}
+				if(stride > 1 && i >= stride && x == p[i - stride]) {
+					pixel_run = match_length(p + i, p + i - stride, limit);
+				}
+
+				int run = std::max(byte_run, pixel_run);
+				if(run >= 3) {
+					put(dst, b, nb, byte_run == run
+						? match_code(run, distance_code(1))
+						: match_code(run, pixel_distance)
+					);
+					i += run;
+					prev = p[i - 1];
+					continue;
+				}
+				put(dst, b, nb, fast_tables.literals[x]);
+				prev = x;
+				i++;
+			}
+
+			bits = b;
+			num_bits = nb;
+			last = prev;
+		});
+	}
+
+	// Ends the block and the zlib stream with the Adler-32 trailer
+	void finish(std::vector<uint8_t> & out) {
+		emit(out, 8, [&](uint8_t *& dst) {
+			put(dst, bits, num_bits, fixed_code(256));
+			while(num_bits > 0) {
+				*dst++ = bits;
+				bits >>= 8;
+				num_bits -= 8;
+			}
+			bits = 0;
+			num_bits = 0;
+
+			uint32_t trailer = htonl(adler);
+			memcpy(dst, &trailer, 4);
+			dst += 4;
+		});
+	}
+};
+
+}
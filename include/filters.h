@@ -2,6 +2,13 @@
 
 namespace rpng {
 
+// Filter types
+constexpr uint8_t FILTER_TYPE_NONE		= 0;
+constexpr uint8_t FILTER_TYPE_SUB		= 1;
+constexpr uint8_t FILTER_TYPE_UP		= 2;
+constexpr uint8_t FILTER_TYPE_AVG		= 3;
+constexpr uint8_t FILTER_TYPE_PAETH		= 4;
+
 uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
     int16_t p = (int16_t)a + b - c;
     uint16_t pa = abs(p - a);
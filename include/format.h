@@ -0,0 +1,35 @@
+#pragma once
+
+namespace rpng {
+
+// Layouts `load` can produce. Raw keeps the samples as stored: sub-byte
+// samples packed, 16-bit samples big-endian, indices unexpanded. The others
+// expand palettes and tRNS transparency and scale every sample to the
+// format's depth.
+enum pixel_format_t : int {
+	PIXEL_FORMAT_RAW		= 0,
+	PIXEL_FORMAT_RGBA8		= 1,
+	PIXEL_FORMAT_RGB8		= 2,	// alpha dropped
+	PIXEL_FORMAT_GRAY8		= 3,	// colour weighted as libpng does
+	PIXEL_FORMAT_RGBA16		= 4,	// native-endian
+	PIXEL_FORMAT_BGRA8		= 5
+};
+
+// Bytes per pixel of a converted format
+constexpr int pixel_size(pixel_format_t format) {
+	switch(format) {
+	case PIXEL_FORMAT_RGBA8:
+	case PIXEL_FORMAT_BGRA8:
+		return 4;
+	case PIXEL_FORMAT_RGB8:
+		return 3;
+	case PIXEL_FORMAT_GRAY8:
+		return 1;
+	case PIXEL_FORMAT_RGBA16:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+}
@@ -1,47 +1,245 @@
 #pragma once
 
+#include <span>
 #include <vector>
+#include <cstring>
+#include <new>
+#include <memory_resource>
 #include <stdexcept>
 
 #include <zlib.h>
 
-std::vector<uint8_t> inflate(std::vector<uint8_t> & in) {
-	z_stream stream { .next_in = in.data(), .avail_in = (uInt)in.size() };
-	if(inflateInit(&stream) != Z_OK) {
-		throw std::runtime_error(fmt::format(
-			"Could not initialize the inflate procedure: {}", stream.msg
-		));
+#include "builtin_inflate.h"
+
+// zalloc and zfree over the memory resource passed as zlib's opaque pointer.
+// zlib frees without a size, so each block starts with its own.
+constexpr size_t ZLIB_BLOCK_HEADER = 16;
+
+void * zlib_allocate(void * opaque, uInt items, uInt size) {
+	auto * memory = (std::pmr::memory_resource *)opaque;
+	size_t n = (size_t)items * size;
+	try {
+		auto * block = (uint8_t *)memory->allocate(
+			ZLIB_BLOCK_HEADER + n, ZLIB_BLOCK_HEADER
+		);
+		memcpy(block, &n, sizeof(n));
+		return block + ZLIB_BLOCK_HEADER;
+	} catch(std::bad_alloc const &) {
+		return Z_NULL;		// reported by zlib as Z_MEM_ERROR
+	}
+}
+
+void zlib_free(void * opaque, void * address) {
+	auto * memory = (std::pmr::memory_resource *)opaque;
+	uint8_t * block = (uint8_t *)address - ZLIB_BLOCK_HEADER;
+	size_t n;
+	memcpy(&n, block, sizeof(n));
+	memory->deallocate(block, ZLIB_BLOCK_HEADER + n, ZLIB_BLOCK_HEADER);
+}
+
+// Incremental zlib decompressor. Input and output may be supplied piecewise,
+// e.g. one IDAT chunk at a time, without first being gathered into a buffer.
+// Negative `window_bits` inflate raw deflate data, without the zlib header and
+// Adler-32 trailer. Given a memory resource, zlib's state and window are
+// allocated from it. A zlib stream can instead be inflated by rpng's own
+// decoder, chosen with use_builtin().
+class inflater_t {
+private:
+	z_stream stream {};
+	bool done = false;
+	uint8_t no_output;		// zlib rejects a null next_out, even when empty
+	bool verify = true;
+	bool builtin = false;
+	rpng::builtin_inflater_t builtin_inflater;
+
+public:
+	explicit inflater_t(
+		int window_bits = MAX_WBITS,
+		std::pmr::memory_resource * memory = nullptr
+	) {
+		if(memory) {
+			stream.zalloc = zlib_allocate;
+			stream.zfree = zlib_free;
+			stream.opaque = memory;
+		}
+		if(inflateInit2(&stream, window_bits) != Z_OK) {
+			throw std::runtime_error(fmt::format(
+				"Could not initialize the inflate procedure: {}",
+				stream.msg ? stream.msg : "unknown error"
+			));
+		}
+	}
+
+	inflater_t(inflater_t const &) = delete;
+	inflater_t & operator=(inflater_t const &) = delete;
+
+	~inflater_t() {
+		inflateEnd(&stream);
+	}
+
+	// Switches between zlib and the built-in decoder for the following
+	// streams, which must be zlib streams, not raw deflate data
+	void use_builtin(bool enable) {
+		builtin = enable;
+	}
+
+	rpng::builtin_inflater_t & builtin_decoder() {
+		return builtin_inflater;
+	}
+
+	// Whether the Adler-32 trailer of the following streams is checked. Off,
+	// neither zlib nor the built-in decoder computes it at all.
+	void verify_checksum(bool enable) {
+		if(enable == verify) return;
+		verify = enable;
+		inflateValidate(&stream, enable);
+		builtin_inflater.verify_checksum(enable);
+	}
+
+	bool verifies_checksum() const {
+		return verify;
+	}
+
+	// Prepares for a new stream, keeping the allocated window and state
+	void reset() {
+		if(builtin) {
+			builtin_inflater.reset();
+			return;
+		}
+		if(inflateReset(&stream) != Z_OK) {
+			throw std::runtime_error("Could not reset the inflate procedure");
+		}
+		done = false;
+	}
+
+	bool finished() const {
+		return builtin ? builtin_inflater.finished() : done;
 	}
 
-	std::vector<uint8_t> out(in.size() * 2);
-	stream.next_out = out.data();
-	stream.avail_out = out.size();
+	uint64_t total_out() const {
+		return builtin ? builtin_inflater.total_out() : stream.total_out;
+	}
+
+	// Inflates as much of `in` into `out` as possible, advancing both spans
+	// past the consumed and produced bytes. Returns true once the end of the
+	// zlib stream has been reached.
+	bool inflate(std::span<uint8_t const> & in, std::span<uint8_t> & out) {
+		if(builtin) return builtin_inflater.inflate(in, out);
+		if(done) return true;
+
+		stream.next_in = (Bytef *)in.data();
+		stream.avail_in = (uInt)in.size();
+		stream.next_out = out.empty() ? &no_output : out.data();
+		stream.avail_out = (uInt)out.size();
 
-	int res;
-	while((res = inflate(&stream, Z_FINISH)) != Z_STREAM_END) {
-		if(stream.avail_out == 0 && (res == Z_OK || res == Z_BUF_ERROR)) {
-			out.resize(out.size() * 2);
-			stream.next_out = out.data() + stream.total_out;
-			stream.avail_out = stream.total_out;
-		} else {
-			std::string msg;
+		int res = ::inflate(&stream, Z_NO_FLUSH);
 
-			if(stream.avail_in == 0) msg = "Ran out of input to decompress";
-			else if(res == Z_NEED_DICT) msg = "Z_NEED_DICT: unhandled error";
-			else msg = fmt::format("Error inflating stream: {}", stream.msg);
+		in = in.last(stream.avail_in);
+		out = out.last(stream.avail_out);
 
-			if(inflateEnd(&stream) != Z_OK) {
-				msg = fmt::format("{}\nAND\n{}", msg, stream.msg);
-			}
-			throw std::runtime_error(msg);
+		switch(res) {
+		case Z_STREAM_END:
+			done = true;
+			return true;
+		case Z_OK:
+		case Z_BUF_ERROR:
+			return false;
+		case Z_NEED_DICT:
+			throw std::runtime_error("Z_NEED_DICT: unhandled error");
+		default:
+			throw std::runtime_error(fmt::format(
+				"Error inflating stream: {}",
+				stream.msg ? stream.msg : "unknown error"
+			));
 		}
 	}
+};
+
+// Inflates `in` onto the end of the first `size` bytes of `out`, doubling the
+// buffer whenever it fills up, to no more than `max_size` bytes
+void inflate_append(
+	inflater_t & inflater,
+	std::span<uint8_t const> in,
+	std::vector<uint8_t> & out,
+	size_t & size,
+	size_t max_size = SIZE_MAX
+) {
+	while(!in.empty() && !inflater.finished()) {
+		if(size == out.size() && size < max_size)
+			out.resize(std::min(std::max<size_t>(out.size() * 2, 64), max_size));
+
+		std::span<uint8_t> window = std::span(out).subspan(size);
+		size_t avail_in = in.size();
+		inflater.inflate(in, window);
+		size = out.size() - window.size();
+
+		// at the limit, with output still to come
+		bool stalled = window.empty() && in.size() == avail_in;
+		if(stalled && !inflater.finished())
+			throw std::runtime_error(fmt::format(
+				"Inflated data exceeds the limit of {} bytes", max_size
+			));
+	}
+}
+
+// Inflates a whole zlib datastream, given in `segments`, of at most
+// `max_size` bytes
+template <class Range>
+std::vector<uint8_t> inflate(
+	Range const & segments,
+	size_t max_size = SIZE_MAX
+) {
+	inflater_t inflater;
+	std::vector<uint8_t> out;
+	size_t size = 0;
 
-	out.resize(stream.total_out);
-	if(inflateEnd(&stream) != Z_OK) {
+	for(std::span<uint8_t const> in : segments) {
+		if(out.empty()) out.resize(std::min(in.size() * 2, max_size));
+		inflate_append(inflater, in, out, size, max_size);
+	}
+
+	if(!inflater.finished())
+		throw std::runtime_error("Ran out of input to decompress");
+
+	out.resize(size);
+	return out;
+}
+
+// Inflates `in` into the window `out`, which must be large enough for the rest
+// of the stream. A stream that still has output pending once `out` is full is
+// rejected.
+void inflate_into(
+	inflater_t & inflater,
+	std::span<uint8_t const> in,
+	std::span<uint8_t> & out
+) {
+	while(!in.empty() && !inflater.finished()) {
+		size_t avail_in = in.size();
+		inflater.inflate(in, out);
+		if(out.empty() && in.size() == avail_in && !inflater.finished())
+			throw std::runtime_error(
+				"Inflated data exceeds the size implied by IHDR"
+			);
+	}
+}
+
+// Checks that the stream ended exactly when the window `out` was filled
+void inflate_finish(inflater_t const & inflater, std::span<uint8_t> out) {
+	if(!inflater.finished())
+		throw std::runtime_error("Ran out of input to decompress");
+	else if(!out.empty())
 		throw std::runtime_error(fmt::format(
-			"Could not cleanup inflate procedure: {}", stream.msg
+			"Inflated data is {} bytes short of the size implied by IHDR",
+			out.size()
 		));
+}
+
+// Inflates `segments` in a single pass into `out`, whose size is known up front
+template <class Range>
+void inflate_exact(Range const & segments, std::span<uint8_t> out) {
+	inflater_t inflater;
+	for(std::span<uint8_t const> in : segments) {
+		inflate_into(inflater, in, out);
 	}
-	return out;
+	inflate_finish(inflater, out);
 }
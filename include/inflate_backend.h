@@ -0,0 +1,173 @@
+#pragma once
+
+#include <span>
+#include <new>
+#include <stdexcept>
+
+#include <dlfcn.h>
+
+#include <fmt/format.h>
+
+namespace rpng {
+
+// Which library inflates the image data. zlib inflates the datastream
+// piecewise, as the IDAT chunks arrive; zlib-ng built with ZLIB_COMPAT links
+// in its place unchanged. libdeflate inflates the whole datastream in one
+// call, straight into a buffer of the size IHDR implies, which is quicker but
+// needs all of the data up front. The built-in decoder (builtin_inflate.h)
+// works either way and needs no other library.
+enum inflate_backend_t : int {
+	INFLATE_BACKEND_ZLIB = 0,
+	INFLATE_BACKEND_LIBDEFLATE,
+	INFLATE_BACKEND_BUILTIN
+};
+
+// Chosen at build time with the RPNG_INFLATE_BACKEND CMake option
+#ifndef RPNG_DEFAULT_INFLATE_BACKEND
+#define RPNG_DEFAULT_INFLATE_BACKEND INFLATE_BACKEND_ZLIB
+#endif
+
+// The part of libdeflate's API that is used, resolved when first needed so
+// that the library stays an optional, run-time dependency
+struct libdeflate_api_t {
+	void * (*alloc_decompressor)();
+	int (*zlib_decompress)(
+		void * decompressor,
+		void const * in, size_t in_size,
+		void * out, size_t out_size, size_t * actual_out_size
+	);
+	int (*deflate_decompress)(
+		void * decompressor,
+		void const * in, size_t in_size,
+		void * out, size_t out_size, size_t * actual_out_size
+	);
+	void (*free_decompressor)(void * decompressor);
+};
+
+// Results of libdeflate_zlib_decompress() and libdeflate_deflate_decompress()
+constexpr int LIBDEFLATE_SUCCESS = 0;
+constexpr int LIBDEFLATE_BAD_DATA = 1;
+constexpr int LIBDEFLATE_INSUFFICIENT_SPACE = 3;
+
+// Null if libdeflate cannot be loaded
+libdeflate_api_t const * libdeflate_api() {
+	static libdeflate_api_t const * api = []() -> libdeflate_api_t const * {
+		void * lib = dlopen("libdeflate.so.0", RTLD_NOW | RTLD_LOCAL);
+		if(!lib) return nullptr;
+
+		static libdeflate_api_t loaded{
+			reinterpret_cast<decltype(loaded.alloc_decompressor)>(
+				dlsym(lib, "libdeflate_alloc_decompressor")
+			),
+			reinterpret_cast<decltype(loaded.zlib_decompress)>(
+				dlsym(lib, "libdeflate_zlib_decompress")
+			),
+			reinterpret_cast<decltype(loaded.deflate_decompress)>(
+				dlsym(lib, "libdeflate_deflate_decompress")
+			),
+			reinterpret_cast<decltype(loaded.free_decompressor)>(
+				dlsym(lib, "libdeflate_free_decompressor")
+			)
+		};
+		bool complete = loaded.alloc_decompressor
+			&& loaded.zlib_decompress
+			&& loaded.deflate_decompress
+			&& loaded.free_decompressor;
+		return complete ? &loaded : nullptr;
+	}();
+	return api;
+}
+
+bool inflate_backend_available(inflate_backend_t backend) {
+	switch(backend) {
+	case INFLATE_BACKEND_ZLIB:
+	case INFLATE_BACKEND_BUILTIN:
+		return true;
+	case INFLATE_BACKEND_LIBDEFLATE:
+		return libdeflate_api() != nullptr;
+	}
+	return false;
+}
+
+char const * inflate_backend_name(inflate_backend_t backend) {
+	switch(backend) {
+	case INFLATE_BACKEND_ZLIB:
+		return "zlib";
+	case INFLATE_BACKEND_LIBDEFLATE:
+		return "libdeflate";
+	case INFLATE_BACKEND_BUILTIN:
+		return "builtin";
+	}
+	return "unknown";
+}
+
+// Whole-buffer decompressor over libdeflate, allocated on first use and kept
+// from one image to the next
+class libdeflate_inflater_t {
+private:
+	void * decompressor = nullptr;
+
+public:
+	libdeflate_inflater_t() = default;
+	libdeflate_inflater_t(libdeflate_inflater_t const &) = delete;
+	libdeflate_inflater_t & operator=(libdeflate_inflater_t const &) = delete;
+
+	~libdeflate_inflater_t() {
+		if(decompressor) libdeflate_api()->free_decompressor(decompressor);
+	}
+
+	// Inflates the complete zlib datastream `in`, which must fill `out`
+	// exactly. Without `verify_checksum`, only the header is checked and the
+	// deflate data after it is inflated raw, skipping the Adler-32.
+	void inflate(
+		std::span<uint8_t const> in, std::span<uint8_t> out,
+		bool verify_checksum = true
+	) {
+		libdeflate_api_t const * api = libdeflate_api();
+		if(!api) throw std::runtime_error("libdeflate is not available");
+		if(!decompressor) decompressor = api->alloc_decompressor();
+		if(!decompressor) throw std::bad_alloc();
+
+		auto decompress = api->zlib_decompress;
+		if(!verify_checksum) {
+			bool valid = in.size() >= 2
+				&& (in[0] & 0x0f) == 8 && (in[0] >> 4) <= 7
+				&& !(in[1] & 0x20) && (in[0] << 8 | in[1]) % 31 == 0;
+			if(!valid)
+				throw std::runtime_error(
+					"Error inflating stream: incorrect header check"
+				);
+			decompress = api->deflate_decompress;
+			in = in.subspan(2);
+		}
+
+		size_t size = 0;
+		int res = decompress(
+			decompressor, in.data(), in.size(), out.data(), out.size(), &size
+		);
+		switch(res) {
+		case LIBDEFLATE_SUCCESS:
+			if(size != out.size())
+				throw std::runtime_error(fmt::format(
+					"Inflated data is {} bytes short of the size implied by "
+					"IHDR",
+					out.size() - size
+				));
+			return;
+		case LIBDEFLATE_BAD_DATA:
+			throw std::runtime_error(
+				"Error inflating stream: invalid compressed data"
+			);
+		case LIBDEFLATE_INSUFFICIENT_SPACE:
+			throw std::runtime_error(
+				"Inflated data exceeds the size implied by IHDR"
+			);
+		default:
+			throw std::runtime_error(fmt::format(
+				"Error inflating stream: libdeflate result {}", res
+			));
+		}
+	}
+};
+
+}
@@ -1,70 +1,227 @@
 #pragma once
 
+#include <span>
+#include <array>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
 #include "pass.h"
-#include "utils.h"
+#include "layout.h"
+#include "reconstruct.h"
+#include "thread_pool.h"
 
 namespace rpng {
 
-std::vector<uint8_t> deinterlace_aligned(
-	uint8_t const * src,
-	int width, int height, int stride
-) {
-	std::vector<uint8_t> out(width * height * stride);
-	for(int p = 1; p <= 7; p++) {
-		interlace_pass_t const & pass = interlace_passes[p];
-		for(int y = pass.offset_y; y < height; y += pass.period_y) {
-			for(int x = pass.offset_x; x < width; x += pass.period_x) {
-				for(int k = 0; k < stride; k++) {
-					out[(y * width + x) * stride + k] = *(src++);
-				}
+// Spreads the samples of one byte of a sub-byte reduced image over `period`
+// bytes of the final row, one sample every `period` sample slots, packed MSB
+// first into the top of a 64-bit word
+struct spread_table_t {
+	std::array<uint64_t, 256> bits;
+	uint64_t mask;				// every slot the byte's samples land in
+};
+
+spread_table_t make_spread_table(int period, int stride_bits) {
+	spread_table_t table{};
+	int samples_per_byte = 8 / stride_bits;
+	uint64_t sample_mask = (1 << stride_bits) - 1;
+	for(int v = 0; v < 256; v++) {
+		for(int i = 0; i < samples_per_byte; i++) {
+			uint64_t sample = (v >> (8 - (i + 1) * stride_bits)) & sample_mask;
+			int shift = 64 - (i * period + 1) * stride_bits;
+			table.bits[v] |= sample << shift;
+			if(v == 0) table.mask |= sample_mask << shift;
+		}
+	}
+	return table;
+}
+
+// Tables for periods 2, 4 and 8 and depths of 1, 2 and 4 bits
+spread_table_t const & spread_table(int period, int stride_bits) {
+	static std::array<spread_table_t, 9> const tables = [] {
+		std::array<spread_table_t, 9> tables;
+		for(int p = 0; p < 3; p++) {
+			for(int b = 0; b < 3; b++) {
+				tables[p * 3 + b] = make_spread_table(2 << p, 1 << b);
 			}
 		}
+		return tables;
+	}();
+	int p = __builtin_ctz(period) - 1;
+	int b = __builtin_ctz(stride_bits);
+	return tables[p * 3 + b];
+}
+
+// Merges the top `n` bytes of `bits`, where `mask` is set, into `dst`
+void merge_bytes(uint8_t * dst, uint64_t bits, uint64_t mask, int n) {
+	for(int j = 0; j < n; j++) {
+		int shift = 56 - 8 * j;
+		dst[j] ^= (dst[j] ^ (uint8_t)(bits >> shift)) & (uint8_t)(mask >> shift);
 	}
-	return out;
 }
 
-std::vector<uint8_t> deinterlace_unaligned(
-	uint8_t const * src,
-	int width, int height, int stride_bits
+// Scatters a row of 1, 2 or 4-bit samples, each source byte placing all of
+// its samples with one table lookup and a masked write of `period` bytes.
+// Bits of the final row outside the pass's samples are left untouched.
+void scatter_subbyte_row(
+	uint8_t * dst, uint8_t const * row, int width,
+	interlace_pass_t const & pass, int stride_bits
 ) {
-	int bytes_per_row = (width * stride_bits + 7) / 8;
+	spread_table_t const & table = spread_table(pass.period_x, stride_bits);
 	int samples_per_byte = 8 / stride_bits;
+	int shift = pass.offset_x * stride_bits;
+
+	// a source byte's last sample ends this many bits into its destination
+	auto end_bit = [&](int samples) {
+		return shift + ((samples - 1) * pass.period_x + 1) * stride_bits;
+	};
+
+	int full = width / samples_per_byte;
+	int n = (end_bit(samples_per_byte) + 7) / 8;
+	uint64_t mask = table.mask >> shift;
+	for(int k = 0; k < full; k++) {
+		merge_bytes(dst, table.bits[row[k]] >> shift, mask, n);
+		dst += pass.period_x;
+	}
 
-	std::vector<uint8_t> out(height * bytes_per_row);
-	for(int p = 1; p <= 7; p++) {
-		interlace_pass_t const & pass = interlace_passes[p];
-
-		int pass_width = count(width, pass.offset_x, pass.period_x);
-		int bytes_per_pass_row = (pass_width * stride_bits + 7) / 8;
-
-		for(int y = pass.offset_y; y < height; y += pass.period_y) {
-			int x = pass.offset_x;
-			for(int b = 0; b < bytes_per_pass_row; b++, src++) {
-				for(int s = 0; s < samples_per_byte; s++, x += pass.period_x) {
-					bitcpy_unaligned(
-						&out[y * bytes_per_row + (x * stride_bits / 8)],
-						*src,
-						(x * stride_bits) % 8,
-						s * stride_bits,
-						stride_bits
-					);
-				}
+	// the padding bits of the last byte must not reach the final row
+	if(int rest = width - full * samples_per_byte) {
+		int end = end_bit(rest);
+		uint64_t keep = ~0ull << (64 - end);
+		merge_bytes(
+			dst, table.bits[row[full]] >> shift, mask & keep, (end + 7) / 8
+		);
+	}
+}
+
+// Writes row `y` of a reconstructed reduced image to its final position in the
+// image at `dst`, whose rows are `pitch` bytes apart
+void scatter_row(
+	uint8_t * dst, size_t pitch,
+	uint8_t const * row,
+	reduced_image_t const & image, int y,
+	int stride_bits
+) {
+	interlace_pass_t const & pass = interlace_passes[image.pass];
+	dst += (size_t)(pass.offset_y + y * pass.period_y) * pitch;
+
+	int tail_bits = (size_t)image.width * stride_bits % 8;
+	if(pass.period_x == 1 && image.pass && tail_bits) {
+		// like libpng, keep the padding bits of the final row
+		int n = image.bytes_per_row - 1;
+		memcpy(dst, row, n);
+		uint8_t mask = 0xff << (8 - tail_bits);
+		dst[n] ^= (dst[n] ^ row[n]) & mask;
+	} else if(pass.period_x == 1) {
+		memcpy(dst, row, image.bytes_per_row);
+	} else if(stride_bits >= 8) {
+		int stride = stride_bits / 8;
+		for(int i = 0; i < image.width; i++) {
+			int x = pass.offset_x + i * pass.period_x;
+			for(int k = 0; k < stride; k++) {
+				dst[x * stride + k] = *(row++);
 			}
 		}
+	} else {
+		scatter_subbyte_row(dst, row, image.width, pass, stride_bits);
 	}
-	return out;
 }
 
+// Fills bands of final rows, `pitch` bytes apart, from the reconstructed rows
+// of every reduced image, located by row_at(reduced_image_t const &, int y).
+// Sub-byte samples from different passes share bytes, so the work is split
+// by row, not by pass.
+template <class RowAt>
+void scatter_bands(
+	uint8_t * dst, size_t pitch,
+	image_layout_t const & layout,
+	int height,
+	RowAt && row_at,
+	thread_pool_t * pool
+) {
+	// fills final rows [y0, y1)
+	auto scatter_rows = [&](int y0, int y1) {
+		for(int p = 0; p < layout.num_passes; p++) {
+			reduced_image_t const & image = layout.passes[p];
+			interlace_pass_t const & pass = interlace_passes[image.pass];
+
+			int first = count(y0, pass.offset_y, pass.period_y);
+			int last = std::min(
+				count(y1, pass.offset_y, pass.period_y),
+				image.height
+			);
+			for(int y = first; y < last; y++) {
+				scatter_row(
+					dst, pitch,
+					row_at(image, y), image, y,
+					layout.stride_bits
+				);
+			}
+		}
+	};
+
+	if(pool) {
+		int num_bands = std::min(height, 4 * pool->size());
+		pool->parallel_for(num_bands, [&](int band) {
+			scatter_rows(
+				(int64_t)height * band / num_bands,
+				(int64_t)height * (band + 1) / num_bands
+			);
+		});
+	} else {
+		scatter_rows(0, height);
+	}
+}
+
+// Scatters the reconstructed reduced images into the final image, in
+// parallel bands of rows given a pool
 std::vector<uint8_t> deinterlace(
 	std::vector<uint8_t> const & in,
 	chunk_ihdr_data_t const & ihdr,
-	colour_properties_t const & colours
+	colour_properties_t const & colours,
+	thread_pool_t * pool = nullptr
+) {
+	image_layout_t layout = image_layout(ihdr, colours);
+	std::vector<uint8_t> out(layout.raw_size);
+
+	scatter_bands(out.data(), layout.bytes_per_row, layout, ihdr.height, [&](
+		reduced_image_t const & image, int y
+	) {
+		return in.data() + image.offset + (size_t)y * image.bytes_per_row;
+	}, pool);
+	return out;
+}
+
+// Reconstructs the reduced images of the inflated datastream in place and
+// writes each row straight to its final position in `dst`, whose rows are
+// `pitch` bytes apart, with no packed intermediate image. Given a pool, the
+// reduced images are reconstructed in parallel. Passes of whole-byte pixels
+// never share a byte of `dst`, so their rows are scattered as soon as they
+// are unfiltered; sub-byte images are scattered afterwards in bands of final
+// rows.
+void reconstruct_deinterlace(
+	std::span<uint8_t> filtered,
+	image_layout_t const & layout,
+	int height,
+	uint8_t * dst, size_t pitch,
+	thread_pool_t * pool = nullptr
 ) {
-	int stride_bits	= ihdr.bit_depth * colours.num_channels;
-	int stride = (stride_bits + 7) / 8;
-	return stride_bits >= 8
-		? deinterlace_aligned(in.data(), ihdr.width, ihdr.height, stride)
-		: deinterlace_unaligned(in.data(), ihdr.width, ihdr.height, stride_bits);
+	bool fused = layout.stride_bits >= 8;
+	reconstruct_in_place(filtered, layout, pool, [&](
+		reduced_image_t const & image, int y, uint8_t const * row
+	) {
+		if(fused) {
+			scatter_row(dst, pitch, row, image, y, layout.stride_bits);
+		}
+	});
+	if(fused) return;
+
+	scatter_bands(dst, pitch, layout, height, [&](
+		reduced_image_t const & image, int y
+	) {
+		return filtered.data() + image.filtered_offset
+			+ (size_t)y * (1 + image.bytes_per_row) + 1;
+	}, pool);
 }
 
 }
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+
+#include "chunk/ihdr.h"
+#include "pass.h"
+
+namespace rpng {
+
+// A non-empty reduced image: the whole image, or one of the Adam7 passes
+struct reduced_image_t {
+	int pass;
+	int width, height;			// in pixels
+	int bytes_per_row;			// excluding the filter type byte
+	size_t filtered_offset;		// offset within the inflated datastream
+	size_t offset;				// offset within the reconstructed datastream
+};
+
+// Sizes and offsets of every stage of the decode, fully determined by IHDR
+struct image_layout_t {
+	int stride_bits;
+	int stride;					// bytes per pixel, rounded up
+	int bytes_per_row;			// of the final image
+	int max_bytes_per_row;		// of any reduced image
+	int num_passes;
+	std::array<reduced_image_t, 7> passes;
+	size_t filtered_size;
+	size_t reconstructed_size;
+	size_t raw_size;
+};
+
+image_layout_t image_layout(
+	chunk_ihdr_data_t const & ihdr,
+	colour_properties_t const & colours
+) {
+	image_layout_t layout{};
+	layout.stride_bits = ihdr.bit_depth * colours.num_channels;
+	layout.stride = (layout.stride_bits + 7) / 8;
+	layout.bytes_per_row = ((size_t)ihdr.width * layout.stride_bits + 7) / 8;
+	layout.raw_size = (size_t)ihdr.height * layout.bytes_per_row;
+
+	int first_pass = ihdr.interlace ? 1 : 0;
+	int last_pass = ihdr.interlace ? 7 : 0;
+
+	for(int p = first_pass; p <= last_pass; p++) {
+		interlace_pass_t const & pass = interlace_passes[p];
+
+		int pass_width = count(ihdr.width, pass.offset_x, pass.period_x);
+		int pass_height = count(ihdr.height, pass.offset_y, pass.period_y);
+		if(!pass_width || !pass_height) continue;
+
+		int bytes_per_pass_row
+			= ((size_t)pass_width * layout.stride_bits + 7) / 8;
+
+		layout.passes[layout.num_passes++] = {
+			p,
+			pass_width, pass_height,
+			bytes_per_pass_row,
+			layout.filtered_size,
+			layout.reconstructed_size
+		};
+		layout.max_bytes_per_row
+			= std::max(layout.max_bytes_per_row, bytes_per_pass_row);
+		layout.filtered_size += (size_t)pass_height * (1 + bytes_per_pass_row);
+		layout.reconstructed_size += (size_t)pass_height * bytes_per_pass_row;
+	}
+	return layout;
+}
+
+}
@@ -1,13 +1,68 @@
 #pragma once
 
 #include <cstdio>
+#include <cstring>
+#include <span>
 #include <vector>
+#include <utility>
 #include <string>
 
 #include <fmt/format.h>
 #include <png.h>
 
-std::vector<uint8_t> decode(std::string const & filepath) {
+// Reads the image through `png` once its input has been set up, and packs the
+// rows with any padding bits of the final byte cleared. A non-zero
+// `rgba_depth` of 8 or 16 expands every image to RGBA of that depth, 16-bit
+// samples in native byte order.
+std::vector<uint8_t> decode(
+	png_struct * png, png_info * info, int rgba_depth = 0
+) {
+	if(rgba_depth) {
+		png_set_expand(png);
+		png_set_gray_to_rgb(png);
+		if(rgba_depth == 16) {
+			png_set_expand_16(png);
+		} else {
+			png_set_scale_16(png);
+		}
+		png_set_add_alpha(png, 0xffff, PNG_FILLER_AFTER);
+	}
+	png_read_png(png, info, PNG_TRANSFORM_IDENTITY, nullptr);
+
+	png_uint_32 width = png_get_image_width(png, info);
+	png_uint_32 height = png_get_image_height(png, info);
+
+	png_byte num_channels = rgba_depth ? 4 : png_get_channels(png, info);
+	png_byte bit_depth = rgba_depth ? rgba_depth : png_get_bit_depth(png, info);
+
+	int bits_per_row = width * num_channels * bit_depth;
+	int bytes_per_row = (bits_per_row + 7) / 8;
+
+	uint8_t final_byte_mask = 0xff;
+ 	if(bits_per_row % 8) {
+		final_byte_mask	= ~(0xff >> (bits_per_row % 8));
+	}
+
+	png_byte ** rows = png_get_rows(png, info);
+
+	std::vector<uint8_t> img;
+	for(uint32_t i = 0; i < height; i++) {
+		for(int j = 0; j < bytes_per_row - 1; j++) {
+			img.push_back(rows[i][j]);
+		}
+		img.push_back(rows[i][bytes_per_row - 1] & final_byte_mask);
+	}
+
+	// png_set_swap only applies to images stored with 16-bit samples
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	if(rgba_depth == 16) {
+		for(size_t i = 0; i < img.size(); i += 2) std::swap(img[i], img[i + 1]);
+	}
+#endif
+	return img;
+}
+
+std::vector<uint8_t> decode(std::string const & filepath, int rgba_depth = 0) {
 	FILE * file = fopen(filepath.c_str(), "rb");
 	if(!file)
 		throw std::runtime_error(fmt::format("Cannot open file: {}", filepath));
@@ -28,33 +83,119 @@ std::vector<uint8_t> decode(std::string const & filepath) {
 	}
 
 	png_init_io(png, file);
-	png_read_png(png, info, PNG_TRANSFORM_IDENTITY, nullptr);
-
-	png_uint_32 width = png_get_image_width(png, info);
-	png_uint_32 height = png_get_image_height(png, info);
+	std::vector<uint8_t> img = decode(png, info, rgba_depth);
 
-	png_byte num_channels = png_get_channels(png, info);
-	png_byte bit_depth = png_get_bit_depth(png, info);
+	png_destroy_read_struct(&png, &info, nullptr);
+	fclose(file);
+	return img;
+}
 
-	int bits_per_row = width * num_channels * bit_depth;
-	int bytes_per_row = (bits_per_row + 7) / 8;
+// Decodes an in-memory datastream. libpng errors, e.g. a CRC mismatch, are
+// thrown as std::runtime_error.
+std::vector<uint8_t> decode(std::span<uint8_t const> buf) {
+	png_struct * png = png_create_read_struct(
+		PNG_LIBPNG_VER_STRING,
+		nullptr,
+		[](png_struct *, char const * message) {
+			throw std::runtime_error(message);
+		},
+		nullptr
+	);
+	if(!png) throw std::runtime_error("Couldn't create a png struct");
 
-	uint8_t final_byte_mask = 0xff;
- 	if(bits_per_row % 8) {
-		final_byte_mask	= ~(0xff >> (bits_per_row % 8));
+	png_info * info = png_create_info_struct(png);
+	if(!info) {
+		png_destroy_read_struct(&png, nullptr, nullptr);
+		throw std::runtime_error("Couldn't create a png info struct");
 	}
 
-	png_byte ** rows = png_get_rows(png, info);
+	png_set_read_fn(
+		png,
+		&buf,
+		[](png_struct * png, png_byte * data, size_t length) {
+			auto * in = (std::span<uint8_t const> *)png_get_io_ptr(png);
+			if(in->size() < length)
+				throw std::runtime_error("Unexpected end of file");
+			memcpy(data, in->data(), length);
+			*in = in->subspan(length);
+		}
+	);
 
 	std::vector<uint8_t> img;
-	for(uint32_t i = 0; i < height; i++) {
-		for(int j = 0; j < bytes_per_row - 1; j++) {
-			img.push_back(rows[i][j]);
-		}
-		img.push_back(rows[i][bytes_per_row - 1] & final_byte_mask);
+	try {
+		img = decode(png, info);
+	} catch(...) {
+		png_destroy_read_struct(&png, &info, nullptr);
+		throw;
 	}
-
 	png_destroy_read_struct(&png, &info, nullptr);
-	fclose(file);
 	return img;
 }
+
+// Encodes packed rows with libpng. Indexed images get a greyscale palette.
+std::vector<uint8_t> encode(
+	std::vector<uint8_t> const & img,
+	uint32_t width, uint32_t height,
+	int bit_depth, int colour_type,
+	int compression_level = 6,
+	bool interlace = false
+) {
+	png_struct * png = png_create_write_struct(
+		PNG_LIBPNG_VER_STRING,
+		nullptr,
+		nullptr,
+		nullptr
+	);
+	if(!png) throw std::runtime_error("Couldn't create a png struct");
+
+	png_info * info = png_create_info_struct(png);
+	if(!info) {
+		png_destroy_write_struct(&png, nullptr);
+		throw std::runtime_error("Couldn't create a png info struct");
+	}
+
+	std::vector<uint8_t> out;
+	png_set_write_fn(
+		png,
+		&out,
+		[](png_struct * png, png_byte * data, size_t length) {
+			auto * out = (std::vector<uint8_t> *)png_get_io_ptr(png);
+			out->insert(out->end(), data, data + length);
+		},
+		nullptr
+	);
+
+	png_set_IHDR(
+		png, info,
+		width, height,
+		bit_depth, colour_type,
+		interlace ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE,
+		PNG_COMPRESSION_TYPE_DEFAULT,
+		PNG_FILTER_TYPE_DEFAULT
+	);
+	png_set_compression_level(png, compression_level);
+
+	std::vector<png_color> palette;
+	if(colour_type == PNG_COLOR_TYPE_PALETTE) {
+		int entries = 1 << bit_depth;
+		for(int i = 0; i < entries; i++) {
+			png_byte v = i * 255 / (entries - 1);
+			palette.push_back({ v, v, v });
+		}
+		png_set_PLTE(png, info, palette.data(), entries);
+	}
+
+	png_write_info(png, info);
+
+	int channels = png_get_channels(png, info);
+	size_t bytes_per_row = ((size_t)width * channels * bit_depth + 7) / 8;
+	std::vector<png_byte *> rows(height);
+	for(uint32_t i = 0; i < height; i++) {
+		rows[i] = (png_byte *)img.data() + i * bytes_per_row;
+	}
+
+	png_write_image(png, rows.data());
+	png_write_end(png, nullptr);
+	png_destroy_write_struct(&png, &info);
+	return out;
+}
@@ -4,10 +4,11 @@
 #include <string>
 #include <stdexcept>
 #include <memory>
+#include <functional>
 #include <ios>
 #include <filesystem>
-#include <unordered_map>
 #include <vector>
+#include <optional>
 
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
@@ -15,56 +16,66 @@
 
 #include "net.h"
 #include "constants.h"
+#include "reader.h"
+#include "mmap.h"
 #include "chunk.h"
+#include "chunk_index.h"
+#include "checksum.h"
 #include "inflate.h"
+#include "layout.h"
 #include "reconstruct.h"
 #include "interlace.h"
+#include "convert.h"
+#include "scanline.h"
+#include "options.h"
+#include "memory.h"
+#include "pipeline.h"
+#include "segmented.h"
 #include "netpbm.h"
 #include "chunk/ihdr.h"
+#include "chunk/rpix.h"
 
 namespace rpng {
 
-void parse_png_header(std::ifstream & ifs) {
+void parse_png_header(reader_t & reader) {
 	uint64_t filetype = 0xdeadbeefdeadbeef;
-	ifs.read((char*)&filetype, 8);
-	if(ifs.gcount() != 8 || filetype != PNG_MAGIC)
+	if(reader.remaining() >= 8) filetype = reader.read<uint64_t>("header");
+	if(filetype != PNG_MAGIC)
 		throw std::runtime_error(
 			fmt::format("Unexpected PNG filetype: {:#x}", filetype)
 		);
 }
 
-chunk_t parse_chunk(std::ifstream & ifs) {
+// CRC-32 of a chunk's type and data
+uint32_t chunk_crc(uint32_t type, std::span<uint8_t const> data) {
+	uint32_t crc = update_crc32(0, (uint8_t const *)&type, 4);
+	return update_crc32(crc, data.data(), data.size());
+}
+
+void check_chunk_crc(chunk_t const & chunk) {
+	if(chunk_crc(chunk.type, chunk.data) != chunk.crc)
+		throw std::runtime_error(fmt::format("CRC mismatch in {}", chunk));
+}
+
+// Checks the chunk's CRC unless `verify_crc` is false, while its data is
+// still in cache from the read
+chunk_t parse_chunk(reader_t & reader, bool verify_crc = true) {
 	chunk_t chunk{};
-	uint32_t data;
-
-	ifs.read((char*)&data, 4);
-	chunk.length = ntohl(data);
-	if(ifs.gcount() != 4)
-		throw std::runtime_error("Unexpected end of file @ chunk length");
-
-	ifs.read((char*)&chunk.type, 4);
-	if(ifs.gcount() != 4)
-		throw std::runtime_error("Unexpected end of file @ chunk type");
-
-	if(chunk.length > 0) {
-		chunk.data.resize(chunk.length);
-		ifs.read((char*)chunk.data.data(), chunk.length);
-		if(ifs.gcount() != chunk.length)
-			throw std::runtime_error("Unexpected end of file @ chunk data");
-	}
 
-	ifs.read((char*)&data, 4);
-	chunk.crc = ntohl(data);
-	if(ifs.gcount() != 4)
-		throw std::runtime_error("Unexpected end of file @ chunk CRC");
+	chunk.length = ntohl(reader.read<uint32_t>("chunk length"));
+	chunk.type = reader.read<uint32_t>("chunk type");
+	chunk.offset = reader.pos;
+	chunk.data = reader.read(chunk.length, "chunk data");
+	chunk.crc = ntohl(reader.read<uint32_t>("chunk CRC"));
 
 	SPDLOG_DEBUG("parsed chunk: {}", chunk);
+	if(verify_crc) check_chunk_crc(chunk);
 	return chunk;
 }
 
 std::pair<chunk_ihdr_data_t, colour_properties_t>
-parse_ihdr(std::ifstream & ifs) {
-	chunk_t ihdr = parse_chunk(ifs);
+parse_ihdr(reader_t & reader, bool verify_crc = true) {
+	chunk_t ihdr = parse_chunk(reader, verify_crc);
 	if(ihdr.type != CHUNK_TYPE_IHDR) {
 		throw std::runtime_error(fmt::format(
 			"First chunk type is not IHDR: {}", ihdr
@@ -83,91 +94,476 @@ parse_ihdr(std::ifstream & ifs) {
 	ihdr_data.width = ntohl(ihdr_data.width);
 	ihdr_data.height = ntohl(ihdr_data.height);
 
-	if(ihdr_data.width == 0 || ihdr_data.height == 0)
-		throw std::runtime_error("Neither width nor height may be zero");
+	return { ihdr_data, check_ihdr(ihdr_data) };
+}
 
-	colour_properties_t colours = colour_properties[
-		std::min<uint8_t>(ihdr_data.colour_type, colour_properties.size() - 1)
-	];
+// What the decoder does with a chunk, going by its type
+enum chunk_action_t {
+	CHUNK_ACTION_IDAT,
+	CHUNK_ACTION_ANCILLARY,		// recognized, and of use to the decoder
+	CHUNK_ACTION_METADATA,		// of no use to the decoder, and left unread
+	CHUNK_ACTION_SKIP
+};
 
-	if(colours.colour_type == COLOUR_TYPE_INVALID) {
-		throw std::runtime_error(
-			fmt::format("Colour type {} is not valid", ihdr_data.colour_type)
-		);
-	} else if((ihdr_data.bit_depth & colours.valid_bit_depths) == 0) {
-		throw std::runtime_error(fmt::format(
-			"Colour type {} and bit depth {} combination is not valid",
-			ihdr_data.colour_type,
-			ihdr_data.bit_depth
-		));
+// Throws for an unrecognized critical chunk, and warns about an unrecognized
+// ancillary one
+chunk_action_t chunk_action(chunk_t const & chunk) {
+	switch(chunk.type) {
+	case CHUNK_TYPE_IDAT:
+		return CHUNK_ACTION_IDAT;
+	case CHUNK_TYPE_RPIX:
+		return CHUNK_ACTION_ANCILLARY;
+	case CHUNK_TYPE_IHDR:
+	case CHUNK_TYPE_PLTE:
+	case CHUNK_TYPE_TRNS:
+	case CHUNK_TYPE_IEND:
+		return CHUNK_ACTION_SKIP;
+	case CHUNK_TYPE_CHRM:
+	case CHUNK_TYPE_GAMA:
+	case CHUNK_TYPE_ICCP:
+	case CHUNK_TYPE_SBIT:
+	case CHUNK_TYPE_SRGB:
+	case CHUNK_TYPE_BKGD:
+	case CHUNK_TYPE_HIST:
+	case CHUNK_TYPE_PHYS:
+	case CHUNK_TYPE_SPLT:
+	case CHUNK_TYPE_TIME:
+	case CHUNK_TYPE_ITXT:
+	case CHUNK_TYPE_TEXT:
+	case CHUNK_TYPE_ZTXT:
+	case CHUNK_TYPE_ACTL:		// animation_decoder_t reads the frames
+	case CHUNK_TYPE_FCTL:
+	case CHUNK_TYPE_FDAT:
+		return CHUNK_ACTION_METADATA;
+	default:
+		if(chunk.type & (1 << 5))
+			SPDLOG_WARN(
+				"Ignoring unrecognized ancillary chunk: {}",
+				chunk
+			);
+		else
+			throw std::runtime_error(fmt::format(
+				"Encountered unrecognized critical chunk: {}", chunk
+			));
+		return CHUNK_ACTION_METADATA;
 	}
-	return { ihdr_data, colours };
 }
 
-std::vector<uint8_t> pack_idat_chunks(std::ifstream & ifs) {
-	std::unordered_map<uint32_t, std::vector<chunk_t>> chunks;
-	while(ifs && ifs.peek() != std::ifstream::traits_type::eof()) {
-		chunk_t & chunk = [&]() -> chunk_t & {
-			chunk_t tmp = parse_chunk(ifs);
-			return chunks[tmp.type].emplace_back(std::move(tmp));
-		}();
+// Walks the remaining chunks, validating their types. Each IDAT chunk is
+// handed to `on_idat` as soon as it has been parsed, and each recognized
+// ancillary chunk to `on_ancillary`. Every chunk is added to `index`, if
+// given. Metadata chunks are neither read nor checked against their CRC, so
+// a large one costs no more than its header; metadata_t checks it if it is
+// ever read.
+template <class IdatFn, class AncillaryFn>
+void parse_chunks(
+	reader_t & reader,
+	IdatFn && on_idat,
+	AncillaryFn && on_ancillary,
+	bool verify_crc = true,
+	chunk_index_t * index = nullptr
+) {
+	while(!reader.eof()) {
+		chunk_t chunk = parse_chunk(reader, false);
+		if(index) index->add(chunk);
+
+		chunk_action_t action = chunk_action(chunk);
+		if(verify_crc && action != CHUNK_ACTION_METADATA)
+			check_chunk_crc(chunk);
 
-		switch(chunk.type) {
-		case CHUNK_TYPE_IHDR:
-		case CHUNK_TYPE_PLTE:
-		case CHUNK_TYPE_IDAT:
-		case CHUNK_TYPE_IEND:
+		switch(action) {
+		case CHUNK_ACTION_IDAT:
+			on_idat(chunk);
+			break;
+		case CHUNK_ACTION_ANCILLARY:
+			on_ancillary(chunk);
+			break;
+		case CHUNK_ACTION_METADATA:
+		case CHUNK_ACTION_SKIP:
 			break;
-		default:
-			if(chunk.type & (1 << 5))
-				SPDLOG_WARN(
-					"Ignoring unrecognized ancillary chunk: {}",
-					chunk
-				);
-			else
-				throw std::runtime_error(fmt::format(
-					"Encountered unrecognized critical chunk: {}", chunk
-				));
 		}
 	}
+}
 
-	std::vector<uint8_t> packed;
-	for(auto const & chunk : chunks[CHUNK_TYPE_IDAT]) {
-		packed.insert(packed.end(), chunk.data.begin(), chunk.data.end());
+template <class IdatFn>
+void parse_chunks(
+	reader_t & reader,
+	IdatFn && on_idat,
+	bool verify_crc = true,
+	chunk_index_t * index = nullptr
+) {
+	parse_chunks(reader, on_idat, [](chunk_t const &) {}, verify_crc, index);
+}
+
+// Collects views of the IDAT payloads without copying them, along with the
+// rpIX segment index if there is one, into the containers' memory resources.
+// A malformed index is ignored.
+void collect_idat_chunks(
+	reader_t & reader,
+	idat_list_t & idats,
+	segment_index_t & segments,
+	bool verify_crc = true,
+	chunk_index_t * index = nullptr
+) {
+	parse_chunks(reader, [&](chunk_t const & chunk) {
+		idats.push_back(chunk.data);
+	}, [&](chunk_t const & chunk) {
+		try {
+			segments = parse_rpix(
+				chunk.data, segments.get_allocator().resource()
+			);
+		} catch(std::exception const & e) {
+			SPDLOG_WARN("Ignoring rpIX chunk: {}", e.what());
+			segments.clear();
+		}
+	}, verify_crc, index);
+}
+
+idat_list_t pack_idat_chunks(reader_t & reader, segment_index_t & segments) {
+	idat_list_t idats;
+	collect_idat_chunks(reader, idats, segments);
+	return idats;
+}
+
+idat_list_t pack_idat_chunks(reader_t & reader) {
+	segment_index_t segments;
+	return pack_idat_chunks(reader, segments);
+}
+
+// Indexes the chunks after IHDR from their headers, without reading their
+// data. Nothing is checked but the signature, IHDR, and that each chunk lies
+// within `buf`.
+chunk_index_t index_chunks(
+	std::span<uint8_t const> buf,
+	std::pmr::memory_resource * memory = std::pmr::get_default_resource()
+) {
+	reader_t reader{ buf };
+	parse_png_header(reader);
+	parse_ihdr(reader);
+
+	chunk_index_t index(memory);
+	while(!reader.eof()) index.add(parse_chunk(reader, false));
+	return index;
+}
+
+// PLTE and tRNS, which both come before the image data
+struct colour_chunks_t {
+	std::span<uint8_t const> palette;
+	std::span<uint8_t const> transparency;
+};
+
+// Looks ahead, up to the first IDAT chunk, without advancing `reader`. Only
+// PLTE and tRNS are checked against their CRC; other chunks are left to
+// parse_chunks().
+colour_chunks_t find_colour_chunks(reader_t reader, bool verify_crc = true) {
+	colour_chunks_t chunks;
+	while(!reader.eof()) {
+		chunk_t chunk = parse_chunk(reader, false);
+		if(chunk.type == CHUNK_TYPE_IDAT) break;
+
+		bool colour = chunk.type == CHUNK_TYPE_PLTE
+			|| chunk.type == CHUNK_TYPE_TRNS;
+		if(!colour) continue;
+		if(verify_crc) check_chunk_crc(chunk);
+		if(chunk.type == CHUNK_TYPE_PLTE) chunks.palette = chunk.data;
+		if(chunk.type == CHUNK_TYPE_TRNS) chunks.transparency = chunk.data;
 	}
-	return packed;
+	return chunks;
 }
 
-std::vector<uint8_t> load(std::string const & filepath) {
-	SPDLOG_DEBUG("{}", filepath);
-	std::ifstream ifs(filepath, std::ios::binary);
-	if(!ifs)
-		throw std::runtime_error(fmt::format("Cannot open file {}", filepath));
+using row_callback_t = std::function<
+	void(reduced_image_t const & image, int y, std::span<uint8_t const> row)
+>;
 
-	parse_png_header(ifs);
+// Decodes the image one scanline at a time, passing each reconstructed row of
+// each reduced image to `on_row` as soon as it is available
+std::pair<chunk_ihdr_data_t, colour_properties_t> load_rows(
+	std::span<uint8_t const> buf,
+	row_callback_t const & on_row,
+	decode_scratch_t & scratch
+) {
+	reader_t reader{ buf };
+	parse_png_header(reader);
 
-	auto [ihdr_data, colours] = parse_ihdr(ifs);
+	auto [ihdr_data, colours] = parse_ihdr(reader);
 	SPDLOG_DEBUG("\n{}\n", ihdr_data);
 
-	std::vector<uint8_t> packed = pack_idat_chunks(ifs); 
-	SPDLOG_DEBUG("packed idat size: {}", packed.size());
+	scanline_decoder_t decoder(image_layout(ihdr_data, colours), scratch);
+	parse_chunks(reader, [&](chunk_t const & chunk) {
+		decoder.feed(chunk.data, on_row);
+	});
+	decoder.finish();
+
+	return { ihdr_data, colours };
+}
 
-	std::vector<uint8_t> filtered = inflate(packed);
-	SPDLOG_DEBUG("inflated size: {}", filtered.size());
+std::pair<chunk_ihdr_data_t, colour_properties_t> load_rows(
+	std::span<uint8_t const> buf,
+	row_callback_t const & on_row
+) {
+	decode_scratch_t scratch;
+	return load_rows(buf, on_row, scratch);
+}
 
-	std::vector<uint8_t> reconstructed
-		= reconstruct(filtered, ihdr_data, colours);
-	SPDLOG_DEBUG("reconstructed size: {}", filtered.size());
+// Inflates the whole datastream into `out`, which it must fill exactly.
+// libdeflate and the built-in decoder take their input in one piece, so IDAT
+// chunks are joined first unless there is only one. The Adler-32 is checked
+// as set on scratch.inflater.
+void inflate_whole(
+	idat_list_t const & idats,
+	std::span<uint8_t> out,
+	inflate_backend_t backend,
+	decode_scratch_t & scratch,
+	std::pmr::memory_resource * memory
+) {
+	if(backend == INFLATE_BACKEND_ZLIB) {
+		scratch.inflater.reset();
+		for(std::span<uint8_t const> idat : idats) {
+			inflate_into(scratch.inflater, idat, out);
+		}
+		inflate_finish(scratch.inflater, out);
+		return;
+	}
 
-	std::vector<uint8_t> raw;
-	if(ihdr_data.interlace) {
-		raw = deinterlace(reconstructed, ihdr_data, colours);
+	std::pmr::vector<uint8_t> joined(memory);
+	std::span<uint8_t const> in;
+	if(idats.size() == 1) {
+		in = idats[0];
 	} else {
-		raw = reconstructed;
+		for(std::span<uint8_t const> idat : idats) {
+			joined.insert(joined.end(), idat.begin(), idat.end());
+		}
+		in = joined;
+	}
+	if(backend == INFLATE_BACKEND_BUILTIN)
+		scratch.inflater.builtin_decoder().inflate_whole(in, out);
+	else
+		scratch.libdeflate.inflate(in, out, scratch.inflater.verifies_checksum());
+}
+
+// Inflates the whole datastream, then reconstructs the reduced images, on the
+// pool if there is one, writing their rows into the final image. Taken by
+// large interlaced images, and by every image inflated with libdeflate.
+void load_whole(
+	idat_list_t const & idats,
+	chunk_ihdr_data_t const & ihdr_data,
+	image_layout_t const & layout,
+	row_writer_t const & writer,
+	decode_scratch_t & scratch,
+	thread_pool_t * pool,
+	std::pmr::memory_resource * memory,
+	inflate_backend_t backend
+) {
+	std::pmr::vector<uint8_t> filtered(layout.filtered_size, memory);
+	inflate_whole(idats, filtered, backend, scratch, memory);
+
+	if(!writer.concurrent()) {
+		reconstruct_deinterlace(
+			filtered, layout, ihdr_data.height,
+			writer.dst, writer.pitch, pool
+		);
+		return;
+	}
+
+	// a conversion buffer per pass
+	size_t buffer_size = writer.buffer_size();
+	std::pmr::vector<uint8_t> buffers(8 * buffer_size, memory);
+	reconstruct_in_place(filtered, layout, pool, [&](
+		reduced_image_t const & image, int y, uint8_t const * row
+	) {
+		writer.write(image, y, row, buffers.data() + image.pass * buffer_size);
+	});
+}
+
+// Bytes per row of the decoded image in the given pixel format
+size_t output_row_size(
+	chunk_ihdr_data_t const & ihdr,
+	colour_properties_t const & colours,
+	pixel_format_t format
+) {
+	if(format != PIXEL_FORMAT_RAW)
+		return (size_t)ihdr.width * pixel_size(format);
+	return ((size_t)ihdr.width * ihdr.bit_depth * colours.num_channels + 7) / 8;
+}
+
+// As load_into() below, once `reader` has read the signature and IHDR, so
+// that a caller sizing `dst` from the header need not parse it twice
+std::pair<chunk_ihdr_data_t, colour_properties_t> load_into(
+	reader_t reader,
+	chunk_ihdr_data_t const & ihdr_data,
+	colour_properties_t const & colours,
+	std::span<uint8_t> dst, size_t pitch,
+	decode_scratch_t & scratch,
+	decode_options_t const & options = {}
+) {
+	std::pmr::memory_resource * memory = resource_or_default(options.memory);
+	bool verify = options.verify_checksums;
+	if(options.chunks) options.chunks->clear();
+	SPDLOG_DEBUG("\n{}\n", ihdr_data);
+
+	size_t row_size = output_row_size(ihdr_data, colours, options.format);
+	size_t needed = (ihdr_data.height - 1) * pitch + row_size;
+	if(pitch < row_size || dst.size() < needed)
+		throw std::runtime_error(fmt::format(
+			"Output of {} bytes with a pitch of {} is too small for {} rows "
+			"of {} bytes",
+			dst.size(), pitch, (uint32_t)ihdr_data.height, row_size
+		));
+
+	image_layout_t layout = image_layout(ihdr_data, colours);
+
+	std::optional<pixel_converter_t> converter;
+	if(options.format != PIXEL_FORMAT_RAW) {
+		colour_chunks_t chunks = find_colour_chunks(reader, verify);
+		converter.emplace(
+			ihdr_data, colours, options.format,
+			chunks.palette, chunks.transparency
+		);
+	}
+	row_writer_t writer{
+		layout, dst.data(), pitch, converter ? &*converter : nullptr
+	};
+
+	inflate_backend_t backend = options.inflate;
+	if(!inflate_backend_available(backend)) {
+		SPDLOG_WARN(
+			"{} is not available, inflating with zlib",
+			inflate_backend_name(backend)
+		);
+		backend = INFLATE_BACKEND_ZLIB;
+	}
+	scratch.inflater.use_builtin(backend == INFLATE_BACKEND_BUILTIN);
+	scratch.inflater.verify_checksum(verify);
+
+	// Large non-interlaced images decode band by band when the encoder left a
+	// segment index. libdeflate and large interlaced images inflate the whole
+	// datastream at once, and anything else decodes serially from the
+	// collected IDAT chunks.
+	bool parallel = options.pool
+		&& layout.filtered_size >= options.parallel_threshold;
+	bool whole = backend == INFLATE_BACKEND_LIBDEFLATE
+		|| (parallel && ihdr_data.interlace);
+
+	idat_list_t idats(memory);
+	bool collected = parallel || whole;
+	if(collected) {
+		segment_index_t segments(memory);
+		collect_idat_chunks(
+			reader, idats, segments, verify, options.chunks
+		);
+		if(!whole && segments.size() > 1) {
+			try {
+				decode_segmented(
+					layout, idats, segments, *options.pool, memory, [&](
+						reduced_image_t const & image, int y,
+						uint8_t const * row
+					) {
+						writer.write(image, y, row, nullptr);
+					}, verify
+				);
+				return { ihdr_data, colours };
+			} catch(std::exception const & e) {
+				SPDLOG_WARN(
+					"Segmented decode failed, decoding serially: {}",
+					e.what()
+				);
+			}
+		}
 	}
+
+	if(whole) {
+		load_whole(
+			idats, ihdr_data, layout, writer, scratch,
+			parallel ? options.pool : nullptr, memory, backend
+		);
+		return { ihdr_data, colours };
+	}
+
+	auto for_each_idat = [&](auto && on_idat) {
+		if(collected) {
+			for(std::span<uint8_t const> idat : idats) on_idat(idat);
+		} else {
+			parse_chunks(reader, [&](chunk_t const & chunk) {
+				on_idat(chunk.data);
+			}, verify, options.chunks);
+		}
+	};
+
+	// unfilter each scanline straight into its final position
+	std::pmr::vector<uint8_t> buffer(writer.buffer_size(), memory);
+	auto write_row = [&](
+		reduced_image_t const & image, int y, std::span<uint8_t const> row
+	) {
+		writer.write(image, y, row.data(), buffer.data());
+	};
+
+	if(options.pipeline && layout.filtered_size >= options.parallel_threshold) {
+		decode_pipelined(layout, scratch, memory, for_each_idat, write_row);
+		return { ihdr_data, colours };
+	}
+
+	scanline_decoder_t decoder(layout, scratch);
+	for_each_idat([&](std::span<uint8_t const> idat) {
+		decoder.feed(idat, write_row);
+	});
+	decoder.finish();
+
+	return { ihdr_data, colours };
+}
+
+// Decodes into `dst`, whose rows are `pitch` bytes apart, e.g. caller-owned
+// staging memory with aligned rows. Only the output_row_size() bytes of each
+// row are written, and with raw sub-byte interlaced samples the padding bits
+// at the end of a row are left as they were. Temporaries come from
+// options.memory, so with a reused `scratch` and an arena released between
+// images, a decode on the calling thread allocates nothing else.
+std::pair<chunk_ihdr_data_t, colour_properties_t> load_into(
+	std::span<uint8_t const> buf,
+	std::span<uint8_t> dst, size_t pitch,
+	decode_scratch_t & scratch,
+	decode_options_t const & options = {}
+) {
+	reader_t reader{ buf };
+	parse_png_header(reader);
+	auto [ihdr_data, colours] = parse_ihdr(reader, options.verify_checksums);
+	return load_into(
+		reader, ihdr_data, colours, dst, pitch, scratch, options
+	);
+}
+
+// Decodes an image, reusing the zlib stream and row buffers in `scratch`
+std::vector<uint8_t> load(
+	std::span<uint8_t const> buf,
+	decode_scratch_t & scratch,
+	decode_options_t const & options = {}
+) {
+	reader_t reader{ buf };
+	parse_png_header(reader);
+	auto [ihdr_data, colours] = parse_ihdr(reader, options.verify_checksums);
+
+	size_t pitch = output_row_size(ihdr_data, colours, options.format);
+	std::vector<uint8_t> raw(ihdr_data.height * pitch);
+	load_into(reader, ihdr_data, colours, raw, pitch, scratch, options);
 	SPDLOG_DEBUG("raw size: {}", raw.size());
 
 	return raw;
+}
+
+std::vector<uint8_t> load(
+	std::span<uint8_t const> buf,
+	decode_options_t const & options = {}
+) {
+	decode_scratch_t scratch;
+	return load(buf, scratch, options);
+}
+
+std::vector<uint8_t> load(
+	std::string const & filepath,
+	decode_options_t const & options = {}
+) {
+	SPDLOG_DEBUG("{}", filepath);
+	mapped_file_t file(filepath);
+	return load(file.span(), options);
 
 	/*
 	std::filesystem::create_directory(
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <memory_resource>
+
+namespace rpng {
+
+std::pmr::memory_resource * resource_or_default(
+	std::pmr::memory_resource * memory
+) {
+	return memory ? memory : std::pmr::get_default_resource();
+}
+
+// Serializes a memory resource that is not thread-safe, e.g. an arena, for
+// allocations made from pool tasks
+class locked_resource_t : public std::pmr::memory_resource {
+private:
+	std::mutex mutex;
+	std::pmr::memory_resource * upstream;
+
+public:
+	explicit locked_resource_t(std::pmr::memory_resource * upstream)
+		: upstream(upstream) {}
+
+protected:
+	void * do_allocate(size_t bytes, size_t alignment) override {
+		std::lock_guard lock(mutex);
+		return upstream->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void * p, size_t bytes, size_t alignment) override {
+		std::lock_guard lock(mutex);
+		upstream->deallocate(p, bytes, alignment);
+	}
+
+	bool do_is_equal(
+		std::pmr::memory_resource const & other
+	) const noexcept override {
+		return this == &other;
+	}
+};
+
+// Bump allocator over a block that is kept from one decode to the next.
+// Deallocation is a no-op and reset() frees everything at once. Whatever does
+// not fit comes from `upstream`, and the next reset() grows the block by that
+// much, so a run of similar images settles into no allocations at all.
+class arena_t : public std::pmr::memory_resource {
+private:
+	static constexpr size_t block_alignment = 64;
+
+	std::pmr::memory_resource * upstream;
+	std::pmr::monotonic_buffer_resource overflow;
+	std::byte * block = nullptr;
+	size_t block_size = 0;
+	size_t used = 0;
+	size_t spilled = 0;		// bytes that went to `overflow` instead
+
+public:
+	explicit arena_t(
+		std::pmr::memory_resource * upstream = std::pmr::get_default_resource()
+	) : upstream(upstream), overflow(upstream) {}
+
+	arena_t(arena_t const &) = delete;
+	arena_t & operator=(arena_t const &) = delete;
+
+	~arena_t() {
+		if(block) upstream->deallocate(block, block_size, block_alignment);
+	}
+
+	// Frees every allocation, none of which may still be in use
+	void reset() {
+		overflow.release();
+		if(spilled) {
+			size_t grown = block_size + spilled;
+			if(block) upstream->deallocate(block, block_size, block_alignment);
+			block = nullptr;
+			block_size = 0;
+			block = (std::byte *)upstream->allocate(grown, block_alignment);
+			block_size = grown;
+		}
+		used = 0;
+		spilled = 0;
+	}
+
+	size_t capacity() const {
+		return block_size;
+	}
+
+protected:
+	void * do_allocate(size_t bytes, size_t alignment) override {
+		uintptr_t base = (uintptr_t)block;
+		size_t offset = ((base + used + alignment - 1) & ~(alignment - 1)) - base;
+		if(block && offset + bytes <= block_size) {
+			used = offset + bytes;
+			return block + offset;
+		}
+		spilled += bytes + alignment;
+		return overflow.allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void *, size_t, size_t) override {}
+
+	bool do_is_equal(
+		std::pmr::memory_resource const & other
+	) const noexcept override {
+		return this == &other;
+	}
+};
+
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <string_view>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "load.h"
+#include "chunk_index.h"
+#include "chunk/gama.h"
+#include "chunk/phys.h"
+#include "chunk/text.h"
+#include "chunk/iccp.h"
+
+namespace rpng {
+
+// Ancillary chunks of a datastream, read through its chunk_index_t. A chunk is
+// only read, CRC-checked and parsed when asked for, so a decode whose metadata
+// goes unused pays for no more than the chunk headers. Compressed text and ICC
+// profiles that inflate to more than `max_inflated` bytes throw. `buf` and
+// `index` must outlive this.
+class metadata_t {
+private:
+	std::span<uint8_t const> buf;
+	chunk_index_t const & index;
+	bool verify_crc;
+	size_t max_inflated;
+
+public:
+	metadata_t(
+		std::span<uint8_t const> buf,
+		chunk_index_t const & index,
+		bool verify_crc = true,
+		size_t max_inflated = MAX_INFLATED_METADATA
+	) : buf(buf), index(index), verify_crc(verify_crc),
+		max_inflated(max_inflated) {}
+
+	// The data of an indexed chunk, after checking its CRC
+	std::span<uint8_t const> data(chunk_entry_t const & entry) const {
+		chunk_t chunk{
+			entry.offset, entry.length, entry.type, bytes(entry), entry.crc
+		};
+		if(verify_crc) check_chunk_crc(chunk);
+		return chunk.data;
+	}
+
+	// From gAMA, e.g. 0.45455
+	std::optional<double> gamma() const {
+		chunk_entry_t const * entry = index.find(CHUNK_TYPE_GAMA);
+		if(!entry) return std::nullopt;
+		return parse_gama(data(*entry)) / 100000.0;
+	}
+
+	std::optional<physical_dimensions_t> physical_dimensions() const {
+		chunk_entry_t const * entry = index.find(CHUNK_TYPE_PHYS);
+		if(!entry) return std::nullopt;
+		return parse_phys(data(*entry));
+	}
+
+	std::optional<icc_profile_t> icc_profile() const {
+		chunk_entry_t const * entry = index.find(CHUNK_TYPE_ICCP);
+		if(!entry) return std::nullopt;
+		return parse_iccp(data(*entry), max_inflated);
+	}
+
+	// Every tEXt, zTXt and iTXt chunk, in file order
+	std::vector<text_t> text() const {
+		std::vector<text_t> texts;
+		for(chunk_entry_t const & entry : index.chunks()) {
+			if(is_text(entry.type))
+				texts.push_back(parse_text(entry.type, data(entry)));
+		}
+		return texts;
+	}
+
+	// The first text chunk with the given keyword. Only the one found is
+	// CRC-checked and parsed; of the others, no more than the keyword and its
+	// separator are read.
+	std::optional<text_t> text(std::string_view keyword) const {
+		for(chunk_entry_t const & entry : index.chunks()) {
+			if(!is_text(entry.type)) continue;
+			std::span<uint8_t const> head = bytes(entry);
+			head = head.first(std::min(head.size(), keyword.size() + 1));
+			bool match = head.size() == keyword.size() + 1
+				&& head.back() == 0
+				&& std::equal(keyword.begin(), keyword.end(), head.begin());
+			if(match) return parse_text(entry.type, data(entry));
+		}
+		return std::nullopt;
+	}
+
+private:
+	// The data of an indexed chunk, unchecked
+	std::span<uint8_t const> bytes(chunk_entry_t const & entry) const {
+		if(entry.offset > buf.size() || buf.size() - entry.offset < entry.length)
+			throw std::runtime_error(fmt::format(
+				"Chunk at {} lies outside the datastream", entry.offset
+			));
+		return buf.subspan(entry.offset, entry.length);
+	}
+
+	static bool is_text(uint32_t type) {
+		return type == CHUNK_TYPE_TEXT
+			|| type == CHUNK_TYPE_ZTXT
+			|| type == CHUNK_TYPE_ITXT;
+	}
+
+	text_t parse_text(uint32_t type, std::span<uint8_t const> bytes) const {
+		switch(type) {
+		case CHUNK_TYPE_TEXT:
+			return rpng::parse_text(bytes);
+		case CHUNK_TYPE_ZTXT:
+			return parse_ztxt(bytes, max_inflated);
+		default:
+			return parse_itxt(bytes, max_inflated);
+		}
+	}
+};
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <utility>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fmt/format.h>
+
+namespace rpng {
+
+// Read-only memory mapping of a whole file
+class mapped_file_t {
+private:
+	void * addr = nullptr;
+	size_t size = 0;
+
+public:
+	explicit mapped_file_t(std::string const & filepath) {
+		int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fd < 0)
+			throw std::runtime_error(
+				fmt::format("Cannot open file {}", filepath)
+			);
+
+		struct stat st;
+		if(fstat(fd, &st) != 0) {
+			close(fd);
+			throw std::runtime_error(
+				fmt::format("Cannot stat file {}", filepath)
+			);
+		}
+
+		size = st.st_size;
+		if(size > 0) {
+			addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(addr == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error(
+					fmt::format("Cannot map file {}", filepath)
+				);
+			}
+			madvise(addr, size, MADV_SEQUENTIAL);
+		}
+		close(fd);
+	}
+
+	mapped_file_t(mapped_file_t const &) = delete;
+	mapped_file_t & operator=(mapped_file_t const &) = delete;
+
+	mapped_file_t(mapped_file_t && other) noexcept
+		: addr(std::exchange(other.addr, nullptr)),
+		  size(std::exchange(other.size, 0)) {}
+
+	mapped_file_t & operator=(mapped_file_t && other) noexcept {
+		std::swap(addr, other.addr);
+		std::swap(size, other.size);
+		return *this;
+	}
+
+	~mapped_file_t() {
+		if(addr) munmap(addr, size);
+	}
+
+	std::span<uint8_t const> span() const {
+		return { (uint8_t const *)addr, size };
+	}
+};
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+#include "format.h"
+#include "chunk_index.h"
+#include "inflate_backend.h"
+#include "thread_pool.h"
+
+namespace rpng {
+
+struct decode_options_t {
+	// Layout of the returned pixels, converted row by row as they decode
+	pixel_format_t format = PIXEL_FORMAT_RAW;
+
+	// Pool for the independent stages of large images, e.g. the seven Adam7
+	// reduced images. Null decodes entirely on the calling thread.
+	thread_pool_t * pool = nullptr;
+
+	// Inflate on a second thread while the calling thread unfilters
+	bool pipeline = false;
+
+	// Images with less inflated data than this stay on the calling thread,
+	// where they finish sooner than the pool could be woken
+	size_t parallel_threshold = 256 << 10;
+
+	// Where the decode's temporaries are allocated, including the zlib streams
+	// of a segmented decode. Null uses the default resource.
+	std::pmr::memory_resource * memory = nullptr;
+
+	// libdeflate inflates the whole datastream at once, so it replaces the
+	// streaming, pipelined and segmented routes. If it cannot be loaded, zlib
+	// is used instead. The built-in decoder takes zlib's place on every route
+	// but the segmented one, whose raw deflate segments stay with zlib.
+	inflate_backend_t inflate = RPNG_DEFAULT_INFLATE_BACKEND;
+
+	// Check each chunk's CRC-32 and the datastream's Adler-32. Trusted data,
+	// e.g. assets shipped with the program, decodes faster without.
+	bool verify_checksums = true;
+
+	// Filled with the position of every chunk after IHDR, found in the same
+	// pass that finds the image data, for reading metadata afterwards with
+	// metadata_t. Null keeps no index.
+	chunk_index_t * chunks = nullptr;
+};
+
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <span>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory_resource>
+#include <exception>
+#include <stdexcept>
+
+#include "reader.h"
+#include "layout.h"
+#include "scanline.h"
+#include "reconstruct.h"
+
+namespace rpng {
+
+// Lock-free single-producer single-consumer ring of fixed-size slots
+class spsc_ring_t {
+private:
+	std::pmr::vector<uint8_t> storage;
+	size_t slot_size;
+	size_t num_slots;
+
+	alignas(64) std::atomic<size_t> head = 0;	// slots published
+	alignas(64) std::atomic<size_t> tail = 0;	// slots released
+	alignas(64) std::atomic<bool> closed = false;
+
+	uint8_t * slot(size_t i) {
+		return storage.data() + (i % num_slots) * slot_size;
+	}
+
+public:
+	spsc_ring_t(
+		size_t slot_size, size_t num_slots,
+		std::pmr::memory_resource * memory = std::pmr::get_default_resource()
+	) : storage(slot_size * num_slots, memory),
+		  slot_size(slot_size),
+		  num_slots(num_slots) {}
+
+	// Either side may close the ring to stop the other one
+	void close() {
+		closed.store(true, std::memory_order_release);
+	}
+
+	// Producer: waits for a free slot, or returns null once closed
+	uint8_t * acquire() {
+		size_t h = head.load(std::memory_order_relaxed);
+		while(h - tail.load(std::memory_order_acquire) == num_slots) {
+			if(closed.load(std::memory_order_acquire)) return nullptr;
+			std::this_thread::yield();
+		}
+		return slot(h);
+	}
+
+	void publish() {
+		head.store(
+			head.load(std::memory_order_relaxed) + 1,
+			std::memory_order_release
+		);
+	}
+
+	// Consumer: waits for a published slot, or returns null once the ring is
+	// closed and drained
+	uint8_t const * front() {
+		size_t t = tail.load(std::memory_order_relaxed);
+		while(head.load(std::memory_order_acquire) == t) {
+			if(closed.load(std::memory_order_acquire)) {
+				if(head.load(std::memory_order_acquire) != t) break;
+				return nullptr;
+			}
+			std::this_thread::yield();
+		}
+		return slot(t);
+	}
+
+	void pop() {
+		tail.store(
+			tail.load(std::memory_order_relaxed) + 1,
+			std::memory_order_release
+		);
+	}
+};
+
+// Two-stage decode: a second thread parses chunks and inflates filtered
+// scanlines into a ring, while the calling thread unfilters each one as it
+// arrives and hands it to the sink. Wall-clock time approaches the larger of
+// the inflate and reconstruct times rather than their sum. The ring comes
+// from `memory`.
+template <class IdatParser, class Sink>
+void decode_pipelined(
+	image_layout_t const & layout,
+	decode_scratch_t & scratch,
+	std::pmr::memory_resource * memory,
+	IdatParser && parse_idat,
+	Sink && sink
+) {
+	constexpr size_t RING_SLOTS = 64;
+	spsc_ring_t ring(1 + layout.max_bytes_per_row, RING_SLOTS, memory);
+
+	std::exception_ptr error;
+	std::thread producer([&] {
+		try {
+			row_inflater_t rows(layout, scratch.inflater, ring.acquire());
+			parse_idat([&](std::span<uint8_t const> idat) {
+				rows.feed(idat, [&](
+					reduced_image_t const & image, int y, uint8_t * row
+				) {
+					ring.publish();
+					uint8_t * next = ring.acquire();
+					if(!next) throw std::runtime_error("Pipeline cancelled");
+					return next;
+				});
+			});
+			rows.finish();
+		} catch(...) {
+			error = std::current_exception();
+		}
+		ring.close();
+	});
+
+	try {
+		unfilter_set_t const & kernels = unfilter_kernels(layout.stride);
+		uint8_t * prev = reserve_rows(scratch.rows, 2 * layout.max_bytes_per_row);
+		uint8_t * cur = prev + layout.max_bytes_per_row;
+
+		for(int p = 0; p < layout.num_passes; p++) {
+			reduced_image_t const & image = layout.passes[p];
+			for(int y = 0; y < image.height; y++) {
+				uint8_t const * row = ring.front();
+				if(!row) break;
+
+				reconstruct_row(
+					cur, row + 1, y ? prev : nullptr,
+					row[0], kernels, image.bytes_per_row
+				);
+				ring.pop();
+
+				sink(image, y, std::span<uint8_t const>(cur, image.bytes_per_row));
+				std::swap(prev, cur);
+			}
+		}
+	} catch(...) {
+		ring.close();
+		producer.join();
+		throw;
+	}
+
+	producer.join();
+	if(error) std::rethrow_exception(error);
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "load.h"
+#include "thread_pool.h"
+#include "chunk/ihdr.h"
+
+namespace rpng {
+
+// Bytes from the start of a PNG to the end of IHDR: the signature, then the
+// chunk's length, type, data and CRC
+constexpr size_t PNG_HEADER_SIZE = 8 + 4 + 4 + sizeof(chunk_ihdr_data_t) + 4;
+
+// Reads the signature and IHDR, and nothing past them
+std::pair<chunk_ihdr_data_t, colour_properties_t> probe(
+	std::span<uint8_t const> buf
+) {
+	reader_t reader{ buf.first(std::min(buf.size(), PNG_HEADER_SIZE)) };
+	parse_png_header(reader);
+	return parse_ihdr(reader);
+}
+
+// Reads the header of a file with a single pread(), rather than mapping it
+std::pair<chunk_ihdr_data_t, colour_properties_t> probe(
+	std::string const & filepath
+) {
+	int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		throw std::runtime_error(
+			fmt::format("Cannot open file {}", filepath)
+		);
+
+	std::array<uint8_t, PNG_HEADER_SIZE> header;
+	ssize_t n = pread(fd, header.data(), header.size(), 0);
+	close(fd);
+	if(n < 0)
+		throw std::runtime_error(
+			fmt::format("Cannot read file {}", filepath)
+		);
+
+	return probe(std::span<uint8_t const>(header.data(), n));
+}
+
+struct probe_result_t {
+	chunk_ihdr_data_t ihdr;
+	colour_properties_t colours;
+	std::exception_ptr error;		// set if the file could not be probed
+};
+
+// Probes many files at once, each worker of `pool` taking a run of them, so
+// that their reads overlap. A file that fails does not stop the others.
+std::vector<probe_result_t> probe_all(
+	std::vector<std::string> const & filepaths,
+	thread_pool_t & pool
+) {
+	std::vector<probe_result_t> results(filepaths.size());
+
+	// runs of files, a few per worker for balance
+	int num_runs = std::min<size_t>(filepaths.size(), pool.size() * 4);
+	pool.parallel_for(num_runs, [&](int run) {
+		size_t begin = filepaths.size() * run / num_runs;
+		size_t end = filepaths.size() * (run + 1) / num_runs;
+		for(size_t i = begin; i < end; i++) {
+			try {
+				std::tie(results[i].ihdr, results[i].colours) =
+					probe(filepaths[i]);
+			} catch(...) {
+				results[i].error = std::current_exception();
+			}
+		}
+	});
+	return results;
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <span>
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+namespace rpng {
+
+// Bounds-checked cursor over an in-memory PNG datastream. Reads hand out views
+// into the underlying buffer; nothing is copied.
+struct reader_t {
+	std::span<uint8_t const> buf;
+	size_t pos = 0;
+
+	bool eof() const {
+		return pos >= buf.size();
+	}
+
+	size_t remaining() const {
+		return buf.size() - pos;
+	}
+
+	std::span<uint8_t const> read(size_t n, char const * what) {
+		if(remaining() < n)
+			throw std::runtime_error(
+				fmt::format("Unexpected end of file @ {}", what)
+			);
+
+		std::span<uint8_t const> out = buf.subspan(pos, n);
+		pos += n;
+		return out;
+	}
+
+	template <class T>
+	T read(char const * what) {
+		T value;
+		memcpy(&value, read(sizeof(T), what).data(), sizeof(T));
+		return value;
+	}
+};
+
+}
@@ -1,84 +1,146 @@
 #pragma once
 
+#include <span>
 #include <vector>
 #include <cmath>
+#include <stdexcept>
+
+#include <fmt/format.h>
 
 #include "filters.h"
+#include "unfilter.h"
 #include "chunk/ihdr.h"
 #include "pass.h"
+#include "layout.h"
+#include "thread_pool.h"
 
 namespace rpng {
 
+// Portable reconstruction loop, applying the filter byte by byte
+void reconstruct_row_scalar(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev,
+	uint8_t filter, int stride, int bytes_per_row
+) {
+	filter_fn_t R = recon_fn[filter];
+	if(!prev) {
+		// first pixel
+		for(int i = 0; i < stride; i++)
+			dst[i] = R(src[i], 0, 0, 0);
+
+		// first scanline
+		for(int i = stride; i < bytes_per_row; i++)
+			dst[i] = R(src[i], dst[i - stride], 0, 0);
+		return;
+	}
+
+	// first stride bytes
+	for(int i = 0; i < stride; i++)
+		dst[i] = R(src[i], 0, prev[i], 0);
+
+	// remaining bytes
+	for(int i = stride; i < bytes_per_row; i++)
+		dst[i] = R(src[i], dst[i - stride], prev[i], prev[i - stride]);
+}
+
+// Reconstructs a single scanline. `prev` is the previous reconstructed row of
+// the same reduced image, or null for its first row. `dst` may alias `src`.
+void reconstruct_row(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev,
+	uint8_t filter, unfilter_set_t const & kernels, int bytes_per_row
+) {
+	if(filter >= recon_fn.size())
+		throw std::runtime_error(
+			fmt::format("Invalid filter type: {}", filter)
+		);
+
+	unfilter_fn_t fn = prev ? kernels.rows[filter] : kernels.first_rows[filter];
+	fn(dst, src, prev, bytes_per_row);
+}
+
+void reconstruct_row(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev,
+	uint8_t filter, int stride, int bytes_per_row
+) {
+	reconstruct_row(
+		dst, src, prev, filter, unfilter_kernels(stride), bytes_per_row
+	);
+}
+
 void reconstruct_slice(
 	uint8_t * dst, uint8_t const * src,
 	int stride, int bytes_per_row, int height
 ) {
-	// first pixel
-	filter_fn_t R = recon_fn[*(src++)];
-	for(int i = 0; i < stride; i++)
-		*(dst++) = R(*(src++), 0, 0, 0);
-
-	// first scanline
-	for(int i = stride; i < bytes_per_row; i++, src++, dst++) {
-		*dst = R(*src, *(dst - stride), 0, 0);
+	unfilter_set_t const & kernels = unfilter_kernels(stride);
+	uint8_t const * prev = nullptr;
+	for(int i = 0; i < height; i++) {
+		reconstruct_row(dst, src + 1, prev, *src, kernels, bytes_per_row);
+		prev = dst;
+		dst += bytes_per_row;
+		src += 1 + bytes_per_row;
 	}
+}
 
-	// remaining scanlines
-	for(int i = 1; i < height; i++) {
-		R = recon_fn[*(src++)];
-
-		// first stride bytes
-		for(int j = 0; j < stride; j++, src++, dst++)
-			*dst = R(*src, 0, *(dst - bytes_per_row), 0);
-
-		// remaining bytes
-		for(int j = stride; j < bytes_per_row; j++, src++, dst++) {
-			*dst = R(
-				*src,
-				*(dst - stride),
-				*(dst - bytes_per_row),
-				*(dst - stride - bytes_per_row)
+// Reconstructs the reduced images of the inflated datastream in place, passing
+// each row to on_row(reduced_image_t const &, int y, uint8_t const * row) in
+// order within its reduced image. Given a pool, the reduced images are
+// reconstructed in parallel.
+template <class OnRow>
+void reconstruct_in_place(
+	std::span<uint8_t> filtered,
+	image_layout_t const & layout,
+	thread_pool_t * pool,
+	OnRow && on_row
+) {
+	unfilter_set_t const & kernels = unfilter_kernels(layout.stride);
+	auto reconstruct_pass = [&](int p) {
+		reduced_image_t const & image = layout.passes[p];
+		uint8_t * row = filtered.data() + image.filtered_offset + 1;
+		uint8_t const * prev = nullptr;
+		for(int y = 0; y < image.height; y++) {
+			reconstruct_row(
+				row, row, prev, row[-1], kernels, image.bytes_per_row
 			);
+			on_row(image, y, row);
+			prev = row;
+			row += 1 + image.bytes_per_row;
 		}
+	};
+
+	if(pool && layout.num_passes > 1) {
+		pool->parallel_for(layout.num_passes, reconstruct_pass);
+	} else {
+		for(int p = 0; p < layout.num_passes; p++) reconstruct_pass(p);
 	}
 }
 
+// Reconstructs every reduced image of the inflated datastream. Given a pool,
+// the Adam7 reduced images, which filter independently, are reconstructed
+// in parallel.
 std::vector<uint8_t> reconstruct(
 	std::vector<uint8_t> const & in,
 	chunk_ihdr_data_t const & ihdr,
-	colour_properties_t const & colours
+	colour_properties_t const & colours,
+	thread_pool_t * pool = nullptr
 ) {
-	int stride_bits	= ihdr.bit_depth * colours.num_channels;
-	int stride = (stride_bits + 7) / 8;
-
-	// compute reconstructed image size and reduced image dimensions
-	int first_pass = ihdr.interlace ? 1 : 0;
-	int last_pass = ihdr.interlace ? 7 : 0;
-
-	int reconstructed_size = 0;
-	std::vector<std::pair<int, int>> reduced_image_dims;
-	for(int p = first_pass; p <= last_pass; p++) {
-		interlace_pass_t const & pass = interlace_passes[p];
-
-		int pass_width = count(ihdr.width, pass.offset_x, pass.period_x);
-		int pass_height = count(ihdr.height, pass.offset_y, pass.period_y);
-		int bytes_per_pass_row = (pass_width * stride_bits + 7) / 8;
-
-		if(!pass_width || !pass_height) continue;
-
-		reduced_image_dims.emplace_back(bytes_per_pass_row, pass_height);
-		reconstructed_size += pass_height * bytes_per_pass_row;
-	}
+	image_layout_t layout = image_layout(ihdr, colours);
 
 	// reconstruct reduced images
-	std::vector<uint8_t> reconstructed_image(reconstructed_size);
-	uint8_t * dst = reconstructed_image.data();
-	uint8_t const * src = in.data();
-
-	for(auto [bytes_per_row, height] : reduced_image_dims) {
-		reconstruct_slice(dst, src, stride, bytes_per_row, height);
-		dst += height * bytes_per_row;
-		src += height * (1 + bytes_per_row);
+	std::vector<uint8_t> reconstructed_image(layout.reconstructed_size);
+	auto reconstruct_pass = [&](int i) {
+		reduced_image_t const & image = layout.passes[i];
+		reconstruct_slice(
+			reconstructed_image.data() + image.offset,
+			in.data() + image.filtered_offset,
+			layout.stride,
+			image.bytes_per_row,
+			image.height
+		);
+	};
+
+	if(pool && layout.num_passes > 1) {
+		pool->parallel_for(layout.num_passes, reconstruct_pass);
+	} else {
+		for(int i = 0; i < layout.num_passes; i++) reconstruct_pass(i);
 	}
 	return reconstructed_image;
 }
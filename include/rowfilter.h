@@ -0,0 +1,354 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
+#include "filters.h"
+#include "unfilter.h"
+#include "chunk/ihdr.h"
+
+namespace rpng {
+
+// Filters `n` bytes of the row `src` into `dst` against the previous row
+// `prev`, all zeros for the first row. Returns the sum of the magnitudes of
+// the filtered bytes taken as signed, the usual estimate of how well a row
+// will compress.
+using filter_row_fn_t = uint64_t(*)(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+);
+
+// Kernels indexed by [filter type][bytes per pixel]
+using filter_table_t = std::array<std::array<filter_row_fn_t, 9>, 5>;
+
+uint8_t signed_magnitude(uint8_t x) {
+	return x < 128 ? x : 256 - x;
+}
+
+// Filters bytes [begin, end) of a row, treating bytes left of the row as zero
+template <uint8_t FILTER, int STRIDE>
+uint64_t filter_range(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev,
+	int begin, int end
+) {
+	uint64_t cost = 0;
+	for(int i = begin; i < end; i++) {
+		int a = i >= STRIDE ? src[i - STRIDE] : 0;
+		int b = prev[i];
+		int c = i >= STRIDE ? prev[i - STRIDE] : 0;
+
+		uint8_t x = src[i];
+		if constexpr(FILTER == FILTER_TYPE_SUB) x -= a;
+		if constexpr(FILTER == FILTER_TYPE_UP) x -= b;
+		if constexpr(FILTER == FILTER_TYPE_AVG) x -= (a + b) >> 1;
+		if constexpr(FILTER == FILTER_TYPE_PAETH) x -= paeth_predict(a, b, c);
+
+		dst[i] = x;
+		cost += signed_magnitude(x);
+	}
+	return cost;
+}
+
+template <uint8_t FILTER, int STRIDE>
+uint64_t filter_scalar(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	int head = std::min(n, STRIDE);
+	return filter_range<FILTER, STRIDE>(dst, src, prev, 0, head)
+		+ filter_range<FILTER, STRIDE>(dst, src, prev, head, n);
+}
+
+template <int STRIDE>
+void fill_scalar(filter_table_t & table) {
+	table[FILTER_TYPE_NONE][STRIDE] = filter_scalar<FILTER_TYPE_NONE, STRIDE>;
+	table[FILTER_TYPE_SUB][STRIDE] = filter_scalar<FILTER_TYPE_SUB, STRIDE>;
+	table[FILTER_TYPE_UP][STRIDE] = filter_scalar<FILTER_TYPE_UP, STRIDE>;
+	table[FILTER_TYPE_AVG][STRIDE] = filter_scalar<FILTER_TYPE_AVG, STRIDE>;
+	table[FILTER_TYPE_PAETH][STRIDE]
+		= filter_scalar<FILTER_TYPE_PAETH, STRIDE>;
+}
+
+#if defined(__x86_64__)
+
+namespace simd {
+
+// Unlike reconstruction, filtering only reads the unfiltered rows, so every
+// filter runs a full register at a time. The first pixel, which has no left
+// neighbour, and the tail are left to the scalar loop.
+
+// Paeth predictor of 8 pixels' bytes widened to 16-bit lanes
+[[gnu::target("sse2")]]
+__m128i paeth_lanes_sse2(__m128i a, __m128i b, __m128i c) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i pa = _mm_sub_epi16(b, c);
+	__m128i pb = _mm_sub_epi16(a, c);
+	__m128i pc = _mm_add_epi16(pa, pb);
+	pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+	pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+	pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+	return paeth_select(a, b, c, pa, pb, pc);
+}
+
+[[gnu::target("sse2")]]
+__m128i predict_paeth_sse2(__m128i a, __m128i b, __m128i c) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = paeth_lanes_sse2(
+		_mm_unpacklo_epi8(a, zero),
+		_mm_unpacklo_epi8(b, zero),
+		_mm_unpacklo_epi8(c, zero)
+	);
+	__m128i hi = paeth_lanes_sse2(
+		_mm_unpackhi_epi8(a, zero),
+		_mm_unpackhi_epi8(b, zero),
+		_mm_unpackhi_epi8(c, zero)
+	);
+	return _mm_packus_epi16(lo, hi);
+}
+
+template <uint8_t FILTER, int BPP>
+[[gnu::target("sse2")]]
+uint64_t filter_sse2(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	uint64_t cost = filter_range<FILTER, BPP>(
+		dst, src, prev, 0, std::min(n, BPP)
+	);
+
+	__m128i zero = _mm_setzero_si128(), sum = zero;
+	int i = BPP;
+	for(; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((__m128i const *)(src + i));
+		__m128i a = _mm_loadu_si128((__m128i const *)(src + i - BPP));
+		__m128i b = _mm_loadu_si128((__m128i const *)(prev + i));
+		__m128i c = _mm_loadu_si128((__m128i const *)(prev + i - BPP));
+
+		if constexpr(FILTER == FILTER_TYPE_SUB) x = _mm_sub_epi8(x, a);
+		if constexpr(FILTER == FILTER_TYPE_UP) x = _mm_sub_epi8(x, b);
+		if constexpr(FILTER == FILTER_TYPE_AVG)
+			x = _mm_sub_epi8(x, avg_floor(a, b));
+		if constexpr(FILTER == FILTER_TYPE_PAETH)
+			x = _mm_sub_epi8(x, predict_paeth_sse2(a, b, c));
+		_mm_storeu_si128((__m128i *)(dst + i), x);
+
+		__m128i magnitude = _mm_min_epu8(x, _mm_sub_epi8(zero, x));
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(magnitude, zero));
+	}
+	cost += _mm_cvtsi128_si64(sum)
+		+ _mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum));
+	return cost + filter_range<FILTER, BPP>(dst, src, prev, i, n);
+}
+
+[[gnu::target("avx2")]]
+__m256i avg_floor_avx2(__m256i a, __m256i b) {
+	__m256i round = _mm256_and_si256(
+		_mm256_xor_si256(a, b), _mm256_set1_epi8(1)
+	);
+	return _mm256_sub_epi8(_mm256_avg_epu8(a, b), round);
+}
+
+[[gnu::target("avx2")]]
+__m256i paeth_lanes_avx2(__m256i a, __m256i b, __m256i c) {
+	__m256i pa = _mm256_sub_epi16(b, c);
+	__m256i pb = _mm256_sub_epi16(a, c);
+	__m256i pc = _mm256_abs_epi16(_mm256_add_epi16(pa, pb));
+	pa = _mm256_abs_epi16(pa);
+	pb = _mm256_abs_epi16(pb);
+
+	__m256i smallest = _mm256_min_epi16(pc, _mm256_min_epi16(pa, pb));
+	__m256i bc = _mm256_blendv_epi8(c, b, _mm256_cmpeq_epi16(smallest, pb));
+	return _mm256_blendv_epi8(bc, a, _mm256_cmpeq_epi16(smallest, pa));
+}
+
+// The unpacks and the pack work within 128-bit lanes and so undo each other's
+// reordering
+[[gnu::target("avx2")]]
+__m256i predict_paeth_avx2(__m256i a, __m256i b, __m256i c) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i lo = paeth_lanes_avx2(
+		_mm256_unpacklo_epi8(a, zero),
+		_mm256_unpacklo_epi8(b, zero),
+		_mm256_unpacklo_epi8(c, zero)
+	);
+	__m256i hi = paeth_lanes_avx2(
+		_mm256_unpackhi_epi8(a, zero),
+		_mm256_unpackhi_epi8(b, zero),
+		_mm256_unpackhi_epi8(c, zero)
+	);
+	return _mm256_packus_epi16(lo, hi);
+}
+
+template <uint8_t FILTER, int BPP>
+[[gnu::target("avx2")]]
+uint64_t filter_avx2(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	uint64_t cost = filter_range<FILTER, BPP>(
+		dst, src, prev, 0, std::min(n, BPP)
+	);
+
+	__m256i zero = _mm256_setzero_si256(), sum = zero;
+	int i = BPP;
+	for(; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((__m256i const *)(src + i));
+		__m256i a = _mm256_loadu_si256((__m256i const *)(src + i - BPP));
+		__m256i b = _mm256_loadu_si256((__m256i const *)(prev + i));
+		__m256i c = _mm256_loadu_si256((__m256i const *)(prev + i - BPP));
+
+		if constexpr(FILTER == FILTER_TYPE_SUB) x = _mm256_sub_epi8(x, a);
+		if constexpr(FILTER == FILTER_TYPE_UP) x = _mm256_sub_epi8(x, b);
+		if constexpr(FILTER == FILTER_TYPE_AVG)
+			x = _mm256_sub_epi8(x, avg_floor_avx2(a, b));
+		if constexpr(FILTER == FILTER_TYPE_PAETH)
+			x = _mm256_sub_epi8(x, predict_paeth_avx2(a, b, c));
+		_mm256_storeu_si256((__m256i *)(dst + i), x);
+
+		__m256i magnitude = _mm256_min_epu8(x, _mm256_sub_epi8(zero, x));
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(magnitude, zero));
+	}
+	alignas(32) uint64_t sums[4];
+	_mm256_store_si256((__m256i *)sums, sum);
+	cost += sums[0] + sums[1] + sums[2] + sums[3];
+	return cost + filter_range<FILTER, BPP>(dst, src, prev, i, n);
+}
+
+template <int BPP>
+void fill_sse2(filter_table_t & table) {
+	table[FILTER_TYPE_NONE][BPP] = filter_sse2<FILTER_TYPE_NONE, BPP>;
+	table[FILTER_TYPE_SUB][BPP] = filter_sse2<FILTER_TYPE_SUB, BPP>;
+	table[FILTER_TYPE_UP][BPP] = filter_sse2<FILTER_TYPE_UP, BPP>;
+	table[FILTER_TYPE_AVG][BPP] = filter_sse2<FILTER_TYPE_AVG, BPP>;
+	table[FILTER_TYPE_PAETH][BPP] = filter_sse2<FILTER_TYPE_PAETH, BPP>;
+}
+
+template <int BPP>
+void fill_avx2(filter_table_t & table) {
+	table[FILTER_TYPE_NONE][BPP] = filter_avx2<FILTER_TYPE_NONE, BPP>;
+	table[FILTER_TYPE_SUB][BPP] = filter_avx2<FILTER_TYPE_SUB, BPP>;
+	table[FILTER_TYPE_UP][BPP] = filter_avx2<FILTER_TYPE_UP, BPP>;
+	table[FILTER_TYPE_AVG][BPP] = filter_avx2<FILTER_TYPE_AVG, BPP>;
+	table[FILTER_TYPE_PAETH][BPP] = filter_avx2<FILTER_TYPE_PAETH, BPP>;
+}
+
+template <int... BPP>
+void fill(filter_table_t & table, simd_level_t level) {
+	if(level >= SIMD_SSE2) (fill_sse2<BPP>(table), ...);
+	if(level >= SIMD_AVX2) (fill_avx2<BPP>(table), ...);
+}
+
+}
+
+#endif
+
+// Builds the filter kernel table for an instruction set tier, which must be
+// supported by the running CPU
+filter_table_t filter_table(simd_level_t level) {
+	filter_table_t table{};
+	fill_scalar<1>(table);
+	fill_scalar<2>(table);
+	fill_scalar<3>(table);
+	fill_scalar<4>(table);
+	fill_scalar<6>(table);
+	fill_scalar<8>(table);
+#if defined(__x86_64__)
+	simd::fill<1, 2, 3, 4, 6, 8>(table, level);
+#endif
+	return table;
+}
+
+// Filter kernels for one pixel size at the best tier of the running CPU
+std::array<filter_row_fn_t, 5> const & filter_kernels(int stride) {
+	static std::array<std::array<filter_row_fn_t, 5>, 9> const sets = [] {
+		filter_table_t table = filter_table(simd_level());
+		std::array<std::array<filter_row_fn_t, 5>, 9> sets{};
+		for(int stride : unfilter_strides) {
+			for(int f = 0; f < 5; f++) sets[stride][f] = table[f][stride];
+		}
+		return sets;
+	}();
+	return sets[stride];
+}
+
+// Number of bits an order-0 entropy coder would spend on the row, up to a
+// constant shared by all rows of the same length
+double entropy_cost(uint8_t const * row, int n) {
+	uint32_t histogram[256] = {};
+	for(int i = 0; i < n; i++) histogram[row[i]]++;
+
+	double bits = 0;
+	for(uint32_t count : histogram) {
+		if(count) bits -= count * std::log2((double)count);
+	}
+	return bits;
+}
+
+// Whether rows are worth filtering at all: the bytes of indexed-colour and
+// sub-byte images are not sample values
+bool filters_rows(chunk_ihdr_data_t const & ihdr) {
+	return ihdr.colour_type != COLOUR_TYPE_INDEXED_COLOUR
+		&& ihdr.bit_depth >= 8;
+}
+
+// Chooses the filter type of each row. Effort 0 uses one fixed filter, 1 the
+// filter with the smallest sum of magnitudes (libpng's heuristic), and 2 the
+// filter with the smallest byte entropy, which is slower but usually closer
+// to what deflate achieves. Images that filters_rows() rejects are left
+// unfiltered.
+class filter_selector_t {
+private:
+	std::array<filter_row_fn_t, 5> const & kernels;
+	int bytes_per_row;
+	int effort;
+	bool unfiltered;
+	std::vector<uint8_t> candidates;	// five rows: filter type byte + data
+
+	uint8_t * candidate(int filter) {
+		return candidates.data() + filter * (1 + bytes_per_row);
+	}
+
+public:
+	filter_selector_t(
+		chunk_ihdr_data_t const & ihdr,
+		int stride,
+		int bytes_per_row,
+		int effort
+	) : kernels(filter_kernels(stride)),
+		bytes_per_row(bytes_per_row),
+		effort(effort),
+		unfiltered(!filters_rows(ihdr)),
+		candidates(5 * (1 + bytes_per_row)) {
+		for(int f = 0; f < 5; f++) candidate(f)[0] = f;
+	}
+
+	// Filters `row` against `prev` and returns the filter type byte followed
+	// by the filtered row, valid until the next call
+	std::span<uint8_t const> filter(uint8_t const * row, uint8_t const * prev) {
+		int best = FILTER_TYPE_NONE;
+		if(!unfiltered && effort <= 0) {
+			best = FILTER_TYPE_PAETH;
+		} else if(!unfiltered) {
+			double best_cost = INFINITY;
+			for(int f = 0; f < 5; f++) {
+				uint8_t * out = candidate(f) + 1;
+				double cost = kernels[f](out, row, prev, bytes_per_row);
+				if(effort >= 2) cost = entropy_cost(out, bytes_per_row);
+				if(cost < best_cost) {
+					best = f;
+					best_cost = cost;
+				}
+			}
+			return { candidate(best), (size_t)1 + bytes_per_row };
+		}
+
+		kernels[best](candidate(best) + 1, row, prev, bytes_per_row);
+		return { candidate(best), (size_t)1 + bytes_per_row };
+	}
+};
+
+}
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <zlib.h>
+
+#include "net.h"
+#include "constants.h"
+#include "checksum.h"
+#include "deflate.h"
+#include "fast_deflate.h"
+#include "layout.h"
+#include "rowfilter.h"
+#include "thread_pool.h"
+#include "chunk/ihdr.h"
+#include "chunk/rpix.h"
+
+namespace rpng {
+
+struct encode_options_t {
+	// zlib compression level, 0 to 9
+	int compression_level = 6;
+
+	// Filter selection effort, 0 to 2; see filter_selector_t
+	int effort = 1;
+
+	// Favour encode latency over size: Up filter on every row but the first
+	// and fast_deflater_t in place of zlib. Overrides the level, effort and
+	// pool.
+	bool fast = false;
+
+	// RGB triples, required for indexed-colour images
+	std::span<uint8_t const> palette;
+
+	// Pool on which bands of rows are filtered and deflated in parallel,
+	// pigz-style. Null encodes on the calling thread.
+	thread_pool_t * pool = nullptr;
+
+	// Filtered bytes per band
+	size_t band_size = 256 << 10;
+
+	// Deflate every band from scratch rather than priming it with the end of
+	// the previous band, and list where the bands start in an rpIX chunk, so
+	// that decoders can inflate them in parallel too
+	bool segment_index = false;
+};
+
+// Appends a chunk with its length, type and CRC
+void write_chunk(
+	std::vector<uint8_t> & out,
+	uint32_t type,
+	std::span<uint8_t const> data
+) {
+	uint32_t length = htonl(data.size());
+	uint32_t crc = update_crc32(0, (uint8_t const *)&type, 4);
+	crc = update_crc32(crc, data.data(), data.size());
+	uint32_t crc_be = htonl(crc);
+
+	out.insert(out.end(), (uint8_t *)&length, (uint8_t *)&length + 4);
+	out.insert(out.end(), (uint8_t *)&type, (uint8_t *)&type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	out.insert(out.end(), (uint8_t *)&crc_be, (uint8_t *)&crc_be + 4);
+}
+
+constexpr size_t IDAT_CHUNK_SIZE = 64 << 10;
+
+// Deflates filtered scanlines into IDAT chunks of at most IDAT_CHUNK_SIZE
+// bytes, appended to the datastream as each one fills up
+class idat_writer_t {
+private:
+	std::vector<uint8_t> & out;
+	deflater_t * deflater;
+	std::vector<uint8_t> buf;
+	size_t filled = 0;
+
+	void flush_chunk() {
+		if(!filled) return;
+		write_chunk(out, CHUNK_TYPE_IDAT, std::span(buf).first(filled));
+		filled = 0;
+	}
+
+public:
+	// Without a deflater, only already compressed data may be appended
+	idat_writer_t(std::vector<uint8_t> & out, deflater_t * deflater = nullptr)
+		: out(out), deflater(deflater), buf(IDAT_CHUNK_SIZE) {}
+
+	// Deflates `in` with the given zlib flush mode. A flush is complete once
+	// zlib stops short of filling the output.
+	void write(std::span<uint8_t const> in, int flush = Z_NO_FLUSH) {
+		while(true) {
+			std::span<uint8_t> window = std::span(buf).subspan(filled);
+			bool ended = deflater->deflate(in, window, flush);
+			filled = buf.size() - window.size();
+
+			bool full = window.empty();
+			if(full) flush_chunk();
+			if(ended || (in.empty() && !full && flush != Z_FINISH)) return;
+		}
+	}
+
+	// Appends part of a zlib datastream compressed elsewhere
+	void append(std::span<uint8_t const> data) {
+		while(!data.empty()) {
+			size_t n = std::min(data.size(), buf.size() - filled);
+			memcpy(buf.data() + filled, data.data(), n);
+			filled += n;
+			data = data.subspan(n);
+			if(filled == buf.size()) flush_chunk();
+		}
+	}
+
+	// Writes out the last chunk
+	void close() {
+		flush_chunk();
+	}
+
+	// Ends the zlib stream and writes out the last chunk
+	void finish() {
+		write({}, Z_FINISH);
+		close();
+	}
+};
+
+// zlib stream header for deflate with a 32K window at the given level
+std::array<uint8_t, 2> zlib_header(int level) {
+	int flevel = level < 0 || level == 6 ? 2
+		: level < 2 ? 0
+		: level < 6 ? 1
+		: 3;
+	uint8_t cmf = 0x78, flg = flevel << 6;
+	flg += 31 - (cmf * 256 + flg) % 31;
+	return { cmf, flg };
+}
+
+// Splits the image into bands of rows, filters and deflates every band as a
+// separate raw deflate segment on the pool, and stitches the segments into one
+// zlib datastream. Each segment but the last ends with a sync flush, on a byte
+// boundary. Bands are primed with the last 32K of the previous band, which
+// recovers most of what splitting costs in size, unless an index is wanted,
+// in which case each starts from an empty window as after a full flush. The
+// Adler-32 checksums of the bands are combined for the trailer.
+void write_banded_idat(
+	std::vector<uint8_t> & png,
+	std::span<uint8_t const> img,
+	chunk_ihdr_data_t const & ihdr,
+	image_layout_t const & layout,
+	encode_options_t const & options
+) {
+	size_t row_size = 1 + layout.bytes_per_row;
+	uint32_t band_rows = std::clamp<size_t>(
+		options.band_size / row_size, 1, ihdr.height
+	);
+	int num_bands = (ihdr.height + band_rows - 1) / band_rows;
+
+	auto for_each_band = [&](auto && f) {
+		if(options.pool) {
+			options.pool->parallel_for(num_bands, f);
+		} else {
+			for(int i = 0; i < num_bands; i++) f(i);
+		}
+	};
+
+	std::vector<uint8_t> filtered(ihdr.height * row_size);
+	std::vector<uint8_t> zero_row(layout.bytes_per_row);
+	for_each_band([&](int i) {
+		filter_selector_t selector(
+			ihdr, layout.stride, layout.bytes_per_row, options.effort
+		);
+		uint32_t end = std::min(ihdr.height, (i + 1) * band_rows);
+		for(uint32_t y = i * band_rows; y < end; y++) {
+			size_t offset = (size_t)y * layout.bytes_per_row;
+			uint8_t const * row = img.data() + offset;
+			uint8_t const * prev = y
+				? row - layout.bytes_per_row
+				: zero_row.data();
+			std::span<uint8_t const> out = selector.filter(row, prev);
+			memcpy(filtered.data() + y * row_size, out.data(), out.size());
+		}
+	});
+
+	std::vector<std::vector<uint8_t>> segments(num_bands);
+	std::vector<uLong> checksums(num_bands);
+	for_each_band([&](int i) {
+		size_t begin = (size_t)i * band_rows * row_size;
+		size_t end = std::min(filtered.size(), begin + band_rows * row_size);
+		std::span<uint8_t const> band(filtered.data() + begin, end - begin);
+
+		deflater_t deflater(
+			options.compression_level,
+			filters_rows(ihdr) ? Z_FILTERED : Z_DEFAULT_STRATEGY,
+			-MAX_WBITS
+		);
+		if(begin && !options.segment_index) {
+			size_t window = std::min<size_t>(begin, 32 << 10);
+			deflater.set_dictionary(
+				std::span(filtered).subspan(begin - window, window)
+			);
+		}
+
+		bool last = i + 1 == num_bands;
+		deflate_append(
+			deflater, band, segments[i], last ? Z_FINISH : Z_SYNC_FLUSH
+		);
+		checksums[i] = update_adler32(1, band.data(), band.size());
+	});
+
+	std::array<uint8_t, 2> header = zlib_header(options.compression_level);
+	uLong adler = checksums[0];
+	for(int i = 1; i < num_bands; i++) {
+		size_t size = std::min(
+			filtered.size() - (size_t)i * band_rows * row_size,
+			band_rows * row_size
+		);
+		adler = adler32_combine(adler, checksums[i], size);
+	}
+	uint32_t trailer = htonl(adler);
+
+	if(options.segment_index && num_bands > 1) {
+		segment_index_t index;
+		size_t offset = header.size();
+		for(int i = 0; i < num_bands; i++) {
+			index.push_back({ i * band_rows, (uint32_t)offset });
+			offset += segments[i].size();
+		}
+		if(offset <= UINT32_MAX) {
+			write_chunk(png, CHUNK_TYPE_RPIX, serialize_rpix(index));
+		}
+	}
+
+	idat_writer_t idat(png);
+	idat.append(header);
+	for(auto const & segment : segments) idat.append(segment);
+	idat.append(std::span((uint8_t const *)&trailer, 4));
+	idat.close();
+}
+
+// The fast profile, on the calling thread: the first row is filtered with Sub
+// and the rest with Up, which both cost next to nothing, and the rows are
+// compressed by fast_deflater_t
+void write_fast_idat(
+	std::vector<uint8_t> & png,
+	std::span<uint8_t const> img,
+	chunk_ihdr_data_t const & ihdr,
+	image_layout_t const & layout
+) {
+	std::array<filter_row_fn_t, 5> const & kernels
+		= filter_kernels(layout.stride);
+	int bytes_per_row = layout.bytes_per_row;
+	bool filtered = filters_rows(ihdr);
+
+	std::vector<uint8_t> row(1 + bytes_per_row), zero_row(bytes_per_row);
+	std::vector<uint8_t> stream;
+	stream.reserve(2 * IDAT_CHUNK_SIZE);
+	fast_deflater_t deflater(layout.stride);
+	idat_writer_t idat(png);
+	deflater.begin(stream);
+
+	for(uint32_t y = 0; y < ihdr.height; y++) {
+		uint8_t const * src = img.data() + (size_t)y * bytes_per_row;
+		uint8_t filter = !filtered ? FILTER_TYPE_NONE
+			: y ? FILTER_TYPE_UP
+			: FILTER_TYPE_SUB;
+		uint8_t const * prev = y ? src - bytes_per_row : zero_row.data();
+		row[0] = filter;
+		kernels[filter](row.data() + 1, src, prev, bytes_per_row);
+
+		deflater.write(row, stream);
+		if(stream.size() >= IDAT_CHUNK_SIZE) {
+			idat.append(stream);
+			stream.clear();
+		}
+	}
+	deflater.finish(stream);
+	idat.append(stream);
+	idat.close();
+}
+
+// Encodes packed rows, laid out as load() returns them, into a PNG datastream
+std::vector<uint8_t> save(
+	std::span<uint8_t const> img,
+	chunk_ihdr_data_t const & ihdr,
+	encode_options_t const & options = {}
+) {
+	colour_properties_t colours = check_ihdr(ihdr);
+	if(ihdr.compression != 0 || ihdr.filter != 0)
+		throw std::runtime_error("Unknown compression or filter method");
+	if(ihdr.interlace != 0)
+		throw std::runtime_error("Interlaced encoding is not supported");
+
+	image_layout_t layout = image_layout(ihdr, colours);
+	if(img.size() != layout.raw_size)
+		throw std::runtime_error(fmt::format(
+			"Image size mismatch. Expecting {} bytes, found {}",
+			layout.raw_size,
+			img.size()
+		));
+
+	bool indexed = ihdr.colour_type == COLOUR_TYPE_INDEXED_COLOUR;
+	size_t palette_entries = options.palette.size() / 3;
+	if(
+		options.palette.size() % 3
+		|| palette_entries > std::min<size_t>(256, 1 << ihdr.bit_depth)
+		|| (indexed && palette_entries == 0)
+		|| (!(ihdr.colour_type & 2) && palette_entries)
+	)
+		throw std::runtime_error(fmt::format(
+			"Invalid palette of {} bytes", options.palette.size()
+		));
+
+	std::vector<uint8_t> png;
+	png.insert(png.end(), (uint8_t *)&PNG_MAGIC, (uint8_t *)&PNG_MAGIC + 8);
+
+	chunk_ihdr_data_t ihdr_be = ihdr;
+	ihdr_be.width = htonl(ihdr.width);
+	ihdr_be.height = htonl(ihdr.height);
+	write_chunk(png, CHUNK_TYPE_IHDR, std::span(
+		(uint8_t const *)&ihdr_be, sizeof(chunk_ihdr_data_t)
+	));
+	if(!options.palette.empty()) {
+		write_chunk(png, CHUNK_TYPE_PLTE, options.palette);
+	}
+
+	if(options.fast) {
+		write_fast_idat(png, img, ihdr, layout);
+		write_chunk(png, CHUNK_TYPE_IEND, {});
+		return png;
+	}
+
+	if(options.pool || options.segment_index) {
+		write_banded_idat(png, img, ihdr, layout, options);
+		write_chunk(png, CHUNK_TYPE_IEND, {});
+		return png;
+	}
+
+	filter_selector_t selector(
+		ihdr, layout.stride, layout.bytes_per_row, options.effort
+	);
+	deflater_t deflater(
+		options.compression_level,
+		filters_rows(ihdr) ? Z_FILTERED : Z_DEFAULT_STRATEGY
+	);
+	idat_writer_t idat(png, &deflater);
+
+	std::vector<uint8_t> zero_row(layout.bytes_per_row);
+	uint8_t const * prev = zero_row.data();
+	for(uint32_t y = 0; y < ihdr.height; y++) {
+		uint8_t const * row = img.data() + (size_t)y * layout.bytes_per_row;
+		idat.write(selector.filter(row, prev));
+		prev = row;
+	}
+	idat.finish();
+
+	write_chunk(png, CHUNK_TYPE_IEND, {});
+	return png;
+}
+
+void save(
+	std::string const & filepath,
+	std::span<uint8_t const> img,
+	chunk_ihdr_data_t const & ihdr,
+	encode_options_t const & options = {}
+) {
+	std::vector<uint8_t> png = save(img, ihdr, options);
+
+	FILE * file = fopen(filepath.c_str(), "wb");
+	if(!file)
+		throw std::runtime_error(fmt::format("Cannot open file: {}", filepath));
+
+	size_t written = fwrite(png.data(), 1, png.size(), file);
+	if(fclose(file) != 0 || written != png.size())
+		throw std::runtime_error(
+			fmt::format("Cannot write file: {}", filepath)
+		);
+}
+
+}
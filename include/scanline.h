@@ -0,0 +1,156 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "inflate.h"
+#include "inflate_backend.h"
+#include "layout.h"
+#include "reconstruct.h"
+
+namespace rpng {
+
+// Buffers that can be carried over from one decode to the next: the zlib
+// stream and its window, or the built-in decoder's, libdeflate's
+// decompressor, and the two scanlines
+struct decode_scratch_t {
+	inflater_t inflater;
+	libdeflate_inflater_t libdeflate;
+	std::vector<uint8_t> rows;
+};
+
+// Cuts the inflated datastream into filtered scanlines, a filter type byte
+// followed by the row data, inflating each straight into a buffer chosen by
+// the caller
+class row_inflater_t {
+private:
+	image_layout_t const & layout;
+	inflater_t & inflater;
+	uint8_t * row;
+
+	int pass = 0;					// index into layout.passes
+	int y = 0;						// row within the current reduced image
+	size_t filled = 0;				// bytes of the current row inflated so far
+
+public:
+	row_inflater_t(
+		image_layout_t const & layout,
+		inflater_t & inflater,
+		uint8_t * first_row
+	) : layout(layout), inflater(inflater), row(first_row) {
+		inflater.reset();
+	}
+
+	bool done() const {
+		return pass == layout.num_passes;
+	}
+
+	// Consumes a piece of the zlib datastream. Every scanline it completes is
+	// passed to on_row(reduced_image_t const &, int y, uint8_t * row), which
+	// returns the buffer to inflate the following scanline into.
+	template <class OnRow>
+	void feed(std::span<uint8_t const> in, OnRow && on_row) {
+		while(!done()) {
+			reduced_image_t const & image = layout.passes[pass];
+			size_t row_size = 1 + image.bytes_per_row;
+			std::span<uint8_t> out(row + filled, row_size - filled);
+
+			size_t avail_in = in.size(), avail_out = out.size();
+			inflater.inflate(in, out);
+			filled = row_size - out.size();
+
+			if(filled == row_size) {
+				int row_y = y;
+				filled = 0;
+				if(++y == image.height) {
+					y = 0;
+					pass++;
+				}
+				row = on_row(image, row_y, row);
+			} else if(in.size() == avail_in && out.size() == avail_out) {
+				return;		// zlib needs more input
+			} else if(inflater.finished()) {
+				break;
+			}
+		}
+
+		// anything past the final scanline must be the end of the stream
+		std::span<uint8_t> none;
+		inflate_into(inflater, in, none);
+	}
+
+	// Checks that the stream ended exactly after the final scanline
+	void finish() {
+		if(done() && !inflater.finished()) {
+			std::span<uint8_t const> in;
+			std::span<uint8_t> out;
+			inflater.inflate(in, out);
+		}
+
+		if(!inflater.finished())
+			throw std::runtime_error("Ran out of input to decompress");
+		else if(!done())
+			throw std::runtime_error(
+				"Inflated data is short of the size implied by IHDR"
+			);
+	}
+};
+
+uint8_t * reserve_rows(std::vector<uint8_t> & rows, size_t size) {
+	if(rows.size() < size) rows.resize(size);
+	return rows.data();
+}
+
+// Streaming decode engine. Compressed data is inflated just far enough to
+// complete the next scanline, which is unfiltered against the previous row of
+// its reduced image and handed to a sink. Only two rows are ever held, so
+// working memory is O(width) regardless of the image height.
+class scanline_decoder_t {
+private:
+	image_layout_t layout;
+	unfilter_set_t const & kernels;
+
+	uint8_t * prev;					// two rows: filter type byte + data
+	uint8_t * cur;
+	row_inflater_t rows;
+
+public:
+	scanline_decoder_t(
+		image_layout_t const & layout,
+		decode_scratch_t & scratch
+	) : layout(layout),
+		kernels(unfilter_kernels(layout.stride)),
+		prev(reserve_rows(scratch.rows, 2 * (1 + layout.max_bytes_per_row))),
+		cur(prev + 1 + layout.max_bytes_per_row),
+		rows(this->layout, scratch.inflater, cur) {}
+
+	bool done() const {
+		return rows.done();
+	}
+
+	// Consumes a piece of the zlib datastream, emitting every scanline that
+	// it completes as sink(reduced_image_t const &, int y, span row)
+	template <class Sink>
+	void feed(std::span<uint8_t const> in, Sink && sink) {
+		rows.feed(in, [&](reduced_image_t const & image, int y, uint8_t * row) {
+			reconstruct_row(
+				row + 1, row + 1, y ? prev + 1 : nullptr,
+				row[0], kernels, image.bytes_per_row
+			);
+			sink(image, y, std::span<uint8_t const>(row + 1, image.bytes_per_row));
+
+			std::swap(prev, cur);
+			return cur;
+		});
+	}
+
+	void finish() {
+		rows.finish();
+	}
+};
+
+}
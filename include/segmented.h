@@ -0,0 +1,191 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <memory_resource>
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <zlib.h>
+
+#include "checksum.h"
+#include "inflate.h"
+#include "layout.h"
+#include "reconstruct.h"
+#include "memory.h"
+#include "thread_pool.h"
+#include "chunk/rpix.h"
+
+namespace rpng {
+
+using idat_list_t = std::pmr::vector<std::span<uint8_t const>>;
+
+// Views of bytes [begin, end) of the datastream spread over `idats`
+idat_list_t stream_range(
+	idat_list_t const & idats, size_t begin, size_t end,
+	std::pmr::memory_resource * memory = std::pmr::get_default_resource()
+) {
+	idat_list_t range(memory);
+	size_t pos = 0;
+	for(std::span<uint8_t const> idat : idats) {
+		size_t lo = std::max(begin, pos), hi = std::min(end, pos + idat.size());
+		if(lo < hi) range.push_back(idat.subspan(lo - pos, hi - lo));
+		pos += idat.size();
+	}
+	return range;
+}
+
+void copy_stream(
+	idat_list_t const & idats, size_t begin, size_t end, uint8_t * dst
+) {
+	idat_list_t range = stream_range(
+		idats, begin, end, idats.get_allocator().resource()
+	);
+	for(std::span<uint8_t const> piece : range) {
+		memcpy(dst, piece.data(), piece.size());
+		dst += piece.size();
+	}
+}
+
+// Decodes a non-interlaced image whose datastream restarts at every segment.
+// Each band of rows is inflated as raw deflate data and unfiltered in place
+// on the pool, every row going to on_row(reduced_image_t const &, int y,
+// uint8_t const * row) in order within its band. A band whose first row is
+// filtered against the row above is unfiltered once the preceding band is
+// done. The bands' Adler-32 checksums are combined and checked against the
+// zlib trailer, unless `verify_checksum` is false. Temporaries come from
+// `memory`, locked for the pool's tasks.
+template <class OnRow>
+void decode_segmented(
+	image_layout_t const & layout,
+	idat_list_t const & idats,
+	segment_index_t const & segments,
+	thread_pool_t & pool,
+	std::pmr::memory_resource * memory,
+	OnRow && on_row,
+	bool verify_checksum = true
+) {
+	reduced_image_t const & image = layout.passes[0];
+	size_t row_size = 1 + image.bytes_per_row;
+
+	size_t stream_size = 0;
+	for(std::span<uint8_t const> idat : idats) stream_size += idat.size();
+
+	uint8_t header[2];
+	if(stream_size < 6)
+		throw std::runtime_error("Datastream too short for a segment index");
+	copy_stream(idats, 0, 2, header);
+	if((header[0] & 0x0f) != Z_DEFLATED || (header[1] & 0x20))
+		throw std::runtime_error("Unsupported zlib header for a segment index");
+
+	int num_segments = segments.size();
+	for(int i = 0; i < num_segments; i++) {
+		segment_t const & s = segments[i];
+		bool ordered = i == 0
+			? s.first_row == 0 && s.offset == 2
+			: s.first_row > segments[i - 1].first_row
+				&& s.offset > segments[i - 1].offset;
+		if(
+			!ordered
+			|| s.first_row >= (uint32_t)image.height
+			|| s.offset >= stream_size - 4
+		)
+			throw std::runtime_error(
+				fmt::format("Invalid rpIX segment {}", i)
+			);
+	}
+
+	locked_resource_t task_memory(memory);
+	std::pmr::vector<uint8_t> filtered(layout.filtered_size, memory);
+	std::pmr::vector<uLong> checksums(num_segments, memory);
+	std::pmr::vector<char> dependent(num_segments, memory);
+	unfilter_set_t const & kernels = unfilter_kernels(layout.stride);
+
+	auto band_end = [&](int i) -> uint32_t {
+		return i + 1 < num_segments ? segments[i + 1].first_row : image.height;
+	};
+
+	auto unfilter_band = [&](int i, bool independent) {
+		for(uint32_t y = segments[i].first_row; y < band_end(i); y++) {
+			uint8_t * row = filtered.data() + y * row_size + 1;
+			bool first = y == 0 || (independent && y == segments[i].first_row);
+			reconstruct_row(
+				row, row, first ? nullptr : row - row_size,
+				row[-1], kernels, image.bytes_per_row
+			);
+			on_row(image, y, row);
+		}
+	};
+
+	pool.parallel_for(num_segments, [&](int i) {
+		bool last = i + 1 == num_segments;
+		size_t begin = segments[i].first_row * row_size;
+		size_t end = band_end(i) * row_size;
+		std::span<uint8_t> out(filtered.data() + begin, end - begin);
+
+		inflater_t inflater(-MAX_WBITS, &task_memory);
+		for(std::span<uint8_t const> in : stream_range(
+			idats,
+			segments[i].offset,
+			last ? stream_size : segments[i + 1].offset,
+			&task_memory
+		)) {
+			inflate_into(inflater, in, out);
+		}
+		if(last) {
+			inflate_finish(inflater, out);
+		} else if(inflater.finished() || !out.empty()) {
+			throw std::runtime_error(fmt::format(
+				"rpIX segment {} does not end on its row boundary", i
+			));
+		}
+		if(verify_checksum)
+			checksums[i] = update_adler32(
+				1, filtered.data() + begin, end - begin
+			);
+
+		// Sub and None never look at the row above
+		uint8_t filter = filtered[begin];
+		dependent[i] = i > 0
+			&& filter != FILTER_TYPE_NONE
+			&& filter != FILTER_TYPE_SUB;
+		if(!dependent[i]) unfilter_band(i, true);
+	});
+
+	for(int i = 0; i < num_segments; i++) {
+		if(dependent[i]) unfilter_band(i, false);
+	}
+
+	if(!verify_checksum) return;
+
+	uLong adler = checksums[0];
+	for(int i = 1; i < num_segments; i++) {
+		size_t size = (band_end(i) - segments[i].first_row) * row_size;
+		adler = adler32_combine(adler, checksums[i], size);
+	}
+
+	uint8_t trailer[4];
+	copy_stream(idats, stream_size - 4, stream_size, trailer);
+	uint32_t expected;
+	memcpy(&expected, trailer, 4);
+	if(ntohl(expected) != adler)
+		throw std::runtime_error("Adler-32 mismatch in segmented datastream");
+}
+
+void decode_segmented(
+	image_layout_t const & layout,
+	idat_list_t const & idats,
+	segment_index_t const & segments,
+	uint8_t * raw,
+	thread_pool_t & pool
+) {
+	std::pmr::memory_resource * memory = idats.get_allocator().resource();
+	decode_segmented(layout, idats, segments, pool, memory, [&](
+		reduced_image_t const & image, int y, uint8_t const * row
+	) {
+		memcpy(raw + (size_t)y * image.bytes_per_row, row, image.bytes_per_row);
+	});
+}
+
+}
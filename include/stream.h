@@ -0,0 +1,203 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "net.h"
+#include "load.h"
+#include "checksum.h"
+#include "probe.h"
+#include "layout.h"
+#include "scanline.h"
+
+namespace rpng {
+
+// Push-mode decoder for a PNG that arrives piecewise, e.g. from a socket.
+// Bytes are fed as they come, in pieces of any size that need not line up
+// with chunk boundaries. IDAT data is inflated as soon as it arrives and each
+// scanline is reconstructed once it is complete, so the first rows come out
+// while the rest of the file is still on its way. Each chunk's CRC is
+// computed piece by piece as its data passes through.
+class stream_decoder_t {
+public:
+	// Called after the last row of each reduced image: the whole image, or
+	// one Adam7 pass
+	using pass_callback_t = std::function<void(reduced_image_t const & image)>;
+
+private:
+	enum state_t {
+		STATE_HEADER,			// signature and IHDR
+		STATE_CHUNK_HEADER,		// length and type
+		STATE_CHUNK_DATA,
+		STATE_CHUNK_CRC,
+		STATE_END				// after IEND
+	};
+
+	row_callback_t on_row;
+	pass_callback_t on_pass;
+	decode_scratch_t scratch;
+
+	state_t state = STATE_HEADER;
+	std::array<uint8_t, PNG_HEADER_SIZE> pending;	// a header split by feeds
+	size_t num_pending = 0;
+	size_t offset = 0;			// of the next byte from the start of the file
+
+	chunk_t chunk{};
+	chunk_action_t action = CHUNK_ACTION_SKIP;
+	size_t remaining = 0;		// bytes of the chunk data still to come
+	uint32_t crc = 0;			// of the chunk so far
+
+	chunk_ihdr_data_t ihdr_data{};
+	colour_properties_t colours{};
+	image_layout_t image{};
+	std::optional<scanline_decoder_t> decoder;
+
+	// Moves bytes from `in` until `pending` holds `size` of them
+	bool gather(std::span<uint8_t const> & in, size_t size) {
+		size_t n = std::min(size - num_pending, in.size());
+		memcpy(pending.data() + num_pending, in.data(), n);
+		in = in.subspan(n);
+		offset += n;
+		num_pending += n;
+		if(num_pending < size) return false;
+
+		num_pending = 0;
+		return true;
+	}
+
+	void feed_idat(std::span<uint8_t const> data) {
+		decoder->feed(data, [&](
+			reduced_image_t const & pass, int y, std::span<uint8_t const> row
+		) {
+			on_row(pass, y, row);
+			if(y == pass.height - 1 && on_pass) on_pass(pass);
+		});
+	}
+
+public:
+	explicit stream_decoder_t(
+		row_callback_t on_row,
+		pass_callback_t on_pass = {}
+	) : on_row(std::move(on_row)), on_pass(std::move(on_pass)) {}
+
+	stream_decoder_t(stream_decoder_t const &) = delete;
+	stream_decoder_t & operator=(stream_decoder_t const &) = delete;
+
+	// Consumes the next piece of the file. Rows are emitted from within.
+	void feed(std::span<uint8_t const> in) {
+		while(!in.empty() && state != STATE_END) {
+			switch(state) {
+			case STATE_HEADER:
+				if(!gather(in, PNG_HEADER_SIZE)) return;
+				std::tie(ihdr_data, colours) = probe(pending);
+				SPDLOG_DEBUG("\n{}\n", ihdr_data);
+
+				image = image_layout(ihdr_data, colours);
+				decoder.emplace(image, scratch);
+				state = STATE_CHUNK_HEADER;
+				break;
+
+			case STATE_CHUNK_HEADER: {
+				if(!gather(in, 8)) return;
+				reader_t reader{ std::span(pending).first(8) };
+				chunk = {};
+				chunk.length = ntohl(reader.read<uint32_t>("chunk length"));
+				chunk.type = reader.read<uint32_t>("chunk type");
+				chunk.offset = offset;
+				crc = update_crc32(0, pending.data() + 4, 4);
+
+				action = chunk_action(chunk);
+				remaining = chunk.length;
+				state = STATE_CHUNK_DATA;
+				break;
+			}
+
+			case STATE_CHUNK_DATA: {
+				size_t n = std::min(remaining, in.size());
+				crc = update_crc32(crc, in.data(), n);
+				if(action == CHUNK_ACTION_IDAT) feed_idat(in.first(n));
+				in = in.subspan(n);
+				offset += n;
+				remaining -= n;
+				if(remaining == 0) state = STATE_CHUNK_CRC;
+				break;
+			}
+
+			case STATE_CHUNK_CRC: {
+				if(!gather(in, 4)) return;
+				reader_t reader{ std::span(pending).first(4) };
+				chunk.crc = ntohl(reader.read<uint32_t>("chunk CRC"));
+				SPDLOG_DEBUG("parsed chunk: {}", chunk);
+				if(crc != chunk.crc)
+					throw std::runtime_error(
+						fmt::format("CRC mismatch in {}", chunk)
+					);
+				state = chunk.type == CHUNK_TYPE_IEND
+					? STATE_END
+					: STATE_CHUNK_HEADER;
+				break;
+			}
+
+			case STATE_END:
+				break;
+			}
+		}
+	}
+
+	// Checks, once the input has ended, that it held the whole image and
+	// ended between chunks
+	void finish() {
+		if(state == STATE_HEADER)
+			throw std::runtime_error("Unexpected end of file @ header");
+
+		bool between_chunks = state == STATE_END
+			|| (state == STATE_CHUNK_HEADER && num_pending == 0);
+		if(!between_chunks)
+			throw std::runtime_error(fmt::format(
+				"Unexpected end of file @ {}", chunk
+			));
+
+		decoder->finish();
+	}
+
+	// Starts on a new file, keeping the zlib stream and row buffers
+	void reset() {
+		state = STATE_HEADER;
+		num_pending = 0;
+		offset = 0;
+		decoder.reset();
+	}
+
+	// Whether IHDR has been read, after which the following are valid
+	bool has_header() const {
+		return state != STATE_HEADER;
+	}
+
+	chunk_ihdr_data_t const & ihdr() const {
+		return ihdr_data;
+	}
+
+	colour_properties_t const & colour_properties() const {
+		return colours;
+	}
+
+	image_layout_t const & layout() const {
+		return image;
+	}
+
+	// Whether IEND has been read. Anything fed after it is ignored.
+	bool done() const {
+		return state == STATE_END;
+	}
+};
+
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+#include <condition_variable>
+
+namespace rpng {
+
+// Fixed-size pool of worker threads with one task deque per worker. Workers
+// take their own newest tasks first and, once idle, steal the oldest tasks
+// of other workers, which keeps every core busy when task sizes vary a lot.
+class thread_pool_t {
+private:
+	using task_t = std::function<void()>;
+
+	struct queue_t {
+		std::mutex mutex;
+		std::deque<task_t> tasks;
+	};
+
+	std::vector<std::unique_ptr<queue_t>> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wake;		// idle workers, for new tasks
+	std::condition_variable progress;	// wait(), for finished tasks too
+	size_t pending = 0;				// queued tasks not yet taken by a worker
+	int waiting = 0;				// threads blocked in wait()
+	bool stopping = false;
+	std::atomic<size_t> next_queue = 0;
+
+	static inline thread_local thread_pool_t * current_pool = nullptr;
+	static inline thread_local int current_worker = -1;
+
+	// Takes the newest task of worker `self`, or else steals the oldest of
+	// another. Any other thread, with `self` -1, only steals.
+	bool pop(int self, task_t & task) {
+		int n = queues.size();
+		int first = std::max(self, 0);
+		for(int i = 0; i < n; i++) {
+			queue_t & queue = *queues[(first + i) % n];
+			std::lock_guard lock(queue.mutex);
+			if(queue.tasks.empty()) continue;
+
+			if(i == 0 && self >= 0) {
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+			} else {
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+			}
+			return true;
+		}
+		return false;
+	}
+
+	// Runs a task taken by pop(), then wakes any thread in wait(), whose
+	// future it may have completed
+	void execute(task_t & task) {
+		{
+			std::lock_guard lock(mutex);
+			pending--;
+		}
+		task();
+		task = nullptr;
+		{
+			std::lock_guard lock(mutex);
+			if(!waiting) return;
+		}
+		progress.notify_all();
+	}
+
+	void run(int self) {
+		current_pool = this;
+		current_worker = self;
+
+		task_t task;
+		while(true) {
+			if(pop(self, task)) {
+				execute(task);
+				continue;
+			}
+
+			std::unique_lock lock(mutex);
+			wake.wait(lock, [&] { return stopping || pending > 0; });
+			if(stopping && pending == 0) return;
+		}
+	}
+
+	void post(task_t task) {
+		int target = current_pool == this
+			? current_worker
+			: next_queue++ % queues.size();
+
+		// counted before it can be taken, so the count never goes below zero
+		bool waiters;
+		{
+			std::lock_guard lock(mutex);
+			pending++;
+			waiters = waiting > 0;
+		}
+		{
+			queue_t & queue = *queues[target];
+			std::lock_guard lock(queue.mutex);
+			queue.tasks.push_back(std::move(task));
+		}
+		wake.notify_one();
+		if(waiters) progress.notify_all();
+	}
+
+public:
+	explicit thread_pool_t(
+		int num_threads = std::thread::hardware_concurrency()
+	) {
+		num_threads = std::max(num_threads, 1);
+		for(int i = 0; i < num_threads; i++) {
+			queues.push_back(std::make_unique<queue_t>());
+		}
+		for(int i = 0; i < num_threads; i++) {
+			workers.emplace_back([this, i] { run(i); });
+		}
+	}
+
+	thread_pool_t(thread_pool_t const &) = delete;
+	thread_pool_t & operator=(thread_pool_t const &) = delete;
+
+	// Finishes all queued tasks before joining the workers
+	~thread_pool_t() {
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for(auto & worker : workers) worker.join();
+	}
+
+	int size() const {
+		return workers.size();
+	}
+
+	// Index of the calling worker thread of this pool, or -1 for any other
+	// thread. Lets tasks reach per-worker state without locking.
+	int worker_index() const {
+		return current_pool == this ? current_worker : -1;
+	}
+
+	// Waits for `futures`, running queued tasks in the meantime, so that
+	// tasks may themselves wait on subtasks. With nothing to run, it sleeps
+	// until a task is queued or finishes. The first exception is rethrown
+	// only once every task has finished.
+	void wait(std::vector<std::future<void>> & futures) {
+		int self = worker_index();
+		auto ready = [](std::future<void> const & future) {
+			return future.wait_for(std::chrono::seconds(0))
+				== std::future_status::ready;
+		};
+
+		for(auto & future : futures) {
+			while(!ready(future)) {
+				task_t task;
+				if(pop(self, task)) {
+					execute(task);
+					continue;
+				}
+
+				std::unique_lock lock(mutex);
+				waiting++;
+				progress.wait(lock, [&] {
+					return pending > 0 || ready(future);
+				});
+				waiting--;
+			}
+		}
+		for(auto & future : futures) future.get();
+	}
+
+	// Runs f(0) ... f(n - 1) across the pool and waits for all of them
+	template <class F>
+	void parallel_for(int n, F const & f) {
+		std::vector<std::future<void>> tasks;
+		tasks.reserve(n);
+		for(int i = 0; i < n; i++) {
+			tasks.push_back(submit([&f, i] { f(i); }));
+		}
+		wait(tasks);
+	}
+
+	template <class F>
+	auto submit(F && f) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+		using result_t = std::invoke_result_t<std::decay_t<F>>;
+		auto task = std::make_shared<std::packaged_task<result_t()>>(
+			std::forward<F>(f)
+		);
+		std::future<result_t> result = task->get_future();
+		post([task] { (*task)(); });
+		return result;
+	}
+};
+
+}
@@ -0,0 +1,406 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
+#include "filters.h"
+#include "chunk/ihdr.h"
+
+namespace rpng {
+
+// Reconstructs `n` bytes of a filtered row `src` into `dst` (which may alias
+// `src`) against the previous reconstructed row `prev`
+using unfilter_fn_t = void(*)(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+);
+
+// Kernels indexed by [filter type][bytes per pixel]
+using unfilter_table_t = std::array<std::array<unfilter_fn_t, 9>, 5>;
+
+// Pixel sizes that some valid colour type and bit depth combination produces
+constexpr std::array<int, 6> unfilter_strides { 1, 2, 3, 4, 6, 8 };
+
+static_assert([] {
+	for(colour_properties_t const & colours : colour_properties) {
+		if(colours.colour_type == COLOUR_TYPE_INVALID) continue;
+		for(int bit_depth = 1; bit_depth <= 16; bit_depth <<= 1) {
+			if(!(colours.valid_bit_depths & bit_depth)) continue;
+			int stride = (bit_depth * colours.num_channels + 7) / 8;
+			if(std::find(
+				unfilter_strides.begin(), unfilter_strides.end(), stride
+			) == unfilter_strides.end()) return false;
+		}
+	}
+	return true;
+}(), "every colour type and bit depth needs unfilter kernels");
+
+void unfilter_none(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	if(dst != src) memmove(dst, src, n);
+}
+
+// Paeth predictor written so that it compiles to conditional moves; the
+// branches in paeth() mispredict constantly on photographic data
+uint8_t paeth_predict(int a, int b, int c) {
+	int pa = std::abs(b - c);
+	int pb = std::abs(a - c);
+	int pc = std::abs(a + b - 2 * c);
+	int bc = pb <= pc ? b : c;
+	return (pa <= pb) & (pa <= pc) ? a : bc;
+}
+
+// Scalar kernels with the filter and pixel size fixed at compile time, so
+// each loop is fully inlined over constant strides. FIRST_ROW kernels treat
+// the previous row as all zeros and never read `prev`.
+template <uint8_t FILTER, int STRIDE, bool FIRST_ROW = false>
+void unfilter_scalar(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	auto up = [&](int i) -> uint8_t {
+		return FIRST_ROW ? 0 : prev[i];
+	};
+
+	for(int i = 0; i < STRIDE && i < n; i++) {
+		uint8_t b = up(i);
+		if constexpr(FILTER == FILTER_TYPE_SUB) dst[i] = src[i];
+		if constexpr(FILTER == FILTER_TYPE_UP) dst[i] = src[i] + b;
+		if constexpr(FILTER == FILTER_TYPE_AVG) dst[i] = src[i] + (b >> 1);
+		if constexpr(FILTER == FILTER_TYPE_PAETH) dst[i] = src[i] + b;
+	}
+
+	for(int i = STRIDE; i < n; i++) {
+		uint8_t a = dst[i - STRIDE], b = up(i);
+		if constexpr(FILTER == FILTER_TYPE_SUB)
+			dst[i] = src[i] + a;
+		if constexpr(FILTER == FILTER_TYPE_UP)
+			dst[i] = src[i] + b;
+		if constexpr(FILTER == FILTER_TYPE_AVG)
+			dst[i] = src[i] + (uint8_t)(((uint16_t)a + b) >> 1);
+		if constexpr(FILTER == FILTER_TYPE_PAETH)
+			dst[i] = src[i]
+				+ paeth_predict(a, b, FIRST_ROW ? 0 : prev[i - STRIDE]);
+	}
+}
+
+template <int STRIDE>
+void fill_scalar(unfilter_table_t & table) {
+	table[FILTER_TYPE_NONE][STRIDE] = unfilter_none;
+	table[FILTER_TYPE_SUB][STRIDE] = unfilter_scalar<FILTER_TYPE_SUB, STRIDE>;
+	table[FILTER_TYPE_UP][STRIDE] = unfilter_scalar<FILTER_TYPE_UP, STRIDE>;
+	table[FILTER_TYPE_AVG][STRIDE] = unfilter_scalar<FILTER_TYPE_AVG, STRIDE>;
+	table[FILTER_TYPE_PAETH][STRIDE]
+		= unfilter_scalar<FILTER_TYPE_PAETH, STRIDE>;
+}
+
+#if defined(__x86_64__)
+
+namespace simd {
+
+// Loads and stores of a single pixel of N <= 8 bytes. Odd sizes are split into
+// power-of-two accesses; going through a partially written stack temporary
+// instead stalls on store forwarding.
+template <class T>
+T load_le(uint8_t const * p) {
+	T v;
+	memcpy(&v, p, sizeof(T));
+	return v;
+}
+
+template <class T>
+void store_le(uint8_t * p, T v) {
+	memcpy(p, &v, sizeof(T));
+}
+
+template <int N>
+__m128i load_px(uint8_t const * p) {
+	if constexpr(N == 1) return _mm_cvtsi32_si128(*p);
+	if constexpr(N == 2) return _mm_cvtsi32_si128(load_le<uint16_t>(p));
+	if constexpr(N == 3) return _mm_cvtsi32_si128(
+		load_le<uint16_t>(p) | (uint32_t)p[2] << 16
+	);
+	if constexpr(N == 4) return _mm_cvtsi32_si128(load_le<uint32_t>(p));
+	if constexpr(N == 6) return _mm_cvtsi64_si128(
+		load_le<uint32_t>(p) | (uint64_t)load_le<uint16_t>(p + 4) << 32
+	);
+	if constexpr(N == 8) return _mm_loadl_epi64((__m128i const *)p);
+}
+
+template <int N>
+void store_px(uint8_t * p, __m128i v) {
+	if constexpr(N == 1) *p = _mm_cvtsi128_si32(v);
+	if constexpr(N == 2) store_le<uint16_t>(p, _mm_cvtsi128_si32(v));
+	if constexpr(N == 3) {
+		uint32_t x = _mm_cvtsi128_si32(v);
+		store_le<uint16_t>(p, x);
+		p[2] = x >> 16;
+	}
+	if constexpr(N == 4) store_le<uint32_t>(p, _mm_cvtsi128_si32(v));
+	if constexpr(N == 6) {
+		uint64_t x = _mm_cvtsi128_si64(v);
+		store_le<uint32_t>(p, x);
+		store_le<uint16_t>(p + 4, x >> 32);
+	}
+	if constexpr(N == 8) _mm_storel_epi64((__m128i *)p, v);
+}
+
+// Byte-wise floor((a + b) / 2)
+__m128i avg_floor(__m128i a, __m128i b) {
+	__m128i round = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+	return _mm_sub_epi8(_mm_avg_epu8(a, b), round);
+}
+
+// Paeth predictor on 16-bit lanes, given |p - a|, |p - b| and |p - c|
+__m128i paeth_select(
+	__m128i a, __m128i b, __m128i c,
+	__m128i pa, __m128i pb, __m128i pc
+) {
+	__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+	__m128i use_a = _mm_cmpeq_epi16(smallest, pa);
+	__m128i use_b = _mm_cmpeq_epi16(smallest, pb);
+	__m128i bc = _mm_or_si128(
+		_mm_and_si128(use_b, b),
+		_mm_andnot_si128(use_b, c)
+	);
+	return _mm_or_si128(
+		_mm_and_si128(use_a, a),
+		_mm_andnot_si128(use_a, bc)
+	);
+}
+
+// SSE2: Sub, Average and Paeth carry a dependency from one pixel to the next,
+// so they work a pixel at a time with all of its channels in one register.
+template <int BPP>
+[[gnu::target("sse2")]]
+void unfilter_sub_sse2(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	__m128i a = _mm_setzero_si128();
+	for(int i = 0; i < n; i += BPP) {
+		a = _mm_add_epi8(load_px<BPP>(src + i), a);
+		store_px<BPP>(dst + i, a);
+	}
+}
+
+[[gnu::target("sse2")]]
+void unfilter_up_sse2(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	int i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((__m128i const *)(src + i));
+		__m128i b = _mm_loadu_si128((__m128i const *)(prev + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi8(x, b));
+	}
+	for(; i < n; i++)
+		dst[i] = src[i] + prev[i];
+}
+
+template <int BPP>
+[[gnu::target("sse2")]]
+void unfilter_avg_sse2(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	__m128i a = _mm_setzero_si128();
+	for(int i = 0; i < n; i += BPP) {
+		__m128i b = load_px<BPP>(prev + i);
+		a = _mm_add_epi8(load_px<BPP>(src + i), avg_floor(a, b));
+		store_px<BPP>(dst + i, a);
+	}
+}
+
+template <int BPP>
+[[gnu::target("sse2")]]
+void unfilter_paeth_sse2(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i a = zero, c = zero;
+	for(int i = 0; i < n; i += BPP) {
+		__m128i b = _mm_unpacklo_epi8(load_px<BPP>(prev + i), zero);
+
+		// p - a = b - c, p - b = a - c, p - c = (b - c) + (a - c)
+		__m128i pa = _mm_sub_epi16(b, c);
+		__m128i pb = _mm_sub_epi16(a, c);
+		__m128i pc = _mm_add_epi16(pa, pb);
+		pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+		pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+		pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+		__m128i pred = paeth_select(a, b, c, pa, pb, pc);
+		__m128i x = _mm_add_epi8(
+			load_px<BPP>(src + i),
+			_mm_packus_epi16(pred, pred)
+		);
+		store_px<BPP>(dst + i, x);
+
+		a = _mm_unpacklo_epi8(x, zero);
+		c = b;
+	}
+}
+
+// SSSE3: Sub becomes a log-step prefix sum over 16 bytes at a time, carrying
+// the last pixel of each block into the next with a byte shuffle.
+template <int BPP>
+[[gnu::target("ssse3")]]
+void unfilter_sub_ssse3(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	alignas(16) uint8_t last_pixel[16];
+	for(int i = 0; i < 16; i++)
+		last_pixel[i] = 16 - BPP + i % BPP;
+	__m128i shuffle = _mm_load_si128((__m128i const *)last_pixel);
+
+	__m128i carry = _mm_setzero_si128();
+	int i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((__m128i const *)(src + i));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, BPP));
+		if constexpr(2 * BPP < 16) x = _mm_add_epi8(x, _mm_slli_si128(x, 2 * BPP));
+		if constexpr(4 * BPP < 16) x = _mm_add_epi8(x, _mm_slli_si128(x, 4 * BPP));
+		if constexpr(8 * BPP < 16) x = _mm_add_epi8(x, _mm_slli_si128(x, 8 * BPP));
+		x = _mm_add_epi8(x, carry);
+		_mm_storeu_si128((__m128i *)(dst + i), x);
+		carry = _mm_shuffle_epi8(x, shuffle);
+	}
+	for(; i < n; i++)
+		dst[i] = src[i] + (i >= BPP ? dst[i - BPP] : 0);
+}
+
+template <int BPP>
+[[gnu::target("ssse3")]]
+void unfilter_paeth_ssse3(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i a = zero, c = zero;
+	for(int i = 0; i < n; i += BPP) {
+		__m128i b = _mm_unpacklo_epi8(load_px<BPP>(prev + i), zero);
+
+		__m128i pa = _mm_sub_epi16(b, c);
+		__m128i pb = _mm_sub_epi16(a, c);
+		__m128i pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+		pa = _mm_abs_epi16(pa);
+		pb = _mm_abs_epi16(pb);
+
+		__m128i pred = paeth_select(a, b, c, pa, pb, pc);
+		__m128i x = _mm_add_epi8(
+			load_px<BPP>(src + i),
+			_mm_packus_epi16(pred, pred)
+		);
+		store_px<BPP>(dst + i, x);
+
+		a = _mm_unpacklo_epi8(x, zero);
+		c = b;
+	}
+}
+
+// AVX2: only Up has no dependency along the row to limit its width
+[[gnu::target("avx2")]]
+void unfilter_up_avx2(
+	uint8_t * dst, uint8_t const * src, uint8_t const * prev, int n
+) {
+	int i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((__m256i const *)(src + i));
+		__m256i b = _mm256_loadu_si256((__m256i const *)(prev + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi8(x, b));
+	}
+	for(; i < n; i++)
+		dst[i] = src[i] + prev[i];
+}
+
+template <int BPP>
+void fill_sse2(unfilter_table_t & table) {
+	table[FILTER_TYPE_SUB][BPP] = unfilter_sub_sse2<BPP>;
+	table[FILTER_TYPE_UP][BPP] = unfilter_up_sse2;
+	table[FILTER_TYPE_AVG][BPP] = unfilter_avg_sse2<BPP>;
+	table[FILTER_TYPE_PAETH][BPP] = unfilter_paeth_sse2<BPP>;
+}
+
+template <int BPP>
+void fill_ssse3(unfilter_table_t & table) {
+	table[FILTER_TYPE_SUB][BPP] = unfilter_sub_ssse3<BPP>;
+	table[FILTER_TYPE_PAETH][BPP] = unfilter_paeth_ssse3<BPP>;
+}
+
+template <int BPP>
+void fill_avx2(unfilter_table_t & table) {
+	table[FILTER_TYPE_UP][BPP] = unfilter_up_avx2;
+}
+
+template <int... BPP>
+void fill(unfilter_table_t & table, simd_level_t level) {
+	if(level >= SIMD_SSE2) (fill_sse2<BPP>(table), ...);
+	if(level >= SIMD_SSSE3) (fill_ssse3<BPP>(table), ...);
+	if(level >= SIMD_AVX2) (fill_avx2<BPP>(table), ...);
+}
+
+}
+
+#endif
+
+// Builds the kernel table for an instruction set tier, which must be
+// supported by the running CPU
+unfilter_table_t unfilter_table(simd_level_t level) {
+	unfilter_table_t table{};
+	fill_scalar<1>(table);
+	fill_scalar<2>(table);
+	fill_scalar<3>(table);
+	fill_scalar<4>(table);
+	fill_scalar<6>(table);
+	fill_scalar<8>(table);
+#if defined(__x86_64__)
+	simd::fill<1, 2, 3, 4, 6, 8>(table, level);
+#endif
+	return table;
+}
+
+// The kernels for one pixel size, for the first and for subsequent rows of a
+// reduced image
+struct unfilter_set_t {
+	std::array<unfilter_fn_t, 5> rows;
+	std::array<unfilter_fn_t, 5> first_rows;
+};
+
+template <int STRIDE>
+unfilter_set_t unfilter_set(unfilter_table_t const & table) {
+	unfilter_set_t set;
+	for(int f = 0; f < 5; f++) set.rows[f] = table[f][STRIDE];
+
+	// against an all-zero previous row, Up is None and Paeth is Sub
+	set.first_rows = {
+		table[FILTER_TYPE_NONE][STRIDE],
+		table[FILTER_TYPE_SUB][STRIDE],
+		table[FILTER_TYPE_NONE][STRIDE],
+		unfilter_scalar<FILTER_TYPE_AVG, STRIDE, true>,
+		table[FILTER_TYPE_SUB][STRIDE]
+	};
+	return set;
+}
+
+// Kernel sets by bytes per pixel, for the best instruction set tier of the
+// running CPU
+unfilter_set_t const & unfilter_kernels(int stride) {
+	static std::array<unfilter_set_t, 9> const sets = [] {
+		unfilter_table_t table = unfilter_table(simd_level());
+		std::array<unfilter_set_t, 9> sets{};
+		sets[1] = unfilter_set<1>(table);
+		sets[2] = unfilter_set<2>(table);
+		sets[3] = unfilter_set<3>(table);
+		sets[4] = unfilter_set<4>(table);
+		sets[6] = unfilter_set<6>(table);
+		sets[8] = unfilter_set<8>(table);
+		return sets;
+	}();
+	return sets[stride];
+}
+
+}
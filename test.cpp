@@ -1,15 +1,31 @@
 #include <gtest/gtest.h>
 
 #include "load_test.h"
+#include "unfilter_test.h"
+#include "rowfilter_test.h"
+#include "batch_test.h"
+#include "thread_pool_test.h"
+#include "interlace_test.h"
+#include "save_test.h"
+#include "convert_test.h"
+#include "decoder_test.h"
+#include "probe_test.h"
+#include "stream_test.h"
+#include "inflate_test.h"
+#include "checksum_test.h"
+#include "metadata_test.h"
+#include "apng_test.h"
 
 void register_tests() {
 	using namespace std::filesystem;
+	std::vector<std::string> valid_files, all_files;
 	for(auto dentry : directory_iterator(path("./resources/pngsuite"))) {
 		if(!dentry.is_regular_file()) continue;
 		if(dentry.path().extension().string() != ".png") continue;
 
 		std::string filepath = dentry.path().string();
 		bool should_fail = dentry.path().filename().string().starts_with('x');
+		all_files.push_back(filepath);
 
 		testing::RegisterTest(
 			"ParseTest",
@@ -22,6 +38,7 @@ void register_tests() {
 		);
 
 		if(should_fail) continue;
+		valid_files.push_back(filepath);
 
 		testing::RegisterTest(
 			"DecodeTest",
@@ -32,6 +49,236 @@ void register_tests() {
 			__LINE__,
 			[=]() { return new rpng::DecodeTest(filepath); }
 		);
+
+		testing::RegisterTest(
+			"StreamTest",
+			path(filepath).filename().string().c_str(),
+			nullptr,
+			nullptr,
+			__FILE__,
+			__LINE__,
+			[=]() { return new rpng::StreamTest(filepath); }
+		);
+
+		testing::RegisterTest(
+			"ConvertTest",
+			path(filepath).filename().string().c_str(),
+			nullptr,
+			nullptr,
+			__FILE__,
+			__LINE__,
+			[=]() { return new rpng::ConvertTest(filepath); }
+		);
+
+		testing::RegisterTest(
+			"CorruptionTest",
+			path(filepath).filename().string().c_str(),
+			nullptr,
+			nullptr,
+			__FILE__,
+			__LINE__,
+			[=]() { return new rpng::CorruptionTest(filepath); }
+		);
+
+		testing::RegisterTest(
+			"MetadataTest",
+			path(filepath).filename().string().c_str(),
+			nullptr,
+			nullptr,
+			__FILE__,
+			__LINE__,
+			[=]() { return new rpng::MetadataTest(filepath); }
+		);
+	}
+
+	for(std::string const & filepath : valid_files) {
+		for(int effort : { 0, 1, 2 }) {
+			std::string name = fmt::format(
+				"{}/effort{}", path(filepath).filename().string(), effort
+			);
+			testing::RegisterTest(
+				"EncodeTest",
+				name.c_str(),
+				nullptr,
+				nullptr,
+				__FILE__,
+				__LINE__,
+				[=]() { return new rpng::EncodeTest(filepath, effort); }
+			);
+		}
+	}
+
+	for(int num_threads : { 1, 4 }) {
+		std::string name = fmt::format("pngsuite/threads{}", num_threads);
+		testing::RegisterTest(
+			"BatchTest",
+			name.c_str(),
+			nullptr,
+			nullptr,
+			__FILE__,
+			__LINE__,
+			[=]() { return new rpng::BatchTest(valid_files, num_threads); }
+		);
+	}
+
+	for(int num_threads : { 1, 2, 4 }) {
+		std::string name = fmt::format("threads{}", num_threads);
+		testing::RegisterTest(
+			"ThreadPoolTest",
+			name.c_str(),
+			nullptr,
+			nullptr,
+			__FILE__,
+			__LINE__,
+			[=]() { return new rpng::ThreadPoolTest(num_threads); }
+		);
+	}
+
+	testing::RegisterTest(
+		"ProbeTest",
+		"pngsuite",
+		nullptr,
+		nullptr,
+		__FILE__,
+		__LINE__,
+		[=]() { return new rpng::ProbeTest(all_files); }
+	);
+
+	for(rpng::pixel_format_t format : {
+		rpng::PIXEL_FORMAT_RAW, rpng::PIXEL_FORMAT_RGBA8
+	}) {
+		std::string name = fmt::format("pngsuite/format{}", (int)format);
+		testing::RegisterTest(
+			"DecoderTest",
+			name.c_str(),
+			nullptr,
+			nullptr,
+			__FILE__,
+			__LINE__,
+			[=]() {
+				return new rpng::DecoderTest(valid_files, { .format = format });
+			}
+		);
+	}
+
+	testing::RegisterTest(
+		"ChecksumTest",
+		"kernels",
+		nullptr,
+		nullptr,
+		__FILE__,
+		__LINE__,
+		[=]() { return new rpng::ChecksumTest(); }
+	);
+
+	testing::RegisterTest(
+		"AnimationTest",
+		"pngsuite",
+		nullptr,
+		nullptr,
+		__FILE__,
+		__LINE__,
+		[=]() { return new rpng::AnimationTest(valid_files); }
+	);
+
+	for(int level : { 0, 1, 6, 9 }) {
+		for(int strategy : { Z_DEFAULT_STRATEGY, Z_FIXED, Z_RLE }) {
+			std::string name = fmt::format(
+				"level{}/strategy{}", level, strategy
+			);
+			testing::RegisterTest(
+				"InflateTest",
+				name.c_str(),
+				nullptr,
+				nullptr,
+				__FILE__,
+				__LINE__,
+				[=]() { return new rpng::InflateTest(level, strategy); }
+			);
+		}
+	}
+
+	testing::RegisterTest(
+		"InflateTailTest",
+		"builtin",
+		nullptr,
+		nullptr,
+		__FILE__,
+		__LINE__,
+		[=]() { return new rpng::InflateTailTest(); }
+	);
+
+	testing::RegisterTest(
+		"HuffmanCodeTest",
+		"incomplete",
+		nullptr,
+		nullptr,
+		__FILE__,
+		__LINE__,
+		[=]() { return new rpng::HuffmanCodeTest(); }
+	);
+
+	for(int pass = 1; pass <= 7; pass++) {
+		for(int stride_bits : { 1, 2, 4 }) {
+			std::string name = fmt::format("pass{}/bits{}", pass, stride_bits);
+			testing::RegisterTest(
+				"DeinterlaceTest",
+				name.c_str(),
+				nullptr,
+				nullptr,
+				__FILE__,
+				__LINE__,
+				[=]() { return new rpng::DeinterlaceTest(pass, stride_bits); }
+			);
+		}
+	}
+
+	using namespace rpng;
+	for(int level = SIMD_SCALAR; level <= simd_level(); level++) {
+		std::string level_name = fmt::format("level{}", level);
+		testing::RegisterTest(
+			"BlendTest",
+			level_name.c_str(),
+			nullptr,
+			nullptr,
+			__FILE__,
+			__LINE__,
+			[=]() { return new BlendTest((simd_level_t)level); }
+		);
+
+		for(uint8_t filter = 0; filter < 5; filter++) {
+			for(int stride : { 1, 2, 3, 4, 6, 8 }) {
+				std::string name = fmt::format(
+					"level{}/filter{}/bpp{}", level, filter, stride
+				);
+				testing::RegisterTest(
+					"UnfilterTest",
+					name.c_str(),
+					nullptr,
+					nullptr,
+					__FILE__,
+					__LINE__,
+					[=]() {
+						return new UnfilterTest(
+							(simd_level_t)level, filter, stride
+						);
+					}
+				);
+				testing::RegisterTest(
+					"FilterTest",
+					name.c_str(),
+					nullptr,
+					nullptr,
+					__FILE__,
+					__LINE__,
+					[=]() {
+						return new FilterTest(
+							(simd_level_t)level, filter, stride
+						);
+					}
+				);
+			}
+		}
 	}
 }
 
@@ -0,0 +1,365 @@
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+#include "apng.h"
+#include "blend.h"
+#include "save.h"
+
+namespace rpng {
+
+// Compares a blend kernel with the scalar one, and the scalar one with
+// compositing in floating point, over rows whose alphas are mostly 0 or 255
+class BlendTest : public testing::Test {
+private:
+	simd_level_t level;
+
+public:
+	BlendTest(simd_level_t level) : level(level) {}
+
+	void TestBody() override {
+		std::mt19937 rng(level);
+		blend_fn_t blend = blend_kernel(level);
+
+		for(int width = 0; width <= 67; width++) {
+			std::vector<uint8_t> src(4 * width), dst(4 * width);
+			for(int i = 0; i < 4 * width; i++) {
+				src[i] = rng();
+				dst[i] = rng();
+				if(i % 4 == 3) {
+					uint8_t const alphas[] = { 0, 255, src[i] };
+					src[i] = alphas[rng() % 3];
+					dst[i] = alphas[rng() % 3];
+				}
+			}
+
+			std::vector<uint8_t> expected = dst, actual = dst;
+			blend_over(expected.data(), src.data(), width);
+			blend(actual.data(), src.data(), width);
+			EXPECT_EQ(actual, expected) << width;
+
+			for(int x = 0; x < width; x++) {
+				double sa = src[4 * x + 3] / 255.0, da = dst[4 * x + 3] / 255.0;
+				double oa = sa + da * (1 - sa);
+				EXPECT_NEAR(expected[4 * x + 3], oa * 255, 0.5) << width;
+				if(oa == 0) continue;
+				for(int c = 0; c < 3; c++) {
+					double value = (src[4 * x + c] * sa
+						+ dst[4 * x + c] * da * (1 - sa)) / oa;
+					EXPECT_NEAR(expected[4 * x + c], value, 1) << width;
+				}
+			}
+		}
+	}
+};
+
+// Builds animations with every dispose and blend op from encoded frames, and
+// checks each frame, rendered in order and out of order, against compositing
+// whole canvases frame by frame. Every valid PngSuite file, which lacks acTL,
+// must decode as a single frame, and a few, interlaced and not, are animated
+// with a frame blended over themselves.
+class AnimationTest : public testing::Test {
+private:
+	std::vector<std::string> filepaths;
+
+	struct frame_spec_t {
+		frame_control_t control;
+		std::vector<uint8_t> rgba;
+		std::vector<uint8_t> zlib;
+	};
+
+	static std::vector<uint8_t> idat_data(std::span<uint8_t const> png) {
+		reader_t reader{ png };
+		parse_png_header(reader);
+		std::vector<uint8_t> data;
+		while(!reader.eof()) {
+			chunk_t chunk = parse_chunk(reader);
+			if(chunk.type == CHUNK_TYPE_IDAT)
+				data.insert(data.end(), chunk.data.begin(), chunk.data.end());
+		}
+		return data;
+	}
+
+	static void put32(std::vector<uint8_t> & out, uint32_t value) {
+		value = htonl(value);
+		out.insert(out.end(), (uint8_t *)&value, (uint8_t *)&value + 4);
+	}
+
+	// Writes the fcTL with the next sequence number
+	static void write_fctl(
+		std::vector<uint8_t> & out, frame_control_t const & control,
+		uint32_t & sequence
+	) {
+		std::vector<uint8_t> data;
+		put32(data, sequence++);
+		put32(data, control.width);
+		put32(data, control.height);
+		put32(data, control.x_offset);
+		put32(data, control.y_offset);
+		data.push_back(control.delay_num >> 8);
+		data.push_back(control.delay_num);
+		data.push_back(control.delay_den >> 8);
+		data.push_back(control.delay_den);
+		data.push_back(control.dispose_op);
+		data.push_back(control.blend_op);
+		write_chunk(out, CHUNK_TYPE_FCTL, data);
+	}
+
+	// `base` with acTL, and every frame as fcTL and two fdAT chunks, except
+	// that the first frame is the default image of `base` if `default_frame`
+	static std::vector<uint8_t> assemble(
+		std::span<uint8_t const> base,
+		std::vector<frame_spec_t> const & frames,
+		bool default_frame
+	) {
+		reader_t reader{ base };
+		parse_png_header(reader);
+		size_t first_idat = 0;
+		while(!reader.eof() && !first_idat) {
+			size_t begin = reader.pos;
+			if(parse_chunk(reader).type == CHUNK_TYPE_IDAT) first_idat = begin;
+		}
+
+		std::vector<uint8_t> out(base.begin(), base.begin() + first_idat);
+		std::vector<uint8_t> actl;
+		put32(actl, frames.size());
+		put32(actl, 3);
+		write_chunk(out, CHUNK_TYPE_ACTL, actl);
+
+		uint32_t sequence = 0;
+		if(default_frame) write_fctl(out, frames[0].control, sequence);
+		write_chunk(out, CHUNK_TYPE_IDAT, idat_data(base));
+
+		for(size_t i = default_frame ? 1 : 0; i < frames.size(); i++) {
+			write_fctl(out, frames[i].control, sequence);
+			std::span<uint8_t const> zlib(frames[i].zlib);
+			size_t half = zlib.size() / 2;
+			for(auto part : { zlib.first(half), zlib.subspan(half) }) {
+				std::vector<uint8_t> fdat;
+				put32(fdat, sequence++);
+				fdat.insert(fdat.end(), part.begin(), part.end());
+				write_chunk(out, CHUNK_TYPE_FDAT, fdat);
+			}
+		}
+		write_chunk(out, CHUNK_TYPE_IEND, {});
+		return out;
+	}
+
+	// Every frame, compositing onto whole canvases as the APNG specification
+	// describes
+	static std::vector<std::vector<uint8_t>> composite(
+		uint32_t width, uint32_t height,
+		std::vector<frame_spec_t> const & frames
+	) {
+		std::vector<std::vector<uint8_t>> rendered;
+		std::vector<uint8_t> canvas(4 * width * height, 0), before;
+		for(size_t i = 0; i < frames.size(); i++) {
+			if(i > 0) {
+				frame_control_t const & previous = frames[i - 1].control;
+				for(uint32_t y = 0; y < previous.height; y++) {
+					for(uint32_t x = 0; x < previous.width; x++) {
+						size_t p = 4 * ((y + previous.y_offset) * width
+							+ x + previous.x_offset);
+						for(int c = 0; c < 4; c++) {
+							if(previous.dispose_op == DISPOSE_OP_BACKGROUND)
+								canvas[p + c] = 0;
+							if(previous.dispose_op == DISPOSE_OP_PREVIOUS)
+								canvas[p + c] = before[p + c];
+						}
+					}
+				}
+			}
+			before = canvas;
+
+			frame_control_t const & control = frames[i].control;
+			for(uint32_t y = 0; y < control.height; y++) {
+				for(uint32_t x = 0; x < control.width; x++) {
+					size_t p = 4 * ((y + control.y_offset) * width
+						+ x + control.x_offset);
+					uint8_t const * src = &frames[i].rgba[4 * (y * control.width + x)];
+					if(control.blend_op == BLEND_OP_SOURCE)
+						memcpy(&canvas[p], src, 4);
+					else
+						blend_pixel(&canvas[p], src);
+				}
+			}
+			rendered.push_back(canvas);
+		}
+		return rendered;
+	}
+
+	static frame_spec_t random_frame(
+		std::mt19937 & rng, frame_control_t const & control
+	) {
+		frame_spec_t frame{ control };
+		frame.rgba.resize(4 * control.width * control.height);
+		for(size_t i = 0; i < frame.rgba.size(); i++) {
+			frame.rgba[i] = rng();
+			if(i % 4 == 3 && rng() % 3) frame.rgba[i] = rng() % 2 ? 255 : 0;
+		}
+		chunk_ihdr_data_t ihdr{
+			control.width, control.height, 8, COLOUR_TYPE_TRUECOLOUR_ALPHA,
+			0, 0, 0
+		};
+		frame.zlib = idat_data(save(frame.rgba, ihdr));
+		return frame;
+	}
+
+	void test_synthetic() {
+		constexpr uint32_t W = 24, H = 20;
+		std::mt19937 rng(25);
+
+		std::vector<frame_spec_t> frames;
+		frames.push_back(random_frame(rng, {
+			0, W, H, 0, 0, 1, 10, DISPOSE_OP_PREVIOUS, BLEND_OP_SOURCE
+		}));
+		for(int i = 1; i < 12; i++) {
+			frame_control_t control{};
+			control.width = 1 + rng() % W;
+			control.height = 1 + rng() % H;
+			control.x_offset = rng() % (W - control.width + 1);
+			control.y_offset = rng() % (H - control.height + 1);
+			control.delay_num = i;
+			control.dispose_op = i % 3;
+			control.blend_op = i / 3 % 2;
+			if(i == 6) {
+				control = { 0, W, H, 0, 0, 5, 0,
+					DISPOSE_OP_NONE, BLEND_OP_SOURCE };
+			}
+			frames.push_back(random_frame(rng, control));
+		}
+		std::vector<std::vector<uint8_t>> expected = composite(W, H, frames);
+
+		std::vector<uint8_t> base = save(frames[0].rgba, {
+			W, H, 8, COLOUR_TYPE_TRUECOLOUR_ALPHA, 0, 0, 0
+		});
+		std::vector<uint8_t> apng = assemble(base, frames, true);
+
+		animation_decoder_t decoder(apng);
+		ASSERT_EQ(decoder.num_frames(), frames.size());
+		EXPECT_EQ(decoder.num_plays(), 3u);
+		EXPECT_EQ(decoder.frame_control(1).delay(), 0.01);
+		EXPECT_EQ(decoder.frame_control(0).delay(), 0.1);
+
+		uint32_t count = 0;
+		for(animation_frame_t frame : decoder) {
+			EXPECT_EQ(frame.index, count);
+			EXPECT_EQ(frame.control.delay_num, frames[count].control.delay_num);
+			EXPECT_TRUE(std::ranges::equal(frame.canvas, expected[frame.index]))
+				<< "frame " << frame.index;
+			count++;
+		}
+		EXPECT_EQ(count, frames.size());
+
+		for(uint32_t n : { 9u, 3u, 3u, 11u, 0u, 7u, 5u, 6u, 2u, 10u }) {
+			EXPECT_TRUE(std::ranges::equal(decoder.frame(n), expected[n]))
+				<< "frame " << n << " out of order";
+		}
+		EXPECT_ANY_THROW(decoder.frame(frames.size()));
+
+		animation_decoder_t bgra(apng, { .format = PIXEL_FORMAT_BGRA8 });
+		std::vector<uint8_t> swapped = expected.back();
+		for(size_t i = 0; i < swapped.size(); i += 4)
+			std::swap(swapped[i], swapped[i + 2]);
+		EXPECT_TRUE(std::ranges::equal(bgra.frame(frames.size() - 1), swapped))
+			<< "BGRA8";
+
+		// a default image that is not part of the animation
+		std::vector<uint8_t> hidden = assemble(
+			save(random_frame(rng, frames[0].control).rgba, {
+				W, H, 8, COLOUR_TYPE_TRUECOLOUR_ALPHA, 0, 0, 0
+			}),
+			frames, false
+		);
+		animation_decoder_t hidden_decoder(hidden);
+		ASSERT_EQ(hidden_decoder.num_frames(), frames.size());
+		for(uint32_t n = 0; n < frames.size(); n++) {
+			EXPECT_TRUE(std::ranges::equal(hidden_decoder.frame(n), expected[n]))
+				<< "frame " << n << " after the default image";
+		}
+		EXPECT_EQ(load(std::span<uint8_t const>(hidden)), load(
+			std::span<uint8_t const>(hidden), { .verify_checksums = false }
+		));
+
+		animation_decoder_t still(base);
+		ASSERT_EQ(still.num_frames(), 1u);
+		EXPECT_TRUE(std::ranges::equal(still.frame(0), frames[0].rgba));
+
+		// a frame too few for acTL
+		std::vector<frame_spec_t> fewer(frames.begin(), frames.end() - 1);
+		std::vector<uint8_t> short_apng = assemble(base, fewer, true);
+		reader_t reader{ short_apng };
+		parse_png_header(reader);
+		parse_ihdr(reader);
+		chunk_t actl = parse_chunk(reader);
+		std::vector<uint8_t> more = short_apng;
+		more[actl.offset + 3]++;
+		uint32_t crc = htonl(chunk_crc(
+			actl.type, std::span(more).subspan(actl.offset, actl.length)
+		));
+		memcpy(&more[actl.offset + actl.length], &crc, 4);
+		EXPECT_ANY_THROW(animation_decoder_t{ more });
+
+		// a corrupt frame only fails when it is rendered
+		std::vector<uint8_t> corrupt = apng;
+		size_t last_fdat = 0;
+		reader = { corrupt };
+		parse_png_header(reader);
+		while(!reader.eof()) {
+			chunk_t chunk = parse_chunk(reader);
+			if(chunk.type == CHUNK_TYPE_FDAT) last_fdat = chunk.offset;
+		}
+		corrupt[last_fdat + 3] ^= 1;		// its sequence number
+		animation_decoder_t corrupt_decoder(corrupt);
+		EXPECT_TRUE(std::ranges::equal(corrupt_decoder.frame(1), expected[1]));
+		EXPECT_ANY_THROW(corrupt_decoder.frame(frames.size() - 1));
+		animation_decoder_t unchecked(corrupt, { .verify_checksums = false });
+		EXPECT_ANY_THROW(unchecked.frame(frames.size() - 1));
+		EXPECT_TRUE(std::ranges::equal(unchecked.frame(5), expected[5]));
+	}
+
+public:
+	AnimationTest(std::vector<std::string> const & filepaths)
+		: filepaths(filepaths) {}
+
+	void TestBody() override {
+		test_synthetic();
+
+		for(std::string const & filepath : filepaths) {
+			mapped_file_t file(filepath);
+			std::span<uint8_t const> png = file.span();
+			std::vector<uint8_t> rgba = load(png, { .format = PIXEL_FORMAT_RGBA8 });
+
+			animation_decoder_t decoder(png);
+			ASSERT_EQ(decoder.num_frames(), 1u) << filepath;
+			EXPECT_TRUE(std::ranges::equal(decoder.frame(0), rgba)) << filepath;
+
+			// the image again, blended over itself
+			chunk_ihdr_data_t const & ihdr = decoder.ihdr();
+			frame_control_t whole{
+				0, ihdr.width, ihdr.height, 0, 0, 0, 0,
+				DISPOSE_OP_NONE, BLEND_OP_SOURCE
+			};
+			frame_control_t over = whole;
+			over.blend_op = BLEND_OP_OVER;
+			std::vector<frame_spec_t> frames{
+				{ whole, rgba, idat_data(png) }, { over, rgba, idat_data(png) }
+			};
+			std::vector<uint8_t> apng = assemble(png, frames, true);
+			animation_decoder_t animated(apng);
+			std::vector<std::vector<uint8_t>> expected = composite(
+				ihdr.width, ihdr.height, frames
+			);
+			for(uint32_t n : { 1u, 0u }) {
+				EXPECT_TRUE(std::ranges::equal(animated.frame(n), expected[n]))
+					<< filepath << ", frame " << n;
+			}
+		}
+	}
+};
+
+}
@@ -0,0 +1,66 @@
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "batch.h"
+#include "libpng.h"
+
+namespace rpng {
+
+// Decodes a set of files concurrently, through both the future and the
+// completion callback interfaces, and compares every image with libpng
+class BatchTest : public testing::Test {
+private:
+	std::vector<std::string> filepaths;
+	int num_threads;
+
+public:
+	BatchTest(std::vector<std::string> const & filepaths, int num_threads)
+		: filepaths(filepaths), num_threads(num_threads) {}
+
+	void TestBody() override {
+		batch_decoder_t batch(num_threads);
+
+		auto images = batch.load_all(filepaths);
+		for(size_t i = 0; i < filepaths.size(); i++) {
+			EXPECT_EQ(images[i].get(), decode(filepaths[i])) << filepaths[i];
+		}
+
+		std::vector<std::vector<uint8_t>> results(filepaths.size());
+		batch.load_all(filepaths, [&](
+			size_t i, std::vector<uint8_t> image, std::exception_ptr error
+		) {
+			EXPECT_FALSE(error) << filepaths[i];
+			results[i] = std::move(image);
+		});
+		for(size_t i = 0; i < filepaths.size(); i++) {
+			EXPECT_EQ(results[i], decode(filepaths[i])) << filepaths[i];
+		}
+
+		// waiting for the probes, this thread runs the loads still queued
+		images = batch.load_all(filepaths);
+		std::vector<probe_result_t> probes = batch.probe_all(filepaths);
+		EXPECT_EQ(probes.size(), filepaths.size());
+		for(size_t i = 0; i < filepaths.size(); i++) {
+			EXPECT_EQ(images[i].get(), decode(filepaths[i])) << filepaths[i];
+		}
+
+		// a callback may wait on further loads without stalling its worker
+		std::atomic<size_t> nested = 0;
+		batch.load_all(std::vector{ filepaths[0] }, [&](
+			size_t, std::vector<uint8_t>, std::exception_ptr
+		) {
+			batch.load_all(filepaths, [&](
+				size_t, std::vector<uint8_t>, std::exception_ptr error
+			) {
+				EXPECT_FALSE(error);
+				nested++;
+			});
+		});
+		EXPECT_EQ(nested, filepaths.size());
+	}
+};
+
+}
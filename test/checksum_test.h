@@ -0,0 +1,140 @@
+#include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include "checksum.h"
+#include "load.h"
+#include "stream.h"
+
+namespace rpng {
+
+// Compares every CRC-32 and Adler-32 kernel the CPU has with zlib, over
+// lengths around the kernels' block sizes, at unaligned offsets, and with the
+// data split across two updates
+class ChecksumTest : public testing::Test {
+public:
+	void TestBody() override {
+		std::mt19937 rng(5);
+		std::vector<uint8_t> data(1 << 16);
+		for(uint8_t & byte : data) byte = rng();
+		std::vector<uint8_t> saturated(1 << 16, 0xff);
+
+		std::vector<size_t> sizes;
+		for(size_t n = 0; n <= 260; n++) sizes.push_back(n);
+		for(size_t n : { 5551, 5552, 5553, 11104, 60000 }) sizes.push_back(n);
+
+		for(size_t size : sizes) {
+			for(size_t offset : { 0, 1, 3 }) {
+				uint8_t const * p = data.data() + offset;
+				uint32_t crc = crc32_z(0, p, size);
+				uint32_t adler = adler32_z(1, p, size);
+
+				EXPECT_EQ(update_crc32(0, p, size), crc) << size;
+				EXPECT_EQ(~crc32_slice16(~0u, p, size), crc) << size;
+				EXPECT_EQ(update_adler32(1, p, size), adler) << size;
+
+				size_t split = size / 3;
+				EXPECT_EQ(
+					update_crc32(
+						update_crc32(0, p, split), p + split, size - split
+					),
+					crc
+				) << size << " split";
+				EXPECT_EQ(
+					update_adler32(
+						update_adler32(1, p, split), p + split, size - split
+					),
+					adler
+				) << size << " split";
+
+#if defined(__x86_64__)
+				size_t folded = size & ~(size_t)15;
+				if(cpu_features().pclmul && folded >= 64) {
+					uint32_t partial = ~simd::crc32_pclmul(~0u, p, folded);
+					EXPECT_EQ(partial, crc32_z(0, p, folded)) << size;
+				}
+				if(cpu_features().ssse3) {
+					EXPECT_EQ(simd::adler32_ssse3(1, p, size), adler) << size;
+				}
+#endif
+			}
+
+			// the sums at their largest between reductions
+			EXPECT_EQ(
+				update_adler32(1, saturated.data(), size),
+				adler32_z(1, saturated.data(), size)
+			) << size << " of 0xff";
+		}
+	}
+};
+
+// Corrupts a chunk's CRC, and separately the datastream's Adler-32 (with the
+// chunk's CRC fixed up), and checks that every backend rejects each unless
+// checksums are skipped, when the image decodes as before
+class CorruptionTest : public testing::Test {
+private:
+	std::string filepath;
+
+public:
+	CorruptionTest(std::string const & filepath) : filepath(filepath) {}
+
+	void TestBody() override {
+		std::ifstream ifs(filepath, std::ios::binary);
+		std::vector<uint8_t> png(
+			(std::istreambuf_iterator<char>(ifs)),
+			std::istreambuf_iterator<char>()
+		);
+		std::vector<uint8_t> expected = load(std::span<uint8_t const>(png));
+
+		// the last IDAT chunk, whose data ends with the Adler-32
+		reader_t reader{ png };
+		parse_png_header(reader);
+		chunk_t last{};
+		while(!reader.eof()) {
+			chunk_t chunk = parse_chunk(reader);
+			if(chunk.type == CHUNK_TYPE_IDAT) last = chunk;
+		}
+		size_t crc_offset = last.offset + last.length;
+
+		std::vector<uint8_t> bad_crc = png;
+		bad_crc[crc_offset] ^= 1;
+
+		std::vector<uint8_t> bad_adler = png;
+		bad_adler[crc_offset - 1] ^= 1;
+		uint32_t crc = htonl(chunk_crc(
+			last.type,
+			std::span(bad_adler).subspan(last.offset, last.length)
+		));
+		memcpy(&bad_adler[crc_offset], &crc, 4);
+
+		for(inflate_backend_t backend : {
+			INFLATE_BACKEND_ZLIB, INFLATE_BACKEND_LIBDEFLATE,
+			INFLATE_BACKEND_BUILTIN
+		}) {
+			if(!inflate_backend_available(backend)) continue;
+			std::string name = inflate_backend_name(backend);
+			for(auto const & corrupt : { bad_crc, bad_adler }) {
+				std::span<uint8_t const> buf(corrupt);
+				EXPECT_ANY_THROW(load(buf, { .inflate = backend })) << name;
+				EXPECT_EQ(load(buf, {
+					.inflate = backend, .verify_checksums = false
+				}), expected) << name << ", unchecked";
+			}
+		}
+
+		stream_decoder_t decoder([](
+			reduced_image_t const &, int, std::span<uint8_t const>
+		) {});
+		EXPECT_ANY_THROW({
+			decoder.feed(bad_crc);
+			decoder.finish();
+		}) << "streamed";
+	}
+};
+
+}
@@ -0,0 +1,78 @@
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "load.h"
+#include "save.h"
+#include "libpng.h"
+
+namespace rpng {
+
+// Decodes to every pixel format along each decode route, against libpng's
+// RGBA expansion and formats derived from it
+class ConvertTest : public testing::Test {
+private:
+	std::string filepath;
+
+public:
+	ConvertTest(std::string const & filepath) : filepath(filepath) {}
+
+	void TestBody() override {
+		std::vector<uint8_t> rgba8 = decode(filepath, 8);
+		std::vector<uint8_t> rgba16 = decode(filepath, 16);
+
+		std::vector<uint8_t> rgb8, gray8, bgra8;
+		for(size_t i = 0; i < rgba8.size(); i += 4) {
+			uint8_t const * p = &rgba8[i];
+			rgb8.insert(rgb8.end(), { p[0], p[1], p[2] });
+			gray8.push_back(luma(p[0], p[1], p[2]));
+			bgra8.insert(bgra8.end(), { p[2], p[1], p[0], p[3] });
+		}
+
+		std::pair<pixel_format_t, std::vector<uint8_t> const &> expected[] = {
+			{ PIXEL_FORMAT_RGBA8, rgba8 },
+			{ PIXEL_FORMAT_RGB8, rgb8 },
+			{ PIXEL_FORMAT_GRAY8, gray8 },
+			{ PIXEL_FORMAT_RGBA16, rgba16 },
+			{ PIXEL_FORMAT_BGRA8, bgra8 }
+		};
+
+		static thread_pool_t pool(4);
+		for(auto const & [format, pixels] : expected) {
+			EXPECT_EQ(load(filepath, { .format = format }), pixels)
+				<< "format " << format;
+
+			decode_options_t parallel{
+				.format = format, .pool = &pool, .parallel_threshold = 0
+			};
+			EXPECT_EQ(load(filepath, parallel), pixels)
+				<< "format " << format << ", parallel";
+
+			decode_options_t pipelined{
+				.format = format, .pipeline = true, .parallel_threshold = 0
+			};
+			EXPECT_EQ(load(filepath, pipelined), pixels)
+				<< "format " << format << ", pipelined";
+		}
+
+		// the RGBA8 image re-encoded with a segment index, decoded in bands
+		mapped_file_t file(filepath);
+		reader_t reader{ file.span() };
+		parse_png_header(reader);
+		chunk_ihdr_data_t ihdr = parse_ihdr(reader).first;
+		ihdr.bit_depth = 8;
+		ihdr.colour_type = COLOUR_TYPE_TRUECOLOUR_ALPHA;
+		ihdr.interlace = 0;
+
+		std::vector<uint8_t> png = save(rgba8, ihdr, {
+			.pool = &pool, .band_size = 64, .segment_index = true
+		});
+		decode_options_t segmented{
+			.format = PIXEL_FORMAT_BGRA8, .pool = &pool, .parallel_threshold = 0
+		};
+		EXPECT_EQ(load(png, segmented), bgra8) << "segmented";
+	}
+};
+
+}
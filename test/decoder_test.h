@@ -0,0 +1,53 @@
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "decoder.h"
+#include "libpng.h"
+
+namespace rpng {
+
+// Runs one decoder over a set of files, forwards and then backwards so that
+// its buffers both grow and shrink, and compares every image with libpng.
+// A failed decode must not spoil the next one.
+class DecoderTest : public testing::Test {
+private:
+	std::vector<std::string> filepaths;
+	decode_options_t options;
+
+public:
+	DecoderTest(
+		std::vector<std::string> const & filepaths,
+		decode_options_t const & options
+	) : filepaths(filepaths), options(options) {}
+
+	void TestBody() override {
+		decoder_t decoder(options);
+		int depth = options.format == PIXEL_FORMAT_RGBA8 ? 8 : 0;
+
+		std::vector<std::string> order(filepaths);
+		order.insert(order.end(), filepaths.rbegin(), filepaths.rend());
+		for(std::string const & filepath : order) {
+			std::span<uint8_t const> image = decoder.decode(filepath);
+			EXPECT_EQ(
+				std::vector<uint8_t>(image.begin(), image.end()),
+				decode(filepath, depth)
+			) << filepath;
+			EXPECT_EQ(image.size(), decoder.ihdr().height * decoder.row_size());
+
+			// cut off part way through the first IDAT chunk
+			mapped_file_t file(filepath);
+			reader_t reader{ file.span() };
+			parse_png_header(reader);
+			chunk_t chunk{};
+			while(chunk.type != CHUNK_TYPE_IDAT) chunk = parse_chunk(reader);
+			std::span<uint8_t const> truncated = file.span().first(
+				chunk.offset + chunk.length / 2
+			);
+			EXPECT_ANY_THROW(decoder.decode(truncated)) << filepath;
+		}
+	}
+};
+
+}
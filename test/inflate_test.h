@@ -0,0 +1,287 @@
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "inflate.h"
+#include "deflate.h"
+#include "inflate_backend.h"
+
+namespace rpng {
+
+// Data like filtered scanlines: runs of zeros, short repeating patterns at
+// pixel-sized periods, and noise that compresses poorly
+std::vector<uint8_t> inflate_test_data() {
+	std::mt19937 rng(7);
+	std::vector<uint8_t> data;
+	while(data.size() < 200000) {
+		size_t n = rng() % 5000;
+		switch(rng() % 4) {
+		case 0:
+			data.insert(data.end(), n, 0);
+			break;
+		case 1: {
+			size_t period = 1 + rng() % 16;
+			for(size_t i = 0; i < n; i++)
+				data.push_back(i < period ? rng() : data[data.size() - period]);
+			break;
+		}
+		case 2:
+			for(size_t i = 0; i < n; i++) data.push_back(rng() % 8);
+			break;
+		default:
+			for(size_t i = 0; i < n; i++) data.push_back(rng());
+		}
+	}
+	return data;
+}
+
+// Inflates zlib streams with the built-in decoder, fed in pieces of various
+// sizes, and compares the result with the original data. The stream is
+// deflated with the given level and strategy, and flushed part way through to
+// add an empty stored block.
+class InflateTest : public testing::Test {
+private:
+	int level;
+	int strategy;
+
+public:
+	InflateTest(int level, int strategy)
+		: level(level), strategy(strategy) {}
+
+	void TestBody() override {
+		std::vector<uint8_t> data = inflate_test_data();
+		std::span<uint8_t const> all(data);
+		size_t half = data.size() / 2;
+
+		deflater_t deflater(level, strategy);
+		std::vector<uint8_t> compressed;
+		deflate_append(deflater, all.first(half), compressed, Z_FULL_FLUSH);
+		deflate_append(deflater, all.subspan(half), compressed, Z_FINISH);
+
+		inflater_t inflater;
+		inflater.use_builtin(true);
+		size_t const pieces[] = { 1, 13, 4096, compressed.size() };
+		for(size_t piece : pieces) {
+			for(size_t out_piece : { (size_t)1000, data.size() }) {
+				if(piece == 1 && out_piece != data.size()) continue;
+
+				std::vector<uint8_t> out(data.size());
+				std::span<uint8_t> window(out.data(), 0);
+				size_t produced = 0;
+				inflater.reset();
+				for(size_t i = 0; i < compressed.size(); i += piece) {
+					std::span<uint8_t const> in = std::span(compressed)
+						.subspan(i, std::min(piece, compressed.size() - i));
+					while(true) {
+						window = std::span(out).subspan(
+							produced, std::min(out_piece, out.size() - produced)
+						);
+						size_t avail_in = in.size(), avail_out = window.size();
+						inflater.inflate(in, window);
+						produced += avail_out - window.size();
+						bool progress = in.size() != avail_in
+							|| window.size() != avail_out;
+						if(!progress || inflater.finished()) break;
+					}
+				}
+				EXPECT_TRUE(inflater.finished())
+					<< piece << " byte pieces, " << out_piece << " out";
+				EXPECT_EQ(inflater.total_out(), data.size());
+				EXPECT_TRUE(out == data)
+					<< piece << " byte pieces, " << out_piece << " out";
+			}
+		}
+
+		std::vector<uint8_t> out(data.size());
+		inflater.builtin_decoder().inflate_whole(compressed, out);
+		EXPECT_TRUE(out == data) << "whole";
+
+		// a stream longer or shorter than its output is rejected
+		std::vector<uint8_t> longer(data.size() - 1);
+		EXPECT_ANY_THROW(
+			inflater.builtin_decoder().inflate_whole(compressed, longer)
+		);
+		std::vector<uint8_t> shorter(data.size() + 1);
+		EXPECT_ANY_THROW(
+			inflater.builtin_decoder().inflate_whole(compressed, shorter)
+		);
+
+		// as is one whose checksum does not match
+		compressed.back() ^= 1;
+		EXPECT_ANY_THROW(
+			inflater.builtin_decoder().inflate_whole(compressed, out)
+		);
+		std::span<uint8_t const> in(compressed);
+		std::span<uint8_t> window(out);
+		inflater.reset();
+		EXPECT_ANY_THROW(inflater.inflate(in, window));
+	}
+};
+
+// Ends a stream with a block that starts with a match just short of the end
+// of the output, where there is no room for wide copies, and inflates it into
+// a buffer of exactly its size, with guard bytes after it, whole and
+// streamed
+class InflateTailTest : public testing::Test {
+public:
+	void TestBody() override {
+		std::mt19937 rng(22);
+		for(size_t tail : { 1, 3, 15, 16, 17, 100, 257, 258, 259, 273, 289, 290 }) {
+			std::vector<uint8_t> data(10000);
+			for(uint8_t & byte : data) byte = rng() % 4;
+			size_t head = data.size() - tail;
+			for(size_t i = 0; i < tail; i++) data[head + i] = data[i % 300];
+
+			std::span<uint8_t const> all(data);
+			deflater_t deflater(9, Z_DEFAULT_STRATEGY);
+			std::vector<uint8_t> compressed;
+			deflate_append(deflater, all.first(head), compressed, Z_SYNC_FLUSH);
+			deflate_append(deflater, all.subspan(head), compressed, Z_FINISH);
+
+			constexpr size_t guard = 64;
+			std::vector<uint8_t> out(data.size() + guard, 0xaa);
+			std::span<uint8_t> exact = std::span(out).first(data.size());
+
+			inflater_t inflater;
+			inflater.use_builtin(true);
+			inflater.builtin_decoder().inflate_whole(compressed, exact);
+			EXPECT_TRUE(std::ranges::equal(exact, data)) << tail << ", whole";
+			EXPECT_EQ(
+				std::count(out.begin() + data.size(), out.end(), 0xaa), guard
+			) << tail << ", whole";
+
+			std::fill(out.begin(), out.end(), 0xaa);
+			inflater.reset();
+			std::span<uint8_t> window = exact;
+			inflate_into(inflater, compressed, window);
+			inflate_finish(inflater, window);
+			EXPECT_TRUE(std::ranges::equal(exact, data)) << tail << ", streamed";
+			EXPECT_EQ(
+				std::count(out.begin() + data.size(), out.end(), 0xaa), guard
+			) << tail << ", streamed";
+
+			// a match running past the end of the output is rejected
+			EXPECT_ANY_THROW(inflater.builtin_decoder().inflate_whole(
+				compressed, exact.first(data.size() - 1)
+			)) << tail;
+		}
+	}
+};
+
+// Inflates the stream "A" coded in one dynamic block whose distance code,
+// unused by the data, is incomplete, and checks that every backend agrees on
+// rejecting it, as zlib does, unless it is a single code of length 1
+class HuffmanCodeTest : public testing::Test {
+private:
+	struct bit_writer_t {
+		std::vector<uint8_t> bytes;
+		int used = 8;
+
+		// `n` bits of `value`, least significant first
+		void put(uint32_t value, int n) {
+			for(int i = 0; i < n; i++, used++) {
+				if(used == 8) {
+					bytes.push_back(0);
+					used = 0;
+				}
+				bytes.back() |= (value >> i & 1) << used;
+			}
+		}
+
+		// a Huffman code, most significant bit first
+		void put_code(uint32_t code, int n) {
+			for(int i = n - 1; i >= 0; i--) put(code >> i & 1, 1);
+		}
+	};
+
+	static std::vector<uint8_t> stream(std::array<uint8_t, 2> distances) {
+		bit_writer_t out;
+		out.put(0x78, 8);
+		out.put(0x01, 8);
+		out.put(1, 1);			// BFINAL
+		out.put(2, 2);			// dynamic codes
+		out.put(0, 5);			// 257 literal/length codes
+		out.put(1, 5);			// 2 distance codes
+		out.put(14, 4);			// 18 code length codes
+
+		// 0, 1, 2 and 18 with 2-bit codes, in the order they are sent
+		uint8_t const order[18] = {
+			16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1
+		};
+		for(uint8_t symbol : order) {
+			bool coded = symbol <= 2 || symbol == 18;
+			out.put(coded ? 2 : 0, 3);
+		}
+		auto length = [&](int symbol) {
+			out.put_code(symbol == 18 ? 3 : symbol, 2);
+		};
+		auto zeros = [&](int n) {
+			length(18);
+			out.put(n - 11, 7);
+		};
+
+		// 'A' and end of block take 1 bit each
+		zeros(65);
+		length(1);
+		zeros(138);
+		zeros(52);
+		length(1);
+		for(uint8_t distance : distances) length(distance);
+
+		out.put_code(0, 1);		// 'A'
+		out.put_code(1, 1);		// end of block
+		out.used = 8;
+		for(uint8_t byte : { 0x00, 0x42, 0x00, 0x42 }) out.put(byte, 8);
+		return out.bytes;
+	}
+
+public:
+	void TestBody() override {
+		// complete, a single code, no codes, and incomplete codes
+		std::pair<std::array<uint8_t, 2>, bool> const cases[] = {
+			{ { 1, 1 }, true }, { { 1, 0 }, true }, { { 0, 0 }, true },
+			{ { 1, 2 }, false }, { { 2, 0 }, false }, { { 2, 2 }, false }
+		};
+		for(auto [distances, valid] : cases) {
+			std::vector<uint8_t> in = stream(distances);
+			std::string what = fmt::format(
+				"distance lengths {}, {}", distances[0], distances[1]
+			);
+
+			std::vector<uint8_t> out(1);
+			auto expect = [&](auto && inflate, char const * backend) {
+				out[0] = 0;
+				if(valid) {
+					EXPECT_NO_THROW(inflate()) << what << ", " << backend;
+					EXPECT_EQ(out[0], 'A') << what << ", " << backend;
+				} else {
+					EXPECT_ANY_THROW(inflate()) << what << ", " << backend;
+				}
+			};
+
+			expect([&] { inflate_exact(std::array{ std::span(in) }, out); },
+				"zlib");
+			inflater_t inflater;
+			inflater.use_builtin(true);
+			expect([&] {
+				inflater.builtin_decoder().inflate_whole(in, out);
+			}, "builtin");
+			expect([&] {
+				inflater.reset();
+				std::span<uint8_t> window(out);
+				inflate_into(inflater, in, window);
+				inflate_finish(inflater, window);
+			}, "builtin, streamed");
+			if(inflate_backend_available(INFLATE_BACKEND_LIBDEFLATE)) {
+				libdeflate_inflater_t libdeflate;
+				expect([&] { libdeflate.inflate(in, out); }, "libdeflate");
+			}
+		}
+	}
+};
+
+}
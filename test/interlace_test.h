@@ -0,0 +1,61 @@
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "interlace.h"
+#include "utils.h"
+
+namespace rpng {
+
+// Scatters random sub-byte pass rows of every width up to a few bytes into a
+// random final row, and compares against copying one sample at a time
+class DeinterlaceTest : public testing::Test {
+private:
+	int pass_index;
+	int stride_bits;
+
+public:
+	DeinterlaceTest(int pass_index, int stride_bits)
+		: pass_index(pass_index), stride_bits(stride_bits) {}
+
+	void TestBody() override {
+		interlace_pass_t const & pass = interlace_passes[pass_index];
+		int samples_per_byte = 8 / stride_bits;
+
+		std::mt19937 rng(pass_index * 8 + stride_bits);
+		for(int width = 1; width <= 70; width++) {
+			int pass_width = count(width, pass.offset_x, pass.period_x);
+			if(!pass_width) continue;
+
+			reduced_image_t image{
+				pass_index, pass_width, 1,
+				(pass_width * stride_bits + 7) / 8, 0, 0
+			};
+			std::vector<uint8_t> row(image.bytes_per_row);
+			std::vector<uint8_t> expected((width * stride_bits + 7) / 8);
+			for(auto & x : row) x = rng();
+			for(auto & x : expected) x = rng();
+			std::vector<uint8_t> actual = expected;
+
+			for(int i = 0, x = pass.offset_x; i < pass_width; i++, x += pass.period_x) {
+				bitcpy_unaligned(
+					&expected[x * stride_bits / 8],
+					row[i / samples_per_byte],
+					(x * stride_bits) % 8,
+					(i % samples_per_byte) * stride_bits,
+					stride_bits
+				);
+			}
+			// row 0 of the pass lands on final row offset_y
+			size_t pitch = expected.size();
+			std::vector<uint8_t> rows(pass.offset_y * pitch);
+			rows.insert(rows.end(), actual.begin(), actual.end());
+			scatter_row(rows.data(), pitch, row.data(), image, 0, stride_bits);
+			actual.assign(rows.end() - pitch, rows.end());
+			EXPECT_EQ(actual, expected) << width << " pixels";
+		}
+	}
+};
+
+}
@@ -1,4 +1,8 @@
 #include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <memory_resource>
+#include <iterator>
 #include <stdexcept>
 #include <string>
 
@@ -10,24 +14,28 @@
 
 namespace rpng {
 
+constexpr inflate_backend_t inflate_backends[] = {
+	INFLATE_BACKEND_ZLIB, INFLATE_BACKEND_LIBDEFLATE, INFLATE_BACKEND_BUILTIN
+};
+
 class ParseTest : public testing::Test {
 private:
 	std::string filepath;
 	bool should_fail;
 
-	void test_success() {
+	void test_success(inflate_backend_t backend) {
 		EXPECT_EXIT(
-			(load(filepath), exit(0)),
+			(load(filepath, { .inflate = backend }), exit(0)),
 			testing::ExitedWithCode(0),
 			".*"
 		) << filepath;
 	}
 
-	void test_failure() {
+	void test_failure(inflate_backend_t backend) {
 		EXPECT_EXIT(
 			{
 				try {
-					load(filepath);
+					load(filepath, { .inflate = backend });
 				} catch(std::runtime_error const & e) {
 					exit(0);
 				}
@@ -35,7 +43,7 @@ private:
 			},
 			testing::ExitedWithCode(0),
 			".*"
-		) << filepath;
+		) << filepath << " with " << inflate_backend_name(backend);
 	}
 
 public:
@@ -43,7 +51,10 @@ public:
 		: filepath(filepath), should_fail(should_fail) {}
 
 	void TestBody() override {
-		should_fail ? test_failure() : test_success(); 
+		for(inflate_backend_t backend : inflate_backends) {
+			if(!inflate_backend_available(backend)) continue;
+			should_fail ? test_failure(backend) : test_success(backend);
+		}
 	}
 };
 
@@ -60,6 +71,87 @@ public:
 
 		SPDLOG_DEBUG("Checking {}, result: {}\n", filepath, a == b);
 		EXPECT_EQ(a, b);
+
+		std::ifstream ifs(filepath, std::ios::binary);
+		std::vector<uint8_t> buf(
+			(std::istreambuf_iterator<char>(ifs)),
+			std::istreambuf_iterator<char>()
+		);
+		EXPECT_EQ(load(std::span<uint8_t const>(buf)), b) << "from buffer";
+
+		std::vector<uint8_t> rows;
+		auto [ihdr_data, colours] = load_rows(buf, [&](
+			reduced_image_t const & image, int y, std::span<uint8_t const> row
+		) {
+			rows.insert(rows.end(), row.begin(), row.end());
+		});
+		if(!ihdr_data.interlace) {
+			EXPECT_EQ(rows, b) << "row by row";
+		}
+
+		static thread_pool_t pool(4);
+		decode_options_t parallel{ .pool = &pool, .parallel_threshold = 0 };
+		EXPECT_EQ(load(filepath, parallel), b) << "parallel";
+
+		// whole-buffer reconstruction scattering straight into the image
+		if(ihdr_data.interlace) {
+			reader_t reader{ buf };
+			parse_png_header(reader);
+			parse_ihdr(reader);
+			image_layout_t layout = image_layout(ihdr_data, colours);
+			std::vector<uint8_t> filtered(layout.filtered_size);
+			inflate_exact(pack_idat_chunks(reader), filtered);
+
+			std::vector<uint8_t> raw(layout.raw_size);
+			reconstruct_deinterlace(
+				filtered, layout, ihdr_data.height,
+				raw.data(), layout.bytes_per_row
+			);
+			EXPECT_EQ(raw, b) << "fused deinterlace";
+		}
+
+		for(inflate_backend_t backend : inflate_backends) {
+			if(!inflate_backend_available(backend)) {
+				SPDLOG_WARN("Skipping {}", inflate_backend_name(backend));
+				continue;
+			}
+			std::string name = inflate_backend_name(backend);
+			EXPECT_EQ(load(filepath, { .inflate = backend }), b) << name;
+			EXPECT_EQ(load(filepath, {
+				.pool = &pool, .parallel_threshold = 0, .inflate = backend
+			}), b) << name << ", parallel";
+		}
+
+		decode_options_t pipelined{ .pipeline = true, .parallel_threshold = 0 };
+		EXPECT_EQ(load(filepath, pipelined), b) << "pipelined";
+
+		// into padded rows of caller memory, with every temporary taken from
+		// a fixed arena that cannot grow
+		size_t row_size = b.size() / ihdr_data.height;
+		size_t pitch = row_size + 13;
+		std::vector<uint8_t> storage(1 << 20);
+		decode_scratch_t scratch;
+		for(thread_pool_t * route : { (thread_pool_t *)nullptr, &pool }) {
+			std::pmr::monotonic_buffer_resource arena(
+				storage.data(), storage.size(), std::pmr::null_memory_resource()
+			);
+			std::vector<uint8_t> canvas(ihdr_data.height * pitch, 0xaa);
+			for(size_t y = 0; y < ihdr_data.height; y++)
+				std::fill_n(&canvas[y * pitch], row_size, 0);
+
+			load_into(buf, canvas, pitch, scratch, {
+				.pool = route, .parallel_threshold = 0, .memory = &arena
+			});
+			for(size_t y = 0; y < ihdr_data.height; y++) {
+				auto row = canvas.begin() + y * pitch;
+				ASSERT_TRUE(std::equal(
+					row, row + row_size, b.begin() + y * row_size
+				)) << "into a pitch, row " << y;
+				ASSERT_EQ(
+					std::count(row + row_size, row + pitch, 0xaa), 13
+				) << "past the row, row " << y;
+			}
+		}
 	}
 };
 
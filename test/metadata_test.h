@@ -0,0 +1,267 @@
+#include <csetjmp>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <optional>
+
+#include <gtest/gtest.h>
+#include <png.h>
+#include <zlib.h>
+
+#include "metadata.h"
+#include "probe.h"
+#include "save.h"
+#include "mmap.h"
+
+namespace rpng {
+
+// Reads a file's text, gAMA and pHYs through libpng, and the same through an
+// index from a decode, and checks that they agree, that the decode's index
+// matches index_chunks(), and that a bad CRC in a text chunk only fails the
+// read of its text. Then adds zTXt, iTXt and iCCP chunks that PngSuite lacks,
+// and reads them back.
+class MetadataTest : public testing::Test {
+private:
+	std::string filepath;
+
+	struct libpng_metadata_t {
+		std::vector<text_t> text;
+		std::optional<png_fixed_point> gamma;
+		std::optional<physical_dimensions_t> dimensions;
+	};
+
+	static libpng_metadata_t read_libpng(std::string const & filepath) {
+		FILE * file = fopen(filepath.c_str(), "rb");
+		if(!file) throw std::runtime_error("Cannot open file");
+
+		png_struct * png = png_create_read_struct(
+			PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr
+		);
+		png_info * info = png_create_info_struct(png);
+		libpng_metadata_t metadata;
+		if(setjmp(png_jmpbuf(png))) {
+			png_destroy_read_struct(&png, &info, nullptr);
+			fclose(file);
+			throw std::runtime_error("libpng failed to read");
+		}
+
+		png_init_io(png, file);
+		png_read_png(png, info, PNG_TRANSFORM_IDENTITY, nullptr);
+
+		png_text * texts = nullptr;
+		int num_texts = png_get_text(png, info, &texts, nullptr);
+		for(int i = 0; i < num_texts; i++) {
+			text_t text{};
+			int compression = texts[i].compression;
+			text.type = compression == PNG_TEXT_COMPRESSION_NONE
+				? CHUNK_TYPE_TEXT
+				: compression == PNG_TEXT_COMPRESSION_zTXt
+				? CHUNK_TYPE_ZTXT
+				: CHUNK_TYPE_ITXT;
+			text.keyword = texts[i].key;
+			text.text = texts[i].text;
+			if(text.type == CHUNK_TYPE_ITXT) {
+				text.language = texts[i].lang ? texts[i].lang : "";
+				text.translated_keyword = texts[i].lang_key
+					? texts[i].lang_key : "";
+			}
+			metadata.text.push_back(text);
+		}
+
+		png_fixed_point gamma;
+		if(png_get_gAMA_fixed(png, info, &gamma)) metadata.gamma = gamma;
+
+		png_uint_32 x, y;
+		int unit;
+		if(png_get_pHYs(png, info, &x, &y, &unit))
+			metadata.dimensions = { x, y, (uint8_t)unit };
+
+		png_destroy_read_struct(&png, &info, nullptr);
+		fclose(file);
+		return metadata;
+	}
+
+	static void expect_same(
+		std::vector<text_t> const & actual,
+		std::vector<text_t> const & expected,
+		std::string const & what
+	) {
+		ASSERT_EQ(actual.size(), expected.size()) << what;
+		for(size_t i = 0; i < actual.size(); i++) {
+			EXPECT_EQ(actual[i].type, expected[i].type) << what;
+			EXPECT_EQ(actual[i].keyword, expected[i].keyword) << what;
+			EXPECT_EQ(actual[i].text, expected[i].text) << what;
+			EXPECT_EQ(actual[i].language, expected[i].language) << what;
+			EXPECT_EQ(
+				actual[i].translated_keyword, expected[i].translated_keyword
+			) << what;
+		}
+	}
+
+	static std::vector<uint8_t> compress(std::string_view text) {
+		std::vector<uint8_t> out(compressBound(text.size()));
+		uLongf size = out.size();
+		::compress(out.data(), &size, (Bytef const *)text.data(), text.size());
+		out.resize(size);
+		return out;
+	}
+
+	// The datastream with `chunks` inserted after IHDR
+	static std::vector<uint8_t> insert_chunks(
+		std::span<uint8_t const> png,
+		std::vector<std::pair<uint32_t, std::vector<uint8_t>>> const & chunks
+	) {
+		size_t after_ihdr = PNG_HEADER_SIZE;
+		std::vector<uint8_t> out(png.begin(), png.begin() + after_ihdr);
+		for(auto const & [type, data] : chunks) write_chunk(out, type, data);
+		out.insert(out.end(), png.begin() + after_ihdr, png.end());
+		return out;
+	}
+
+public:
+	MetadataTest(std::string const & filepath) : filepath(filepath) {}
+
+	void TestBody() override {
+		mapped_file_t file(filepath);
+		std::span<uint8_t const> png = file.span();
+
+		chunk_index_t index;
+		std::vector<uint8_t> expected = load(png, { .chunks = &index });
+		metadata_t metadata(png, index);
+		libpng_metadata_t reference = read_libpng(filepath);
+
+		expect_same(metadata.text(), reference.text, filepath);
+		for(text_t const & text : reference.text) {
+			std::optional<text_t> found = metadata.text(text.keyword);
+			ASSERT_TRUE(found) << filepath << ", " << text.keyword;
+		}
+		EXPECT_FALSE(metadata.text("Missing keyword")) << filepath;
+
+		EXPECT_EQ(metadata.gamma().has_value(), reference.gamma.has_value())
+			<< filepath;
+		if(reference.gamma) {
+			EXPECT_EQ(*metadata.gamma(), *reference.gamma / 100000.0)
+				<< filepath;
+		}
+
+		auto dimensions = metadata.physical_dimensions();
+		EXPECT_EQ(dimensions.has_value(), reference.dimensions.has_value())
+			<< filepath;
+		if(dimensions && reference.dimensions) {
+			EXPECT_EQ(dimensions->x, reference.dimensions->x) << filepath;
+			EXPECT_EQ(dimensions->y, reference.dimensions->y) << filepath;
+			EXPECT_EQ(dimensions->unit, reference.dimensions->unit) << filepath;
+		}
+
+		chunk_index_t indexed = index_chunks(png);
+		ASSERT_EQ(indexed.chunks().size(), index.chunks().size()) << filepath;
+		for(size_t i = 0; i < index.chunks().size(); i++) {
+			chunk_entry_t const & a = indexed.chunks()[i];
+			chunk_entry_t const & b = index.chunks()[i];
+			EXPECT_EQ(a.type, b.type) << filepath;
+			EXPECT_EQ(a.length, b.length) << filepath;
+			EXPECT_EQ(a.offset, b.offset) << filepath;
+			EXPECT_EQ(a.crc, b.crc) << filepath;
+		}
+
+		// metadata is only checked once read
+		if(chunk_entry_t const * text = index.find(CHUNK_TYPE_TEXT)) {
+			std::vector<uint8_t> corrupt(png.begin(), png.end());
+			corrupt[text->offset + text->length] ^= 1;
+
+			chunk_index_t corrupt_index;
+			EXPECT_EQ(load(std::span<uint8_t const>(corrupt), {
+				.chunks = &corrupt_index
+			}), expected) << filepath;
+			EXPECT_EQ(
+				load(std::span<uint8_t const>(corrupt), {
+					.format = PIXEL_FORMAT_RGBA8
+				}),
+				load(png, { .format = PIXEL_FORMAT_RGBA8 })
+			) << filepath;
+			EXPECT_ANY_THROW(metadata_t(corrupt, corrupt_index).text())
+				<< filepath;
+
+			// a lookup checks only the chunk it finds
+			metadata_t corrupt_metadata(corrupt, corrupt_index);
+			EXPECT_FALSE(corrupt_metadata.text("Missing keyword")) << filepath;
+			reader_t reader{ std::span<uint8_t const>(corrupt).subspan(
+				text->offset, text->length
+			) };
+			std::string keyword = read_keyword(reader, "keyword");
+			EXPECT_ANY_THROW(corrupt_metadata.text(keyword)) << filepath;
+			EXPECT_EQ(
+				metadata_t(corrupt, corrupt_index, false).text().size(),
+				reference.text.size()
+			) << filepath;
+		}
+
+		std::string profile = "not really an ICC profile";
+		std::string ztxt = "Compressed comment";
+		std::string itxt = "\xe6\x96\x87\xe5\xad\x97";
+
+		std::vector<uint8_t> iccp_data = { 'r', 'p', 'n', 'g', 0, 0 };
+		std::vector<uint8_t> deflated = compress(profile);
+		iccp_data.insert(iccp_data.end(), deflated.begin(), deflated.end());
+
+		std::vector<uint8_t> ztxt_data = { 'Z', 0, 0 };
+		deflated = compress(ztxt);
+		ztxt_data.insert(ztxt_data.end(), deflated.begin(), deflated.end());
+
+		std::vector<uint8_t> itxt_data = {
+			'I', 0, 1, 0, 'j', 'a', 0, 'T', 'i', 't', 'l', 'e', 0
+		};
+		deflated = compress(itxt);
+		itxt_data.insert(itxt_data.end(), deflated.begin(), deflated.end());
+
+		std::vector<uint8_t> extended = insert_chunks(png, {
+			{ CHUNK_TYPE_ICCP, iccp_data },
+			{ CHUNK_TYPE_ZTXT, ztxt_data },
+			{ CHUNK_TYPE_ITXT, itxt_data }
+		});
+		chunk_index_t extended_index = index_chunks(extended);
+		metadata_t extended_metadata(extended, extended_index);
+
+		std::optional<icc_profile_t> icc = extended_metadata.icc_profile();
+		ASSERT_TRUE(icc) << filepath;
+		EXPECT_EQ(icc->name, "rpng") << filepath;
+		EXPECT_EQ(
+			std::string(icc->profile.begin(), icc->profile.end()), profile
+		) << filepath;
+
+		std::vector<text_t> texts = extended_metadata.text();
+		ASSERT_EQ(texts.size(), reference.text.size() + 2) << filepath;
+		EXPECT_EQ(texts[0].type, CHUNK_TYPE_ZTXT) << filepath;
+		EXPECT_EQ(texts[0].keyword, "Z") << filepath;
+		EXPECT_EQ(texts[0].text, ztxt) << filepath;
+		EXPECT_EQ(texts[1].type, CHUNK_TYPE_ITXT) << filepath;
+		EXPECT_EQ(texts[1].keyword, "I") << filepath;
+		EXPECT_EQ(texts[1].language, "ja") << filepath;
+		EXPECT_EQ(texts[1].translated_keyword, "Title") << filepath;
+		EXPECT_EQ(texts[1].text, itxt) << filepath;
+		EXPECT_EQ(extended_metadata.text("I")->text, itxt) << filepath;
+
+		// inflated sizes are capped, at the limit given or else at 8 MiB
+		EXPECT_ANY_THROW(
+			metadata_t(extended, extended_index, true, ztxt.size() - 1).text("Z")
+		) << filepath;
+		EXPECT_EQ(
+			metadata_t(extended, extended_index, true, ztxt.size()).text("Z")->text,
+			ztxt
+		) << filepath;
+		EXPECT_ANY_THROW(
+			metadata_t(extended, extended_index, true, profile.size() - 1)
+				.icc_profile()
+		) << filepath;
+
+		ztxt_data[2] = 1;
+		std::vector<uint8_t> bad_method = insert_chunks(png, {
+			{ CHUNK_TYPE_ZTXT, ztxt_data }
+		});
+		chunk_index_t bad_index = index_chunks(bad_method);
+		EXPECT_ANY_THROW(metadata_t(bad_method, bad_index).text())
+			<< filepath;
+	}
+};
+
+}
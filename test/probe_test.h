@@ -0,0 +1,77 @@
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include "probe.h"
+#include "batch.h"
+
+namespace rpng {
+
+// Probes every file, valid or not, by path, from memory, from just its first
+// PNG_HEADER_SIZE bytes and as a batch, and checks that all agree with
+// parsing IHDR from the mapped file
+class ProbeTest : public testing::Test {
+private:
+	std::vector<std::string> filepaths;
+
+	static void expect_same(
+		std::pair<chunk_ihdr_data_t, colour_properties_t> const & probed,
+		chunk_ihdr_data_t const & ihdr,
+		std::string const & what
+	) {
+		EXPECT_EQ(memcmp(&probed.first, &ihdr, sizeof(ihdr)), 0) << what;
+		EXPECT_EQ(probed.second.colour_type, ihdr.colour_type) << what;
+	}
+
+public:
+	ProbeTest(std::vector<std::string> const & filepaths)
+		: filepaths(filepaths) {}
+
+	void TestBody() override {
+		batch_decoder_t batch(4);
+		std::vector<probe_result_t> results = batch.probe_all(filepaths);
+		ASSERT_EQ(results.size(), filepaths.size());
+
+		for(size_t i = 0; i < filepaths.size(); i++) {
+			std::string const & filepath = filepaths[i];
+			mapped_file_t file(filepath);
+
+			chunk_ihdr_data_t ihdr{};
+			bool valid = true;
+			try {
+				reader_t reader{ file.span() };
+				parse_png_header(reader);
+				ihdr = parse_ihdr(reader).first;
+			} catch(std::runtime_error const &) {
+				valid = false;
+			}
+
+			EXPECT_EQ(!results[i].error, valid) << filepath;
+			if(!valid) {
+				EXPECT_ANY_THROW(probe(filepath)) << filepath;
+				EXPECT_ANY_THROW(probe(file.span())) << filepath;
+				continue;
+			}
+
+			expect_same(probe(filepath), ihdr, filepath);
+			expect_same(probe(file.span()), ihdr, filepath + ", in memory");
+			expect_same(
+				probe(file.span().first(PNG_HEADER_SIZE)), ihdr,
+				filepath + ", header only"
+			);
+			expect_same(
+				{ results[i].ihdr, results[i].colours }, ihdr,
+				filepath + ", batch"
+			);
+			EXPECT_ANY_THROW(probe(file.span().first(PNG_HEADER_SIZE - 5)))
+				<< filepath;
+		}
+
+		EXPECT_ANY_THROW(probe(std::string("resources/missing.png")));
+		EXPECT_TRUE(batch.probe_all({ "resources/missing.png" })[0].error);
+	}
+};
+
+}
@@ -0,0 +1,57 @@
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "rowfilter.h"
+#include "reconstruct.h"
+
+namespace rpng {
+
+// Compares one filter kernel against the byte-wise filter functions on random
+// rows of various lengths, and checks that the row reconstructs
+class FilterTest : public testing::Test {
+private:
+	simd_level_t level;
+	uint8_t filter;
+	int stride;
+
+public:
+	FilterTest(simd_level_t level, uint8_t filter, int stride)
+		: level(level), filter(filter), stride(stride) {}
+
+	void TestBody() override {
+		filter_row_fn_t fn = filter_table(level)[filter][stride];
+		filter_fn_t F = filter_fn[filter];
+
+		std::mt19937 rng(filter * 16 + stride);
+		for(int pixels : { 1, 2, 5, 15, 16, 17, 33, 100, 257 }) {
+			int n = pixels * stride;
+			std::vector<uint8_t> src(n), prev(n);
+			for(auto & x : src) x = rng();
+			for(auto & x : prev) x = rng();
+
+			std::vector<uint8_t> expected(n), actual(n);
+			uint64_t expected_cost = 0;
+			for(int i = 0; i < n; i++) {
+				uint8_t a = i >= stride ? src[i - stride] : 0;
+				uint8_t c = i >= stride ? prev[i - stride] : 0;
+				expected[i] = F(src[i], a, prev[i], c);
+				expected_cost += signed_magnitude(expected[i]);
+			}
+
+			uint64_t cost = fn(actual.data(), src.data(), prev.data(), n);
+			EXPECT_EQ(cost, expected_cost) << n << " bytes, cost";
+			EXPECT_EQ(actual, expected) << n << " bytes";
+
+			std::vector<uint8_t> reconstructed(n);
+			reconstruct_row_scalar(
+				reconstructed.data(), actual.data(), prev.data(),
+				filter, stride, n
+			);
+			EXPECT_EQ(reconstructed, src) << n << " bytes, round trip";
+		}
+	}
+};
+
+}
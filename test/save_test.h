@@ -0,0 +1,83 @@
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "load.h"
+#include "save.h"
+#include "libpng.h"
+
+namespace rpng {
+
+// Re-encodes a decoded image and checks that both rpng and libpng, which also
+// verifies every CRC, read back the same pixels
+class EncodeTest : public testing::Test {
+private:
+	std::string filepath;
+	int effort;
+
+public:
+	EncodeTest(std::string const & filepath, int effort)
+		: filepath(filepath), effort(effort) {}
+
+	void TestBody() override {
+		mapped_file_t file(filepath);
+		reader_t reader{ file.span() };
+		parse_png_header(reader);
+		auto [ihdr_data, colours] = parse_ihdr(reader);
+		ihdr_data.interlace = 0;
+
+		std::vector<uint8_t> img = load(file.span());
+
+		std::vector<uint8_t> palette;
+		if(ihdr_data.colour_type == COLOUR_TYPE_INDEXED_COLOUR) {
+			for(int i = 0; i < 3 << ihdr_data.bit_depth; i++)
+				palette.push_back(i / 3);
+		}
+
+		std::vector<uint8_t> png = save(img, ihdr_data, {
+			.effort = effort,
+			.palette = palette
+		});
+		EXPECT_EQ(load(png), img) << filepath;
+		EXPECT_EQ(decode(std::span<uint8_t const>(png)), img) << filepath;
+
+		std::vector<uint8_t> fast = save(img, ihdr_data, {
+			.fast = true,
+			.palette = palette
+		});
+		EXPECT_EQ(load(fast), img) << "fast";
+		EXPECT_EQ(decode(std::span<uint8_t const>(fast)), img) << "fast, libpng";
+
+		// bands of a few rows each, primed with the previous band or indexed
+		static thread_pool_t pool(4);
+		for(bool indexed : { false, true }) {
+			std::vector<uint8_t> banded = save(img, ihdr_data, {
+				.effort = effort,
+				.palette = palette,
+				.pool = &pool,
+				.band_size = 64,
+				.segment_index = indexed
+			});
+			EXPECT_EQ(load(banded), img) << "banded";
+			EXPECT_EQ(decode(std::span<uint8_t const>(banded)), img)
+				<< "banded, libpng";
+			if(!indexed) continue;
+
+			reader_t banded_reader{ banded };
+			parse_png_header(banded_reader);
+			parse_ihdr(banded_reader);
+			segment_index_t segments;
+			idat_list_t idats = pack_idat_chunks(banded_reader, segments);
+
+			std::vector<uint8_t> raw(img.size());
+			if(segments.size() > 1) {
+				image_layout_t layout = image_layout(ihdr_data, colours);
+				decode_segmented(layout, idats, segments, raw.data(), pool);
+				EXPECT_EQ(raw, img) << "segmented decode";
+			}
+		}
+	}
+};
+
+}
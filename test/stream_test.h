@@ -0,0 +1,75 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "stream.h"
+
+namespace rpng {
+
+// Feeds a file to the push-mode decoder in pieces of various sizes, and
+// checks its rows and passes against load_rows(). The first row must be out
+// before the file has been read to its end, and a cut-off file must fail.
+class StreamTest : public testing::Test {
+private:
+	std::string filepath;
+
+public:
+	StreamTest(std::string const & filepath) : filepath(filepath) {}
+
+	void TestBody() override {
+		mapped_file_t file(filepath);
+		std::span<uint8_t const> png = file.span();
+
+		std::vector<uint8_t> expected;
+		load_rows(png, [&](
+			reduced_image_t const & image, int y, std::span<uint8_t const> row
+		) {
+			expected.insert(expected.end(), row.begin(), row.end());
+		});
+
+		std::vector<uint8_t> rows;
+		std::vector<int> passes;
+		size_t fed = 0, first_row_at = 0;
+		stream_decoder_t decoder([&](
+			reduced_image_t const & image, int y, std::span<uint8_t const> row
+		) {
+			if(rows.empty()) first_row_at = fed;
+			EXPECT_TRUE(decoder.has_header());
+			rows.insert(rows.end(), row.begin(), row.end());
+		}, [&](reduced_image_t const & image) {
+			passes.push_back(image.pass);
+		});
+
+		for(size_t piece : { 1, 7, 64, 1460, 1 << 20 }) {
+			rows.clear();
+			passes.clear();
+			for(fed = 0; fed < png.size(); fed += piece) {
+				decoder.feed(png.subspan(fed, std::min(piece, png.size() - fed)));
+			}
+			decoder.finish();
+			EXPECT_TRUE(decoder.done()) << piece;
+			EXPECT_EQ(rows, expected) << piece << " byte pieces";
+
+			image_layout_t const & layout = decoder.layout();
+			ASSERT_EQ(passes.size(), (size_t)layout.num_passes) << piece;
+			for(int i = 0; i < layout.num_passes; i++)
+				EXPECT_EQ(passes[i], layout.passes[i].pass) << piece;
+
+			// IEND alone is 12 bytes
+			if(piece == 1) {
+				EXPECT_LT(first_row_at, png.size() - 12);
+			}
+			decoder.reset();
+		}
+
+		decoder.feed(png.first(png.size() / 2));
+		EXPECT_ANY_THROW(decoder.finish()) << "half of the file";
+		decoder.reset();
+		decoder.feed(png.first(20));
+		EXPECT_ANY_THROW(decoder.finish()) << "part of the header";
+	}
+};
+
+}
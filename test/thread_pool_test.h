@@ -0,0 +1,44 @@
+#include <atomic>
+#include <future>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "thread_pool.h"
+
+namespace rpng {
+
+// Runs many tiny tasks, which race their own posting, from outside the pool
+// and nested within tasks, and checks that each runs once and that the pool
+// goes back to sleep, so a task posted much later still runs
+class ThreadPoolTest : public testing::Test {
+private:
+	int num_threads;
+
+public:
+	ThreadPoolTest(int num_threads) : num_threads(num_threads) {}
+
+	void TestBody() override {
+		thread_pool_t pool(num_threads);
+		for(int round = 0; round < 50; round++) {
+			std::vector<std::atomic<int>> runs(64);
+			pool.parallel_for(8, [&](int i) {
+				pool.parallel_for(8, [&](int j) { runs[8 * i + j]++; });
+			});
+			for(auto const & count : runs) EXPECT_EQ(count, 1) << round;
+
+			std::atomic<int> total = 0;
+			std::vector<std::future<void>> futures;
+			for(int i = 0; i < 200; i++)
+				futures.push_back(pool.submit([&] { total++; }));
+			pool.wait(futures);
+			EXPECT_EQ(total, 200) << round;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		EXPECT_EQ(pool.submit([] { return 7; }).get(), 7);
+		EXPECT_EQ(pool.worker_index(), -1);
+	}
+};
+
+}
@@ -0,0 +1,53 @@
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "reconstruct.h"
+
+namespace rpng {
+
+// Compares one unfilter kernel against the scalar reconstruction loop on
+// random rows of various lengths, both in place and out of place
+class UnfilterTest : public testing::Test {
+private:
+	simd_level_t level;
+	uint8_t filter;
+	int stride;
+
+public:
+	UnfilterTest(simd_level_t level, uint8_t filter, int stride)
+		: level(level), filter(filter), stride(stride) {}
+
+	void TestBody() override {
+		unfilter_fn_t fn = unfilter_table(level)[filter][stride];
+
+		std::mt19937 rng(filter * 16 + stride);
+		for(int pixels : { 1, 2, 5, 15, 16, 17, 33, 100, 257 }) {
+			int n = pixels * stride;
+			std::vector<uint8_t> src(n), prev(n);
+			for(auto & x : src) x = rng();
+			for(auto & x : prev) x = rng();
+
+			std::vector<uint8_t> expected(n), actual(n), in_place = src;
+			reconstruct_row_scalar(
+				expected.data(), src.data(), prev.data(), filter, stride, n
+			);
+			fn(actual.data(), src.data(), prev.data(), n);
+			fn(in_place.data(), in_place.data(), prev.data(), n);
+
+			EXPECT_EQ(actual, expected) << n << " bytes";
+			EXPECT_EQ(in_place, expected) << n << " bytes, in place";
+
+			reconstruct_row_scalar(
+				expected.data(), src.data(), nullptr, filter, stride, n
+			);
+			reconstruct_row(
+				actual.data(), src.data(), nullptr, filter, stride, n
+			);
+			EXPECT_EQ(actual, expected) << n << " bytes, first row";
+		}
+	}
+};
+
+}